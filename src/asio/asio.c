@@ -11,148 +11,347 @@
 #include "asio.h"
 #include "cwASIO.h"
 #include <stdlib.h>
+#ifdef _WIN32
+#   include <Windows.h>
+#endif
+
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
 
 
 static struct cwASIODriver *theAsioDriver = NULL;
+static THREAD_LOCAL struct cwASIODriver *currentAsioDriver = NULL;
 
-ASIOError ASIOLoad(char const *id, char const *name) {
-    if(theAsioDriver)
-        return ASE_NoMemory;
-    ASIOError err = cwASIOload(id, &theAsioDriver);
+// The driver that the functions without a handle use in the calling thread.
+static struct cwASIODriver *current(void) {
+    return currentAsioDriver ? currentAsioDriver : theAsioDriver;
+}
+
+static ASIOError load(char const *id, char const *name, struct cwASIODriver **drv) {
+    ASIOError err = cwASIOload(id, drv);
     if(err != ASE_OK && err != ASE_SUCCESS) {
-        theAsioDriver = NULL;
+        *drv = NULL;
         return err;
     }
-    err = theAsioDriver->lpVtbl->future(theAsioDriver, kcwASIOsetInstanceName, (void *)name);
-    return err == ASE_SUCCESS || err == ASE_InvalidParameter ? ASE_OK : err;
+    err = (*drv)->lpVtbl->future(*drv, kcwASIOsetInstanceName, (void *)name);
+    if (err != ASE_SUCCESS && err != ASE_InvalidParameter) {
+        cwASIOunload(*drv);
+        *drv = NULL;
+        return err;
+    }
+    return ASE_OK;
+}
+
+ASIOError ASIOLoad(char const *id, char const *name) {
+    if(theAsioDriver)
+        return ASE_NoMemory;
+    return load(id, name, &theAsioDriver);
 }
 
 ASIOError ASIOUnload(void) {
     if (!theAsioDriver || !theAsioDriver->lpVtbl)
         return ASE_InvalidParameter;
+    if (currentAsioDriver == theAsioDriver)
+        currentAsioDriver = NULL;
     cwASIOunload(theAsioDriver);
     theAsioDriver = NULL;
     return ASE_OK;
 }
 
-ASIOError ASIOInit(ASIODriverInfo *info) {
-    if(!theAsioDriver || !theAsioDriver->lpVtbl)
+ASIOError ASIOLoadEx(char const *id, char const *name, ASIOHandle *handle) {
+    if(!handle)
+        return ASE_InvalidParameter;
+    return load(id, name, handle);
+}
+
+ASIOError ASIOUnloadEx(ASIOHandle handle) {
+    if (!handle || !handle->lpVtbl)
+        return ASE_InvalidParameter;
+    if (handle == theAsioDriver)
+        return ASIOUnload();
+    if (currentAsioDriver == handle)
+        currentAsioDriver = NULL;
+    cwASIOunload(handle);
+    return ASE_OK;
+}
+
+ASIOHandle ASIOSelect(ASIOHandle handle) {
+    ASIOHandle previous = currentAsioDriver;
+    currentAsioDriver = handle;
+    return previous;
+}
+
+ASIOHandle ASIOCurrent(void) {
+    return current();
+}
+
+ASIOError ASIOInitEx(ASIOHandle drv, ASIODriverInfo *info) {
+    if(!drv || !drv->lpVtbl)
         return ASE_NotPresent;
-    if (!theAsioDriver->lpVtbl->init(theAsioDriver, info ? info->sysRef : 0))
+    if (!drv->lpVtbl->init(drv, info ? info->sysRef : 0))
         return ASE_NotPresent;
     if(info) {
         info->asioVersion = 2;
-        theAsioDriver->lpVtbl->getDriverName(theAsioDriver, info->name);
-        info->driverVersion = theAsioDriver->lpVtbl->getDriverVersion(theAsioDriver);
-        theAsioDriver->lpVtbl->getErrorMessage(theAsioDriver, info->errorMessage);
+        drv->lpVtbl->getDriverName(drv, info->name);
+        info->driverVersion = drv->lpVtbl->getDriverVersion(drv);
+        drv->lpVtbl->getErrorMessage(drv, info->errorMessage);
     }
     return ASE_OK;
 }
 
-ASIOError ASIOExit(void) {
+ASIOError ASIOInit(ASIODriverInfo *info) {
+    return ASIOInitEx(current(), info);
+}
+
+ASIOError ASIOExitEx(ASIOHandle drv) {
+    (void)drv;
     return ASE_OK;
 }
 
+ASIOError ASIOExit(void) {
+    return ASIOExitEx(current());
+}
+
+ASIOError ASIOStartEx(ASIOHandle drv) {
+    if (!drv || !drv->lpVtbl)
+        return ASE_NotPresent;
+    return drv->lpVtbl->start(drv);
+}
+
 ASIOError ASIOStart(void) {
-    if (!theAsioDriver || !theAsioDriver->lpVtbl)
+    return ASIOStartEx(current());
+}
+
+ASIOError ASIOStopEx(ASIOHandle drv) {
+    if (!drv || !drv->lpVtbl)
         return ASE_NotPresent;
-    return theAsioDriver->lpVtbl->start(theAsioDriver);
+    return drv->lpVtbl->stop(drv);
 }
 
 ASIOError ASIOStop(void) {
-    if (!theAsioDriver || !theAsioDriver->lpVtbl)
+    return ASIOStopEx(current());
+}
+
+ASIOError ASIOGetChannelsEx(ASIOHandle drv, long *numInputChannels, long *numOutputChannels) {
+    if (!drv || !drv->lpVtbl)
         return ASE_NotPresent;
-    return theAsioDriver->lpVtbl->stop(theAsioDriver);
+    return drv->lpVtbl->getChannels(drv, numInputChannels, numOutputChannels);
 }
 
 ASIOError ASIOGetChannels(long *numInputChannels, long *numOutputChannels) {
-    if (!theAsioDriver || !theAsioDriver->lpVtbl)
+    return ASIOGetChannelsEx(current(), numInputChannels, numOutputChannels);
+}
+
+ASIOError ASIOGetLatenciesEx(ASIOHandle drv, long *inputLatency, long *outputLatency) {
+    if (!drv || !drv->lpVtbl)
         return ASE_NotPresent;
-    return theAsioDriver->lpVtbl->getChannels(theAsioDriver, numInputChannels, numOutputChannels);
+    return drv->lpVtbl->getLatencies(drv, inputLatency, outputLatency);
 }
 
 ASIOError ASIOGetLatencies(long *inputLatency, long *outputLatency) {
-    if (!theAsioDriver || !theAsioDriver->lpVtbl)
+    return ASIOGetLatenciesEx(current(), inputLatency, outputLatency);
+}
+
+ASIOError ASIOGetBufferSizeEx(ASIOHandle drv, long *minSize, long *maxSize, long *preferredSize, long *granularity) {
+    if (!drv || !drv->lpVtbl)
         return ASE_NotPresent;
-    return theAsioDriver->lpVtbl->getLatencies(theAsioDriver, inputLatency, outputLatency);
+    return drv->lpVtbl->getBufferSize(drv, minSize, maxSize, preferredSize, granularity);
 }
 
 ASIOError ASIOGetBufferSize(long *minSize, long *maxSize, long *preferredSize, long *granularity) {
-    if (!theAsioDriver || !theAsioDriver->lpVtbl)
+    return ASIOGetBufferSizeEx(current(), minSize, maxSize, preferredSize, granularity);
+}
+
+ASIOError ASIOCanSampleRateEx(ASIOHandle drv, ASIOSampleRate sampleRate) {
+    if (!drv || !drv->lpVtbl)
         return ASE_NotPresent;
-    return theAsioDriver->lpVtbl->getBufferSize(theAsioDriver, minSize, maxSize, preferredSize, granularity);
+    return drv->lpVtbl->canSampleRate(drv, sampleRate);
 }
 
 ASIOError ASIOCanSampleRate(ASIOSampleRate sampleRate) {
-    if (!theAsioDriver || !theAsioDriver->lpVtbl)
+    return ASIOCanSampleRateEx(current(), sampleRate);
+}
+
+ASIOError ASIOGetSampleRateEx(ASIOHandle drv, ASIOSampleRate *currentRate) {
+    if (!drv || !drv->lpVtbl)
         return ASE_NotPresent;
-    return theAsioDriver->lpVtbl->canSampleRate(theAsioDriver, sampleRate);
+    return drv->lpVtbl->getSampleRate(drv, currentRate);
 }
 
 ASIOError ASIOGetSampleRate(ASIOSampleRate *currentRate) {
-    if (!theAsioDriver || !theAsioDriver->lpVtbl)
+    return ASIOGetSampleRateEx(current(), currentRate);
+}
+
+ASIOError ASIOSetSampleRateEx(ASIOHandle drv, ASIOSampleRate sampleRate) {
+    if (!drv || !drv->lpVtbl)
         return ASE_NotPresent;
-    return theAsioDriver->lpVtbl->getSampleRate(theAsioDriver, currentRate);
+    return drv->lpVtbl->setSampleRate(drv, sampleRate);
 }
 
 ASIOError ASIOSetSampleRate(ASIOSampleRate sampleRate) {
-    if (!theAsioDriver || !theAsioDriver->lpVtbl)
+    return ASIOSetSampleRateEx(current(), sampleRate);
+}
+
+ASIOError ASIOGetClockSourcesEx(ASIOHandle drv, ASIOClockSource *clocks, long *numSources) {
+    if (!drv || !drv->lpVtbl)
         return ASE_NotPresent;
-    return theAsioDriver->lpVtbl->setSampleRate(theAsioDriver, sampleRate);
+    return drv->lpVtbl->getClockSources(drv, clocks, numSources);
 }
 
 ASIOError ASIOGetClockSources(ASIOClockSource *clocks, long *numSources) {
-    if (!theAsioDriver || !theAsioDriver->lpVtbl)
+    return ASIOGetClockSourcesEx(current(), clocks, numSources);
+}
+
+ASIOError ASIOSetClockSourceEx(ASIOHandle drv, long reference) {
+    if (!drv || !drv->lpVtbl)
         return ASE_NotPresent;
-    return theAsioDriver->lpVtbl->getClockSources(theAsioDriver, clocks, numSources);
+    return drv->lpVtbl->setClockSource(drv, reference);
 }
 
 ASIOError ASIOSetClockSource(long reference) {
-    if (!theAsioDriver || !theAsioDriver->lpVtbl)
+    return ASIOSetClockSourceEx(current(), reference);
+}
+
+ASIOError ASIOGetSamplePositionEx(ASIOHandle drv, ASIOSamples *sPos, ASIOTimeStamp *tStamp) {
+    if (!drv || !drv->lpVtbl)
         return ASE_NotPresent;
-    return theAsioDriver->lpVtbl->setClockSource(theAsioDriver, reference);
+    return drv->lpVtbl->getSamplePosition(drv, sPos, tStamp);
 }
 
-ASIOError ASIOGetSamplePosition (ASIOSamples *sPos, ASIOTimeStamp *tStamp) {
-    if (!theAsioDriver || !theAsioDriver->lpVtbl)
+ASIOError ASIOGetSamplePosition(ASIOSamples *sPos, ASIOTimeStamp *tStamp) {
+    return ASIOGetSamplePositionEx(current(), sPos, tStamp);
+}
+
+ASIOError ASIOGetChannelInfoEx(ASIOHandle drv, ASIOChannelInfo *info) {
+    if (!drv || !drv->lpVtbl)
         return ASE_NotPresent;
-    return theAsioDriver->lpVtbl->getSamplePosition(theAsioDriver, sPos, tStamp);
+    return drv->lpVtbl->getChannelInfo(drv, info);
 }
 
 ASIOError ASIOGetChannelInfo(ASIOChannelInfo *info) {
-    if (!theAsioDriver || !theAsioDriver->lpVtbl)
+    return ASIOGetChannelInfoEx(current(), info);
+}
+
+#define FORWARDS 32
+
+// The host's callbacks of a driver with buffers. They are called with the driver
+// selected, so that the ASIO SDK compatible functions work on the callback thread.
+static struct Forward {
+    ASIOHandle drv;                     // the driver using the slot, NULL if free
+    ASIOCallbacks host;
+} forwards[FORWARDS];
+
+#ifdef _WIN32
+static bool exchangeForward(int n, ASIOHandle from, ASIOHandle to) {
+    return InterlockedCompareExchangePointer((void *volatile *)&forwards[n].drv, to, from) == from;
+}
+#else
+static bool exchangeForward(int n, ASIOHandle from, ASIOHandle to) {
+    return __atomic_compare_exchange_n(&forwards[n].drv, &from, to, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+#endif
+
+static void forwardBufferSwitch(void *context, long index, ASIOBool direct) {
+    struct Forward const *f = context;
+    ASIOHandle previous = ASIOSelect(f->drv);
+    f->host.bufferSwitch(index, direct);
+    ASIOSelect(previous);
+}
+
+static void forwardSampleRateDidChange(void *context, ASIOSampleRate rate) {
+    struct Forward const *f = context;
+    ASIOHandle previous = ASIOSelect(f->drv);
+    f->host.sampleRateDidChange(rate);
+    ASIOSelect(previous);
+}
+
+static long forwardAsioMessage(void *context, long selector, long value, void *message, double *opt) {
+    struct Forward const *f = context;
+    ASIOHandle previous = ASIOSelect(f->drv);
+    long result = f->host.asioMessage(selector, value, message, opt);
+    ASIOSelect(previous);
+    return result;
+}
+
+static ASIOTime *forwardBufferSwitchTimeInfo(void *context, ASIOTime *params, long index, ASIOBool direct) {
+    struct Forward const *f = context;
+    ASIOHandle previous = ASIOSelect(f->drv);
+    if (f->host.bufferSwitchTimeInfo)
+        params = f->host.bufferSwitchTimeInfo(params, index, direct);
+    else
+        f->host.bufferSwitch(index, direct);    // the host doesn't support time info
+    ASIOSelect(previous);
+    return params;
+}
+
+ASIOError ASIOCreateBuffersEx(ASIOHandle drv, ASIOBufferInfo *bufferInfos, long numChannels, long bufferSize, ASIOCallbacks const *callbacks) {
+    if (!drv || !drv->lpVtbl)
         return ASE_NotPresent;
-    return theAsioDriver->lpVtbl->getChannelInfo(theAsioDriver, info);
+    if (!callbacks || !callbacks->bufferSwitch || !callbacks->sampleRateDidChange || !callbacks->asioMessage)
+        return ASE_InvalidParameter;
+    int n = 0;
+    while (n < FORWARDS && !exchangeForward(n, NULL, drv))
+        ++n;
+    if (n == FORWARDS)
+        return ASE_NoMemory;
+    forwards[n].host = *callbacks;
+    struct cwASIOUserCallbacks const user = {
+        &forwards[n], &forwardBufferSwitch, &forwardSampleRateDidChange, &forwardAsioMessage, &forwardBufferSwitchTimeInfo
+    };
+    ASIOError err = cwASIOcreateBuffers(drv, bufferInfos, numChannels, bufferSize, &user);
+    if (err != ASE_OK)
+        exchangeForward(n, drv, NULL);
+    return err;
 }
 
 ASIOError ASIOCreateBuffers(ASIOBufferInfo *bufferInfos, long numChannels, long bufferSize, ASIOCallbacks const *callbacks) {
-    if (!theAsioDriver || !theAsioDriver->lpVtbl)
+    return ASIOCreateBuffersEx(current(), bufferInfos, numChannels, bufferSize, callbacks);
+}
+
+ASIOError ASIODisposeBuffersEx(ASIOHandle drv) {
+    if (!drv || !drv->lpVtbl)
         return ASE_NotPresent;
-    return theAsioDriver->lpVtbl->createBuffers(theAsioDriver, bufferInfos, numChannels, bufferSize, callbacks);
+    ASIOError err = cwASIOdisposeBuffers(drv);
+    for (int n = 0; n < FORWARDS; ++n)
+        exchangeForward(n, drv, NULL);
+    return err;
 }
 
 ASIOError ASIODisposeBuffers(void) {
-    if (!theAsioDriver || !theAsioDriver->lpVtbl)
+    return ASIODisposeBuffersEx(current());
+}
+
+ASIOError ASIOControlPanelEx(ASIOHandle drv) {
+    if (!drv || !drv->lpVtbl)
         return ASE_NotPresent;
-    return theAsioDriver->lpVtbl->disposeBuffers(theAsioDriver);
+    return drv->lpVtbl->controlPanel(drv);
 }
 
 ASIOError ASIOControlPanel(void) {
-    if (!theAsioDriver || !theAsioDriver->lpVtbl)
+    return ASIOControlPanelEx(current());
+}
+
+ASIOError ASIOFutureEx(ASIOHandle drv, long selector, void *params) {
+    if (!drv || !drv->lpVtbl)
         return ASE_NotPresent;
-    return theAsioDriver->lpVtbl->controlPanel(theAsioDriver);
+    return drv->lpVtbl->future(drv, selector, params);
 }
 
 ASIOError ASIOFuture(long selector, void *params) {
-    if (!theAsioDriver || !theAsioDriver->lpVtbl)
+    return ASIOFutureEx(current(), selector, params);
+}
+
+ASIOError ASIOOutputReadyEx(ASIOHandle drv) {
+    if (!drv || !drv->lpVtbl)
         return ASE_NotPresent;
-    return theAsioDriver->lpVtbl->future(theAsioDriver, selector, params);
+    return drv->lpVtbl->outputReady(drv);
 }
 
 ASIOError ASIOOutputReady(void) {
-    if (!theAsioDriver || !theAsioDriver->lpVtbl)
-        return ASE_NotPresent;
-    return theAsioDriver->lpVtbl->outputReady(theAsioDriver);
+    return ASIOOutputReadyEx(current());
 }
 
 /** @}*/
@@ -33,6 +33,9 @@ typedef struct cwASIOTransportParameters ASIOTransportParameters;
 typedef struct cwASIOIoFormat ASIOIoFormat;
 typedef struct cwASIOInternalBufferInfo ASIOInternalBufferInfo;
 
+/** A driver loaded with ASIOLoadEx(). */
+typedef struct cwASIODriver *ASIOHandle;
+
 /** Load the driver and enable the below functions.
 * If you want to use the C functions below, which are ASIO SDK compatible, then
 * you need to use ASIOLoad() to load the driver, instead of using cwASIOload().
@@ -49,7 +52,42 @@ ASIOError ASIOLoad(char const *id, char const *name);
 */
 ASIOError ASIOUnload(void);
 
+/** Load another driver, independent of the one loaded with ASIOLoad().
+* Any number of drivers can be loaded this way, and used at the same time
+* through the functions taking a handle, or through the ASIO SDK compatible
+* functions after selecting them with ASIOSelect().
+* @param id The id string that was obtained through enumeration.
+* @param name The name string that was obtained through enumeration
+* @param handle Receives the handle of the loaded driver, or NULL on failure.
+* @return an error code, which is zero on success (ASE_OK).
+*/
+ASIOError ASIOLoadEx(char const *id, char const *name, ASIOHandle *handle);
+
+/** Unload a driver loaded with ASIOLoadEx().
+* If the calling thread has selected the driver, it reverts to the driver loaded
+* with ASIOLoad(). Other threads must not use the handle any more.
+* @param handle The driver to unload.
+* @return an error code, which is zero on success.
+*/
+ASIOError ASIOUnloadEx(ASIOHandle handle);
+
+/** Select the driver used by the ASIO SDK compatible functions in the calling thread.
+* Each thread has its own selection, so that code ported from the ASIO SDK can
+* run with a different driver in each thread, without switching a global. The
+* callbacks given to ASIOCreateBuffers() or ASIOCreateBuffersEx() are called with
+* their driver selected, so they can use the ASIO SDK compatible functions, too.
+* At most 32 drivers can have buffers at the same time, beyond that buffer
+* creation fails with ASE_NoMemory.
+* @param handle The driver to use, or NULL for the driver loaded with ASIOLoad().
+* @return The previous selection of the thread, for restoring it.
+*/
+ASIOHandle ASIOSelect(ASIOHandle handle);
+
+/** @return The driver used by the ASIO SDK compatible functions in the calling thread, or NULL if there is none. */
+ASIOHandle ASIOCurrent(void);
+
 // The following functions are direct equivalents to the functions from the ASIO SDK with the same name.
+// They use the driver selected in the calling thread, or else the one loaded with ASIOLoad().
 
 ASIOError ASIOInit(ASIODriverInfo *info);
 ASIOError ASIOExit(void);
@@ -71,4 +109,26 @@ ASIOError ASIOControlPanel(void);
 ASIOError ASIOFuture(long selector, void *params);
 ASIOError ASIOOutputReady(void);
 
+// The following functions do the same as the ones above, for the driver given by the handle.
+
+ASIOError ASIOInitEx(ASIOHandle handle, ASIODriverInfo *info);
+ASIOError ASIOExitEx(ASIOHandle handle);
+ASIOError ASIOStartEx(ASIOHandle handle);
+ASIOError ASIOStopEx(ASIOHandle handle);
+ASIOError ASIOGetChannelsEx(ASIOHandle handle, long *numInputChannels, long *numOutputChannels);
+ASIOError ASIOGetLatenciesEx(ASIOHandle handle, long *inputLatency, long *outputLatency);
+ASIOError ASIOGetBufferSizeEx(ASIOHandle handle, long *minSize, long *maxSize, long *preferredSize, long *granularity);
+ASIOError ASIOCanSampleRateEx(ASIOHandle handle, ASIOSampleRate sampleRate);
+ASIOError ASIOGetSampleRateEx(ASIOHandle handle, ASIOSampleRate *currentRate);
+ASIOError ASIOSetSampleRateEx(ASIOHandle handle, ASIOSampleRate sampleRate);
+ASIOError ASIOGetClockSourcesEx(ASIOHandle handle, ASIOClockSource *clocks, long *numSources);
+ASIOError ASIOSetClockSourceEx(ASIOHandle handle, long reference);
+ASIOError ASIOGetSamplePositionEx(ASIOHandle handle, ASIOSamples *sPos, ASIOTimeStamp *tStamp);
+ASIOError ASIOGetChannelInfoEx(ASIOHandle handle, ASIOChannelInfo *info);
+ASIOError ASIOCreateBuffersEx(ASIOHandle handle, ASIOBufferInfo *bufferInfos, long numChannels, long bufferSize, ASIOCallbacks const *callbacks);
+ASIOError ASIODisposeBuffersEx(ASIOHandle handle);
+ASIOError ASIOControlPanelEx(ASIOHandle handle);
+ASIOError ASIOFutureEx(ASIOHandle handle, long selector, void *params);
+ASIOError ASIOOutputReadyEx(ASIOHandle handle);
+
 /** @}*/
@@ -303,6 +303,92 @@ int cwASIOenumerate(cwASIOcallback *cb, void *context) {
 
 #endif
 
+/* Legacy drivers don't pass a context to the callbacks, so each of them gets the
+ * plain callbacks of a slot, which forward to the user callbacks stored there.
+ */
+#define FALLBACKS 32
+
+static struct {
+    struct cwASIODriver *drv;           // the driver using the slot, NULL if free
+    struct cwASIOUserCallbacks user;
+} fallbacks[FALLBACKS];
+
+#ifdef _WIN32
+static bool exchangeFallback(int n, struct cwASIODriver *from, struct cwASIODriver *to) {
+    return InterlockedCompareExchangePointer((void *volatile *)&fallbacks[n].drv, to, from) == from;
+}
+#else
+static bool exchangeFallback(int n, struct cwASIODriver *from, struct cwASIODriver *to) {
+    return __atomic_compare_exchange_n(&fallbacks[n].drv, &from, to, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+#endif
+
+#define FALLBACK(N) \
+    static void bufferSwitch##N(long index, cwASIOBool direct) { \
+        fallbacks[N].user.bufferSwitch(fallbacks[N].user.userData, index, direct); \
+    } \
+    static void sampleRateDidChange##N(cwASIOSampleRate rate) { \
+        fallbacks[N].user.sampleRateDidChange(fallbacks[N].user.userData, rate); \
+    } \
+    static long asioMessage##N(long selector, long value, void *message, double *opt) { \
+        return fallbacks[N].user.asioMessage(fallbacks[N].user.userData, selector, value, message, opt); \
+    } \
+    static struct cwASIOTime *bufferSwitchTimeInfo##N(struct cwASIOTime *params, long index, cwASIOBool direct) { \
+        return fallbacks[N].user.bufferSwitchTimeInfo(fallbacks[N].user.userData, params, index, direct); \
+    }
+FALLBACK(0) FALLBACK(1) FALLBACK(2) FALLBACK(3) FALLBACK(4) FALLBACK(5) FALLBACK(6) FALLBACK(7)
+FALLBACK(8) FALLBACK(9) FALLBACK(10) FALLBACK(11) FALLBACK(12) FALLBACK(13) FALLBACK(14) FALLBACK(15)
+FALLBACK(16) FALLBACK(17) FALLBACK(18) FALLBACK(19) FALLBACK(20) FALLBACK(21) FALLBACK(22) FALLBACK(23)
+FALLBACK(24) FALLBACK(25) FALLBACK(26) FALLBACK(27) FALLBACK(28) FALLBACK(29) FALLBACK(30) FALLBACK(31)
+
+#define CALLBACKS(N) { &bufferSwitch##N, &sampleRateDidChange##N, &asioMessage##N, &bufferSwitchTimeInfo##N }
+static struct cwASIOCallbacks const fallbackCallbacks[FALLBACKS] = {
+    CALLBACKS(0), CALLBACKS(1), CALLBACKS(2), CALLBACKS(3), CALLBACKS(4), CALLBACKS(5), CALLBACKS(6), CALLBACKS(7),
+    CALLBACKS(8), CALLBACKS(9), CALLBACKS(10), CALLBACKS(11), CALLBACKS(12), CALLBACKS(13), CALLBACKS(14), CALLBACKS(15),
+    CALLBACKS(16), CALLBACKS(17), CALLBACKS(18), CALLBACKS(19), CALLBACKS(20), CALLBACKS(21), CALLBACKS(22), CALLBACKS(23),
+    CALLBACKS(24), CALLBACKS(25), CALLBACKS(26), CALLBACKS(27), CALLBACKS(28), CALLBACKS(29), CALLBACKS(30), CALLBACKS(31)
+};
+
+// Drivers that call the user callbacks still need plain ones, which they don't call.
+static void ignoreBufferSwitch(long index, cwASIOBool direct) {}
+static void ignoreSampleRateDidChange(cwASIOSampleRate rate) {}
+static long ignoreAsioMessage(long selector, long value, void *message, double *opt) { return 0; }
+static struct cwASIOTime *ignoreBufferSwitchTimeInfo(struct cwASIOTime *params, long index, cwASIOBool direct) { return params; }
+
+static struct cwASIOCallbacks const ignoredCallbacks = {
+    &ignoreBufferSwitch, &ignoreSampleRateDidChange, &ignoreAsioMessage, &ignoreBufferSwitchTimeInfo
+};
+
+cwASIOError cwASIOcreateBuffers(struct cwASIODriver *drv, struct cwASIOBufferInfo *bufferInfos, long numChannels, long bufferSize, struct cwASIOUserCallbacks const *callbacks) {
+    if (!drv || !callbacks || !callbacks->bufferSwitch || !callbacks->sampleRateDidChange || !callbacks->asioMessage || !callbacks->bufferSwitchTimeInfo)
+        return ASE_InvalidParameter;
+    if (drv->lpVtbl->future(drv, kcwASIOsetUserCallbacks, (void *)callbacks) == ASE_SUCCESS) {
+        cwASIOError err = drv->lpVtbl->createBuffers(drv, bufferInfos, numChannels, bufferSize, &ignoredCallbacks);
+        if (err != ASE_OK)
+            drv->lpVtbl->future(drv, kcwASIOsetUserCallbacks, NULL);
+        return err;
+    }
+    int n = 0;
+    while (n < FALLBACKS && !exchangeFallback(n, NULL, drv))
+        ++n;
+    if (n == FALLBACKS)
+        return ASE_NoMemory;
+    fallbacks[n].user = *callbacks;
+    cwASIOError err = drv->lpVtbl->createBuffers(drv, bufferInfos, numChannels, bufferSize, &fallbackCallbacks[n]);
+    if (err != ASE_OK)
+        exchangeFallback(n, drv, NULL);
+    return err;
+}
+
+cwASIOError cwASIOdisposeBuffers(struct cwASIODriver *drv) {
+    if (!drv)
+        return ASE_InvalidParameter;
+    cwASIOError err = drv->lpVtbl->disposeBuffers(drv);
+    for (int n = 0; n < FALLBACKS; ++n)
+        exchangeFallback(n, drv, NULL);
+    return err;
+}
+
 bool cwASIOcompareGUID(cwASIOGUID const *a, cwASIOGUID const *b) {
     return a && b ? 0 == memcmp(a, b, sizeof(cwASIOGUID)) : a == b;
 }
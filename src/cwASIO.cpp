@@ -9,6 +9,12 @@
  */
 
 #include "cwASIO.hpp"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#if defined(CWASIO_REALTIME_CHECK) && !defined(_WIN32)
+    #include <dlfcn.h>
+#endif
 
 
 const char *cwASIO::Errc_category::name() const noexcept {
@@ -31,6 +37,40 @@ std::string cwASIO::Errc_category::message(int c) const {
 }
 
 
+#ifdef CWASIO_REALTIME_CHECK
+namespace {
+    // The entry points of the realtime checker, if one is preloaded.
+    struct RealtimeHooks {
+        void (*enter)(char const *) = nullptr;
+        void (*leave)() = nullptr;
+
+        RealtimeHooks() {
+#ifndef _WIN32
+            enter = reinterpret_cast<void (*)(char const *)>(dlsym(RTLD_DEFAULT, "cwASIOrealtimeEnter"));
+            leave = reinterpret_cast<void (*)()>(dlsym(RTLD_DEFAULT, "cwASIOrealtimeLeave"));
+            if (!enter || !leave)
+                enter = nullptr, leave = nullptr;
+#endif
+        }
+    };
+
+    RealtimeHooks const &realtimeHooks() {
+        static RealtimeHooks const hooks;
+        return hooks;
+    }
+}
+
+cwASIO::RealtimeScope::RealtimeScope(char const *callback) noexcept {
+    if (auto enter = realtimeHooks().enter)
+        enter(callback);
+}
+
+cwASIO::RealtimeScope::~RealtimeScope() {
+    if (auto leave = realtimeHooks().leave)
+        leave();
+}
+#endif
+
 cwASIO::Device::Device(std::string name)
     : Device{}
 {
@@ -113,3 +153,259 @@ std::vector<cwASIOClockSource> cwASIO::Device::getClockSources(std::error_code &
         ec.assign(err, err_category());
     return clocks;
 }
+
+/** State of a device while its buffers exist.
+ * The driver calls back with the stream as the context, see `cwASIOcreateBuffers()`.
+ */
+struct cwASIO::Device::Stream {
+    cwASIODriver *drv;
+    ClockEstimator *clock;
+    Arena *arena;
+    Meter *meter;
+    Resume resume;
+    bool created = false;                   // whether the driver's buffers exist
+    std::vector<Buffer> buffers[2];         // views of both halves of the double buffers
+    std::coroutine_handle<> waiter;         // the coroutine waiting for the next period
+    Period period = {};                     // handed to the coroutine when it resumes
+    cwASIOTime time = {};                   // worker mode: the time info of `period`
+    // worker mode: the callback posts the periods to the worker thread
+    std::thread worker;
+    std::atomic<uint32_t> posted = 0;       // number of periods posted, or changed for stopping
+    std::atomic_long index = 0;             // double buffer index of the last period posted
+    cwASIOTime times[2] = {};               // time info posted, per double buffer index
+    bool timed[2] = {};                     // whether the time info is valid
+    bool direct[2] = {};
+    std::atomic_bool stop = false;
+    cwASIOCallbacks const *host = nullptr;  // callback mode: the callbacks forwarded to
+
+    Stream(cwASIODriver *drv, ClockEstimator *clock, Arena *arena, Meter *meter, Resume resume)
+        : drv{ drv }, clock{ clock }, arena{ arena }, meter{ meter }, resume{ resume } {}
+    ~Stream() { dispose(); }
+
+    cwASIOError create(cwASIOBufferInfo *bufferInfos, long numChannels, long bufferSize);
+    cwASIOError dispose();
+    void deliver(cwASIOTime *params, long index, cwASIOBool directProcess);
+    void silence(long index);
+    void measure(long index);
+    void work();
+
+    static void bufferSwitch(void *self, long doubleBufferIndex, cwASIOBool directProcess) {
+        Stream *s = static_cast<Stream *>(self);
+        RealtimeScope scope("bufferSwitch");
+        if (s->host) {
+            s->arena->reset();
+            if (s->host->bufferSwitch)
+                s->host->bufferSwitch(doubleBufferIndex, directProcess);
+            s->measure(doubleBufferIndex);
+        } else {
+            s->deliver(nullptr, doubleBufferIndex, directProcess);
+        }
+    }
+
+    static cwASIOTime *bufferSwitchTimeInfo(void *self, cwASIOTime *params, long doubleBufferIndex, cwASIOBool directProcess) {
+        Stream *s = static_cast<Stream *>(self);
+        RealtimeScope scope("bufferSwitchTimeInfo");
+        if (s->host) {
+            s->arena->reset();
+            cwASIOTime *result = params;
+            if (s->host->bufferSwitchTimeInfo)
+                result = s->host->bufferSwitchTimeInfo(params, doubleBufferIndex, directProcess);
+            else if (s->host->bufferSwitch)     // the host doesn't support time info
+                s->host->bufferSwitch(doubleBufferIndex, directProcess);
+            s->measure(doubleBufferIndex);
+            return result;
+        }
+        s->deliver(params, doubleBufferIndex, directProcess);
+        return params;
+    }
+
+    static void sampleRateDidChange(void *self, cwASIOSampleRate sRate) {
+        Stream *s = static_cast<Stream *>(self);
+        if (s->host) {
+            if (s->host->sampleRateDidChange)
+                s->host->sampleRateDidChange(sRate);
+        } else
+            s->clock->reset(sRate);
+    }
+
+    static long asioMessage(void *self, long selector, long value, void *message, double *opt) {
+        Stream *s = static_cast<Stream *>(self);
+        if (s->host)
+            return s->host->asioMessage ? s->host->asioMessage(selector, value, message, opt) : 0;
+        switch (selector) {
+        case kAsioSelectorSupported:    return value == kAsioEngineVersion || value == kAsioSupportsTimeInfo;
+        case kAsioEngineVersion:        return 2;
+        case kAsioSupportsTimeInfo:     return 1;
+        default:                        return 0;
+        }
+    }
+};
+
+cwASIOError cwASIO::Device::Stream::create(cwASIOBufferInfo *bufferInfos, long numChannels, long bufferSize) {
+    cwASIOUserCallbacks const callbacks = { this, &bufferSwitch, &sampleRateDidChange, &asioMessage, &bufferSwitchTimeInfo };
+    cwASIOError err = cwASIOcreateBuffers(drv, bufferInfos, numChannels, bufferSize, &callbacks);
+    created = err == ASE_OK;
+    return err;
+}
+
+// Stop the worker before the buffers go away.
+cwASIOError cwASIO::Device::Stream::dispose() {
+    if (worker.joinable()) {
+        stop.store(true, std::memory_order_relaxed);
+        posted.fetch_add(1, std::memory_order_release);
+        posted.notify_one();
+        worker.join();
+    }
+    if (!created)
+        return ASE_InvalidMode;
+    created = false;
+    return cwASIOdisposeBuffers(drv);
+}
+
+void cwASIO::Device::Stream::deliver(cwASIOTime *params, long doubleBufferIndex, cwASIOBool directProcess) {
+    if (params) {
+        clock->update(*params);
+    } else {
+        cwASIOSamples asp;
+        cwASIOTimeStamp ats;
+        if (drv->lpVtbl->getSamplePosition(drv, &asp, &ats) == ASE_OK)
+            clock->update(std::chrono::nanoseconds(qWord(ats)), qWord(asp));
+    }
+    if (resume == Resume::inCallback) {
+        arena->reset();
+        period = { buffers[doubleBufferIndex], doubleBufferIndex, directProcess != ASIOFalse, params, 0, arena };
+        if (auto handle = std::exchange(waiter, {}))
+            handle.resume();        // returns when the coroutine waits for the next period
+        else
+            silence(doubleBufferIndex);
+        measure(doubleBufferIndex);
+        return;
+    }
+    times[doubleBufferIndex] = params ? *params : cwASIOTime{};
+    timed[doubleBufferIndex] = params != nullptr;
+    direct[doubleBufferIndex] = directProcess != ASIOFalse;
+    index.store(doubleBufferIndex, std::memory_order_relaxed);
+    posted.fetch_add(1, std::memory_order_release);
+    posted.notify_one();
+}
+
+void cwASIO::Device::Stream::silence(long doubleBufferIndex) {
+    for (Buffer const &b : buffers[doubleBufferIndex]) {
+        if (!b.isInput)
+            memset(b.data, 0, sampleSize(b.type) * size_t(b.frames));
+    }
+}
+
+void cwASIO::Device::Stream::measure(long doubleBufferIndex) {
+    if (!meter)
+        return;
+    std::span<Buffer const> b = buffers[doubleBufferIndex];
+    for (size_t i = 0; i < b.size(); ++i)
+        meter->process(i, b[i].type, b[i].data, b[i].frames);
+    meter->publish(b.empty() ? 0 : b.front().frames);
+}
+
+void cwASIO::Device::Stream::work() {
+    uint32_t consumed = 0;
+    for (;;) {
+        uint32_t p;
+        while ((p = posted.load(std::memory_order_acquire)) == consumed)
+            posted.wait(consumed, std::memory_order_acquire);
+        if (stop.load(std::memory_order_relaxed))
+            return;
+        long i = index.load(std::memory_order_relaxed);
+        time = times[i];
+        arena->reset();
+        period = { buffers[i], i, direct[i], timed[i] ? &time : nullptr, p - consumed - 1, arena };
+        consumed = p;
+        if (auto handle = std::exchange(waiter, {})) {
+            RealtimeScope scope("coroutine");
+            handle.resume();
+            drv->lpVtbl->outputReady(drv);
+        } else {
+            silence(i);
+        }
+        measure(i);
+    }
+}
+
+void cwASIO::Device::release(Stream *stream) {
+    delete stream;
+}
+
+cwASIOError cwASIO::Device::disposeBuffers() {
+    assert(drv_);
+    if (!stream_)
+        return drv_->lpVtbl->disposeBuffers(drv_.get());
+    cwASIOError err = stream_->dispose();
+    stream_.reset();
+    return err;
+}
+
+cwASIOError cwASIO::Device::prepareArena(long numChannels, long bufferSize) {
+    long minSize, maxSize, preferredSize, granularity;
+    if (drv_->lpVtbl->getBufferSize(drv_.get(), &minSize, &maxSize, &preferredSize, &granularity) != ASE_OK)
+        maxSize = bufferSize;
+    size_t capacity = size_t(arenaBuffers_) * size_t(std::max(maxSize, bufferSize)) * size_t(std::max(numChannels, 0L)) * sizeof(float);
+    if (!arena_ || arena_->capacity() < capacity) {
+        arena_.reset();
+        arena_ = std::make_unique<Arena>(capacity);
+        if (arena_->capacity() < capacity)
+            return ASE_NoMemory;
+    }
+    arena_->reset();
+    return ASE_OK;
+}
+
+cwASIOError cwASIO::Device::createBuffers(cwASIOBufferInfo *bufferInfos, long numChannels, long bufferSize, cwASIOCallbacks const *callbacks) {
+    return makeStream(bufferInfos, numChannels, bufferSize, callbacks, Resume::inCallback);
+}
+
+cwASIOError cwASIO::Device::createBuffers(cwASIOBufferInfo *bufferInfos, long numChannels, long bufferSize, Resume resume) {
+    return makeStream(bufferInfos, numChannels, bufferSize, nullptr, resume);
+}
+
+// Create the buffers with our callbacks, which forward to the host's callbacks if given, otherwise to the coroutine.
+cwASIOError cwASIO::Device::makeStream(cwASIOBufferInfo *bufferInfos, long numChannels, long bufferSize, cwASIOCallbacks const *callbacks, Resume resume) {
+    assert(drv_);
+    stream_.reset();
+    if (auto err = prepareArena(numChannels, bufferSize))
+        return err;
+    meter_.reset();
+    if (metering_)
+        meter_ = std::make_unique<Meter>(size_t(std::max(numChannels, 0L)), meterOptions_);
+    std::unique_ptr<Stream, void(*)(Stream*)> stream{ new Stream{ drv_.get(), clock_.get(), arena_.get(), meter_.get(), resume }, &release };
+    stream->host = callbacks;
+    if (auto err = stream->create(bufferInfos, numChannels, bufferSize))
+        return err;
+    for (long i = 0; i < numChannels; ++i) {
+        cwASIOChannelInfo info = {};
+        info.channel = bufferInfos[i].channelNum;
+        info.isInput = bufferInfos[i].isInput;
+        if (auto err = getChannelInfo(info))
+            return err;
+        for (int h = 0; h < 2; ++h)
+            stream->buffers[h].push_back({ bufferInfos[i].buffers[h], info.type, bufferSize, info.isInput != ASIOFalse, info.channel });
+    }
+    if (!callbacks && resume == Resume::onWorker)
+        stream->worker = std::thread(&Stream::work, stream.get());
+    stream_ = std::move(stream);
+    return ASE_OK;
+}
+
+cwASIO::Arena::Arena(size_t capacity) {
+    capacity = (capacity + alignment - 1) & ~(alignment - 1);
+    block_.reset(static_cast<std::byte *>(::operator new[](capacity, std::align_val_t{ alignment }, std::nothrow)));
+    if (block_) {
+        memset(block_.get(), 0, capacity);      // fault the pages in now, not in the callback
+        capacity_ = capacity;
+    }
+}
+
+void cwASIO::Device::PeriodAwaiter::await_suspend(std::coroutine_handle<> handle) noexcept {
+    stream_->waiter = handle;
+}
+
+cwASIO::Period cwASIO::Device::PeriodAwaiter::await_resume() const noexcept {
+    return stream_->period;
+}
@@ -117,6 +117,26 @@ long cwASIOload(char const *id, struct cwASIODriver **drv);
  */
 void cwASIOunload(struct cwASIODriver *drv);
 
+/** Create the buffers with callbacks that receive a context pointer.
+ * This registers the callbacks with the `kcwASIOsetUserCallbacks` selector of
+ * `future()`. Drivers that don't support it get plain callbacks from a fixed
+ * pool, which forward to the given ones, so the number of such drivers with
+ * buffers at the same time is limited. Buffers created this way must be
+ * disposed of with `cwASIOdisposeBuffers()`.
+ * @param drv The driver.
+ * @param bufferInfos, numChannels, bufferSize As for the `createBuffers()` method.
+ * @param callbacks The callbacks, all of which must be given. They are copied.
+ * @return an error code, which is zero on success, `ASE_NoMemory` when the
+ * pool of plain callbacks is exhausted.
+ */
+cwASIOError cwASIOcreateBuffers(struct cwASIODriver *drv, struct cwASIOBufferInfo *bufferInfos, long numChannels, long bufferSize, struct cwASIOUserCallbacks const *callbacks);
+
+/** Dispose of the buffers created with `cwASIOcreateBuffers()`.
+ * @param drv The driver.
+ * @return The result of the `disposeBuffers()` method.
+ */
+cwASIOError cwASIOdisposeBuffers(struct cwASIODriver *drv);
+
 /** Compare two GUIDs for equality.
  * @param a Pointer to first GUID
  * @param a Pointer to second GUID
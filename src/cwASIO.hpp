@@ -12,13 +12,23 @@
 extern "C" {
     #include "cwASIO.h"
 }
+#include "cwASIOmeter.hpp"
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <chrono>
+#include <coroutine>
+#include <cstddef>
 #include <cstring>
+#include <exception>
 #include <memory>
+#include <new>
+#include <span>
 #include <string>
 #include <system_error>
 #include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 
@@ -33,7 +43,7 @@ namespace cwASIO {
         std::string message(int) const override final;
     };
 
-    static Errc_category const &err_category() {
+    inline Errc_category const &err_category() {    // one category for all translation units, error codes compare by its address
         static Errc_category cat;
         return cat;
     }
@@ -46,18 +56,322 @@ namespace cwASIO {
         return uint64_t(val);
     };
 
+    /** Store a 64 bit value into a time stamp or sample position, the inverse of `qWord()`. */
+    template<typename T> inline void setQWord(T &val, uint64_t q) {
+        val.hi = (unsigned long)(q >> 32);
+        val.lo = (unsigned long)(q & 0xFFFFFFFFULL);
+    };
+
+    template<> inline void setQWord<long long int>(long long int &val, uint64_t q) {
+        val = (long long int)q;
+    };
+
     struct SamplePosition {
         std::chrono::nanoseconds systemTime;
         uint64_t samplePosition;
     };
 
+    /** @return The size in bytes of one sample of the given type, or 0 if the type isn't supported. */
+    unsigned sampleSize(cwASIOSampleType type);
+
+    /** Convert samples of the given type to float in the range [-1, 1).
+     * @param type The sample type of the source.
+     * @param src The source samples.
+     * @param dst The destination buffer for `count` floats.
+     * @param count The number of samples to convert.
+     * @return false if the sample type isn't supported.
+     */
+    bool toFloat(cwASIOSampleType type, void const *src, float *dst, long count);
+
+    /** Convert float samples to the given type, clipping to the range [-1, 1).
+     * @param type The sample type of the destination.
+     * @param src The source samples.
+     * @param dst The destination buffer for `count` samples.
+     * @param count The number of samples to convert.
+     * @return false if the sample type isn't supported.
+     */
+    bool fromFloat(cwASIOSampleType type, float const *src, void *dst, long count);
+
+    /** Marks the current thread as running a realtime callback, for as long as it exists.
+     * This is a debugging aid, active only when the wrapper is built with
+     * `CWASIO_REALTIME_CHECK` defined (CMake option of the same name). The
+     * checker in `test/rtcheck.c`, preloaded into the host, then reports any
+     * memory allocation, blocking lock, file I/O or sleep within the scope.
+     * The wrapper puts the host's callbacks, the coroutine in coroutine mode and
+     * the tasks of a `ThreadPool` into such scopes itself.
+     */
+    class RealtimeScope {
+    public:
+#ifdef CWASIO_REALTIME_CHECK
+        explicit RealtimeScope(char const *callback) noexcept;
+        ~RealtimeScope();
+#else
+        explicit RealtimeScope(char const *) noexcept {}
+#endif
+        RealtimeScope(RealtimeScope const &) =delete;
+        RealtimeScope &operator=(RealtimeScope const &) =delete;
+    };
+
+    /** Estimator for the relation between sample position and system time.
+     * The time stamps that a driver delivers with each period are subject to
+     * jitter, caused by interrupt latency and scheduling. This estimator filters
+     * them with a second order delay-locked loop (DLL), yielding a smooth mapping
+     * between sample positions and system time, as well as the actual sample
+     * rate as measured against the system clock.
+     *
+     * The estimator is fed from the buffer switch callback with `update()`. All
+     * other member functions may be called from any thread, without involving
+     * the driver.
+     */
+    class ClockEstimator {
+    public:
+        /** Set the bandwidth of the loop filter.
+         * @param hz The bandwidth in Hz. Smaller values yield smoother estimates,
+         * but take longer to settle.
+         */
+        void setBandwidth(double hz) { bandwidth_ = hz; }
+
+        /** Restart the estimation from scratch.
+         * This is necessary when the sample position jumps, for example after
+         * `start()` or a sample rate change. The latter is detected by `update()`
+         * automatically when fed with the time info.
+         * @param sampleRate The nominal sample rate, or 0 if unknown.
+         */
+        void reset(double sampleRate =0.);
+
+        /** Feed the time stamp of a buffer switch into the loop.
+         * To be called from the buffer switch callback.
+         * @param systemTime The system time of the buffer switch.
+         * @param samplePosition The sample position of the buffer switch.
+         */
+        void update(std::chrono::nanoseconds systemTime, uint64_t samplePosition);
+
+        /** Feed the time info of a buffer switch into the loop.
+         * To be called from `bufferSwitchTimeInfo()`. Time info without valid
+         * system time or sample position is ignored.
+         */
+        void update(cwASIOTime const &time);
+
+        /** @return true if the estimator has seen enough periods for its estimates to be valid. */
+        bool valid() const { return load().nsPerSample > 0.; }
+
+        /** @return The actual sample rate measured against the system clock, in Hz. */
+        double sampleRate() const;
+
+        /** @return The predicted system time of the next buffer switch. */
+        std::chrono::nanoseconds nextPeriod() const;
+
+        /** Map a sample position to system time.
+         * @param samplePosition The sample position, which may be fractional.
+         * @return The estimated system time of the sample position.
+         */
+        std::chrono::duration<double, std::nano> timeOf(double samplePosition) const;
+
+        /** Map system time to a sample position.
+         * @param systemTime The system time.
+         * @return The estimated sample position at the given time, including the fractional part.
+         */
+        double positionAt(std::chrono::duration<double, std::nano> systemTime) const;
+
+    private:
+        struct State {
+            double time;            // filtered time of the last update, in ns
+            double position;        // sample position of the last update
+            double nsPerSample;     // filtered sample period, 0 while not yet valid
+            double step;            // number of samples between the last two updates
+        };
+
+        State load() const;         // consistent snapshot of the shared state
+        void store(State const &s);
+
+        double bandwidth_ = 1.;
+        double nominal_ = 0.;       // nominal sample rate, if known
+        int primed_ = 0;            // number of updates since reset, up to 2
+        State state_ = {};          // working copy of the update thread
+        std::atomic_uint sequence_ = 0;     // odd while the shared state is being written
+        std::atomic<double> time_ = 0.;
+        std::atomic<double> position_ = 0.;
+        std::atomic<double> nsPerSample_ = 0.;
+        std::atomic<double> step_ = 0.;
+    };
+
+    /** Where a coroutine waiting in `Device::nextPeriod()` is resumed. */
+    enum class Resume {
+        inCallback,     //!< directly in the buffer switch callback, the period is done when the coroutine waits again
+        onWorker        //!< on a worker thread of the device, the callback returns at once and `outputReady()` follows the period
+    };
+
+    /** Typed view of the buffer of one channel in one period. */
+    struct Buffer {
+        void *data;
+        cwASIOSampleType type;
+        long frames;
+        bool isInput;
+        long channel;
+
+        /** @return The samples as a span of `T`, which must have the size of a sample. */
+        template<typename T>
+        std::span<T> as() const {
+            assert(sampleSize(type) == sizeof(T));
+            return { static_cast<T *>(data), size_t(frames) };
+        }
+
+        bool toFloat(float *dst) const { return cwASIO::toFloat(type, data, dst, frames); }
+        bool fromFloat(float const *src) const { return cwASIO::fromFloat(type, src, data, frames); }
+    };
+
+    /** Scratch memory for processing one period.
+     * A bump allocator over one preallocated block, which the device resets at
+     * the start of every period. Allocating is just advancing a pointer, so
+     * handlers can take temporary buffers without touching the heap. The block
+     * is aligned to cache lines and prefaulted, and so is every allocation by
+     * default. Not thread safe, the arena belongs to the thread processing the
+     * period.
+     */
+    class Arena {
+    public:
+        static constexpr size_t alignment = 64;     //!< cache line size
+
+        Arena() =default;
+
+        /** Allocate the block, and touch all of its pages.
+         * @param capacity The size of the block in bytes, rounded up to `alignment`.
+         * The capacity remains 0 if the memory isn't available.
+         */
+        explicit Arena(size_t capacity);
+
+        /** @return `size` bytes aligned to `align`, which must be a power of 2, or null if the arena is exhausted. */
+        void *allocate(size_t size, size_t align =alignment) noexcept {
+            size_t begin = (used_ + align - 1) & ~(align - 1);
+            if (begin > capacity_ || size > capacity_ - begin) {
+                ++failures_;
+                return nullptr;
+            }
+            used_ = begin + size;
+            peak_ = std::max(peak_, used_);
+            return block_.get() + begin;
+        }
+
+        /** @return Uninitialized storage for `count` objects of `T`, or an empty span if the arena is exhausted. */
+        template<typename T>
+        std::span<T> buffer(size_t count) noexcept {
+            static_assert(std::is_trivially_destructible_v<T>, "the arena doesn't run destructors");
+            void *p = allocate(count * sizeof(T), std::max(alignof(T), alignment));
+            return p ? std::span<T>{ static_cast<T *>(p), count } : std::span<T>{};
+        }
+
+        /** Release all allocations, done by the device before each period. */
+        void reset() noexcept { used_ = 0; }
+
+        size_t capacity() const { return capacity_; }
+        size_t used() const { return used_; }
+
+        /** @return The most bytes used in any period so far. */
+        size_t peak() const { return peak_; }
+
+        /** @return The number of allocations that failed so far. */
+        uint64_t failures() const { return failures_; }
+
+    private:
+        struct Free {
+            void operator()(std::byte *p) const { ::operator delete[](p, std::align_val_t{ alignment }); }
+        };
+
+        std::unique_ptr<std::byte[], Free> block_;
+        size_t capacity_ = 0;
+        size_t used_ = 0;
+        size_t peak_ = 0;
+        uint64_t failures_ = 0;
+    };
+
+    /** One period, as delivered by `co_await device.nextPeriod()`. */
+    struct Period {
+        std::span<Buffer const> buffers;    //!< in the order of the buffer infos given to `createBuffers()`
+        long index;                         //!< double buffer index
+        bool directProcess;
+        cwASIOTime const *time;             //!< null if the driver called `bufferSwitch()` without time info
+        unsigned missed;                    //!< periods skipped since the previous one, because the coroutine was late
+        Arena *arena;                       //!< scratch memory for this period
+
+        long frames() const { return buffers.empty() ? 0 : buffers.front().frames; }
+    };
+
+    /** Return type for coroutines processing the periods of a device.
+     * The coroutine starts at once, and runs until it first waits for a period.
+     * An exception leaving the coroutine ends it, and is kept for `rethrow()`.
+     * The task must outlive the streaming of the device it waits on.
+     */
+    class Task {
+    public:
+        struct promise_type {
+            std::exception_ptr exception;
+
+            Task get_return_object() { return Task{ std::coroutine_handle<promise_type>::from_promise(*this) }; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { exception = std::current_exception(); }
+        };
+
+        Task(Task &&other) noexcept : handle_{ std::exchange(other.handle_, {}) } {}
+        Task &operator=(Task &&other) noexcept {
+            std::swap(handle_, other.handle_);
+            return *this;
+        }
+        ~Task() {
+            if (handle_)
+                handle_.destroy();
+        }
+
+        /** @return true when the coroutine has finished. */
+        bool done() const { return !handle_ || handle_.done(); }
+
+        /** Throw the exception that ended the coroutine, if any. */
+        void rethrow() const {
+            if (handle_ && handle_.promise().exception)
+                std::rethrow_exception(handle_.promise().exception);
+        }
+
+    private:
+        explicit Task(std::coroutine_handle<promise_type> handle) : handle_{ handle } {}
+
+        std::coroutine_handle<promise_type> handle_;
+    };
+
     /** Handle for an ASIO device. */
     struct Device {
     private:
+        struct Stream;
+        static void release(Stream *stream);
+
         std::unique_ptr<cwASIODriver, void(*)(cwASIODriver*)> drv_;
+        std::unique_ptr<ClockEstimator> clock_;
+        std::unique_ptr<Arena> arena_;
+        std::unique_ptr<Meter> meter_;
+        std::unique_ptr<Stream, void(*)(Stream*)> stream_{ nullptr, &release };   // the callbacks while buffers exist
+        unsigned arenaBuffers_ = 4;
+        bool metering_ = false;
+        Meter::Options meterOptions_;
+
+        cwASIOError prepareArena(long numChannels, long bufferSize);
+        cwASIOError makeStream(cwASIOBufferInfo *bufferInfos, long numChannels, long bufferSize, cwASIOCallbacks const *callbacks, Resume resume);
 
     public:
-        Device() : drv_{ nullptr, &cwASIOunload } {}
+        /** Awaitable for the next period in coroutine mode. */
+        class PeriodAwaiter {
+        public:
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> handle) noexcept;
+            Period await_resume() const noexcept;
+
+        private:
+            friend struct Device;
+            explicit PeriodAwaiter(Stream *stream) : stream_{ stream } {}
+
+            Stream *stream_;
+        };
+
+        Device() : drv_{ nullptr, &cwASIOunload }, clock_{ std::make_unique<ClockEstimator>() } {}
         explicit Device(std::string name);
 
         /** Initialize the driver instance for the device.
@@ -80,6 +394,9 @@ namespace cwASIO {
 
         cwASIOError start() {
             assert(drv_);
+            clock_->reset();
+            if (meter_)
+                meter_->reset();
             return drv_->lpVtbl->start(drv_.get());
         }
 
@@ -151,16 +468,62 @@ namespace cwASIO {
             return drv_->lpVtbl->getChannelInfo(drv_.get(), &info);
         }
 
-        cwASIOError createBuffers(cwASIOBufferInfo *bufferInfos, long numChannels, long bufferSize, cwASIOCallbacks const *callbacks) {
-            assert(drv_);
-            return drv_->lpVtbl->createBuffers(drv_.get(), bufferInfos, numChannels, bufferSize, callbacks);
+        /** Create the buffers, with callbacks for processing the periods.
+         * The device forwards the callbacks, resetting the `arena()` before
+         * each period, and running them in a `RealtimeScope`.
+         * @return `ASE_NoMemory` if too many devices have buffers at the same time or the arena couldn't be allocated, or the driver's error.
+         */
+        cwASIOError createBuffers(cwASIOBufferInfo *bufferInfos, long numChannels, long bufferSize, cwASIOCallbacks const *callbacks);
+
+        /** Create the buffers for processing the periods in a coroutine instead of callbacks.
+         * The coroutine waits for each period with `co_await nextPeriod()`.
+         * Output buffers are silenced in periods the coroutine doesn't wait for.
+         * The device feeds its `clock()` by itself in this mode.
+         * @param bufferInfos The channels, as for the other overload.
+         * @param numChannels The number of channels.
+         * @param bufferSize The buffer size.
+         * @param resume Where the coroutine is resumed.
+         * @return `ASE_NoMemory` if too many devices have buffers at the same time or the arena couldn't be allocated, or the driver's error.
+         */
+        cwASIOError createBuffers(cwASIOBufferInfo *bufferInfos, long numChannels, long bufferSize, Resume resume =Resume::inCallback);
+
+        /** Set the size of the `arena()` created along with the buffers.
+         * @param buffersPerChannel The number of float buffers of the largest
+         * buffer size the driver supports, per channel given to `createBuffers()`.
+         */
+        void setArenaSize(unsigned buffersPerChannel) { arenaBuffers_ = buffersPerChannel; }
+
+        /** @return The scratch memory for the current period, only to be used while processing it. */
+        Arena &arena() {
+            assert(arena_);
+            return *arena_;
         }
 
-        cwASIOError disposeBuffers() {
-            assert(drv_);
-            return drv_->lpVtbl->disposeBuffers(drv_.get());
+        /** Measure the levels of the channels, from the next `createBuffers()` on.
+         * The device feeds the buffers of each period to a `Meter` after the
+         * period has been processed, so outputs are measured as the host wrote them.
+         */
+        void setMetering(bool on, Meter::Options const &options ={}) {
+            metering_ = on;
+            meterOptions_ = options;
         }
 
+        /** @return The meters, for the channels in the order of the buffer infos
+         * given to `createBuffers()`, or null without metering. They remain valid
+         * until the next `createBuffers()`.
+         */
+        Meter const *meter() const { return meter_.get(); }
+
+        /** Wait for the next period, in a coroutine, after `createBuffers()` for coroutine mode.
+         * @return The awaitable, which yields a `Period`.
+         */
+        PeriodAwaiter nextPeriod() {
+            assert(stream_);
+            return PeriodAwaiter{ stream_.get() };
+        }
+
+        cwASIOError disposeBuffers();
+
         cwASIOError controlPanel() {
             assert(drv_);
             return drv_->lpVtbl->controlPanel(drv_.get());
@@ -171,10 +534,32 @@ namespace cwASIO {
             return drv_->lpVtbl->future(drv_.get(), selector, opt);
         }
 
+        /** Switch freewheel mode on or off.
+         * In freewheel mode the driver doesn't pace the callbacks by the sample
+         * clock, but issues the next period as soon as the host has returned
+         * from the previous one. This is meant for offline rendering.
+         * @param enable true to switch freewheel mode on, false to switch it off.
+         * @return `ASE_SUCCESS` if the driver supports freewheel mode,
+         * `ASE_InvalidParameter` if it doesn't.
+         */
+        cwASIOError setFreewheel(bool enable) {
+            assert(drv_);
+            cwASIOBool value = enable ? ASIOTrue : ASIOFalse;
+            return drv_->lpVtbl->future(drv_.get(), kcwASIOsetFreewheel, &value);
+        }
+
         cwASIOError outputReady() {
             assert(drv_);
             return drv_->lpVtbl->outputReady(drv_.get());
         }
+
+        /** Access the clock estimator of this device.
+         * The host feeds it from its buffer switch callback, because the
+         * callbacks carry no reference to the device. It gets reset by `start()`.
+         */
+        ClockEstimator &clock() {
+            return *clock_;
+        }
     };
 
 } // namespace
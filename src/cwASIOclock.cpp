@@ -0,0 +1,110 @@
+/** @file       cwASIOclock.cpp
+ *  @brief      cwASIO clock estimator for hosts and drivers
+ *  @author     Stefan Heinzmann
+ *  @version    1.0
+ *  @date       2023-2025
+ *  @copyright  See file LICENSE in toplevel directory
+ * @addtogroup cwASIO
+ *  @{
+ */
+
+#include "cwASIO.hpp"
+#include <cmath>
+
+
+void cwASIO::ClockEstimator::reset(double sampleRate) {
+    nominal_ = sampleRate;
+    primed_ = 0;
+    state_ = {};
+    store(state_);
+}
+
+void cwASIO::ClockEstimator::update(std::chrono::nanoseconds systemTime, uint64_t samplePosition) {
+    double t = double(systemTime.count());
+    double pos = double(samplePosition);
+    double n = pos - state_.position;
+    if (primed_ == 0 || n <= 0.) {                  // first update, or position jumped back
+        state_ = { t, pos, nominal_ > 0. ? 1e9 / nominal_ : 0., 0. };
+        primed_ = 1;
+    } else if (state_.nsPerSample <= 0.) {          // rate unknown, take it from the first two updates
+        state_ = { t, pos, (t - state_.time) / n, n };
+        primed_ = 2;
+    } else {
+        double period = n * state_.nsPerSample;
+        double predicted = state_.time + period;
+        double err = t - predicted;
+        if (std::abs(err) > period) {               // lost lock, start over at the current rate
+            state_.time = t;
+        } else {
+            // loop filter coefficients for the actual update interval
+            double omega = 2. * 3.14159265358979323846 * bandwidth_ * period * 1e-9;
+            state_.time = predicted + std::sqrt(2.) * omega * err;
+            state_.nsPerSample += omega * omega * err / n;
+        }
+        state_.position = pos;
+        state_.step = n;
+        primed_ = 2;
+    }
+    if (primed_ == 2)
+        store(state_);
+}
+
+void cwASIO::ClockEstimator::update(cwASIOTime const &time) {
+    auto const &info = time.timeInfo;
+    if ((info.flags & (kSystemTimeValid | kSamplePositionValid)) != (kSystemTimeValid | kSamplePositionValid))
+        return;
+    if (info.flags & kSampleRateChanged)
+        reset((info.flags & kSampleRateValid) ? info.sampleRate : 0.);
+    else if (primed_ == 0 && (info.flags & kSampleRateValid))
+        nominal_ = info.sampleRate;
+    update(std::chrono::nanoseconds(qWord(info.systemTime)), qWord(info.samplePosition));
+}
+
+double cwASIO::ClockEstimator::sampleRate() const {
+    State s = load();
+    return s.nsPerSample > 0. ? 1e9 / s.nsPerSample : 0.;
+}
+
+std::chrono::nanoseconds cwASIO::ClockEstimator::nextPeriod() const {
+    State s = load();
+    return std::chrono::nanoseconds(std::llround(s.time + s.step * s.nsPerSample));
+}
+
+std::chrono::duration<double, std::nano> cwASIO::ClockEstimator::timeOf(double samplePosition) const {
+    State s = load();
+    return std::chrono::duration<double, std::nano>(s.time + (samplePosition - s.position) * s.nsPerSample);
+}
+
+double cwASIO::ClockEstimator::positionAt(std::chrono::duration<double, std::nano> systemTime) const {
+    State s = load();
+    return s.nsPerSample > 0. ? s.position + (systemTime.count() - s.time) / s.nsPerSample : s.position;
+}
+
+// The shared state is published with a sequence lock, so the update never waits for a reader.
+cwASIO::ClockEstimator::State cwASIO::ClockEstimator::load() const {
+    State s;
+    unsigned seq;
+    do {
+        while ((seq = sequence_.load(std::memory_order_acquire)) & 1)
+            ;
+        s.time = time_.load(std::memory_order_relaxed);
+        s.position = position_.load(std::memory_order_relaxed);
+        s.nsPerSample = nsPerSample_.load(std::memory_order_relaxed);
+        s.step = step_.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while (seq != sequence_.load(std::memory_order_relaxed));
+    return s;
+}
+
+void cwASIO::ClockEstimator::store(State const &s) {
+    unsigned seq = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    time_.store(s.time, std::memory_order_relaxed);
+    position_.store(s.position, std::memory_order_relaxed);
+    nsPerSample_.store(s.nsPerSample, std::memory_order_relaxed);
+    step_.store(s.step, std::memory_order_relaxed);
+    sequence_.store(seq + 2, std::memory_order_release);
+}
+
+/** @}*/
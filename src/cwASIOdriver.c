@@ -11,6 +11,8 @@
 #include "cwASIOdriver.h"
 #include <assert.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 
 #ifdef _WIN32
 #   include <windows.h>
@@ -18,6 +20,7 @@
 #   include <unknwnbase.h>
 #   include <wchar.h>
 
+#   pragma comment(lib, "Synchronization.lib")  // for WaitOnAddress()
 #   define MODULE_EXPORT    // this is taken care of by the .def file
 #else
 #   define __USE_GNU
@@ -29,7 +32,14 @@
 #   include <string.h>
 #   include <time.h>
 #   include <unistd.h>
+#   include <pthread.h>
+#   include <sched.h>
+#   include <linux/futex.h>
+#   include <sys/epoll.h>
+#   include <sys/eventfd.h>
 #   include <sys/stat.h>
+#   include <sys/syscall.h>
+#   include <sys/timerfd.h>
 
 #   define MODULE_EXPORT __attribute__((retain,visibility("default")))
 #endif
@@ -432,4 +442,519 @@ MODULE_EXPORT long cwASIOfindName(cwASIOGUID const *guid, char *buf, size_t size
     return ctx.buf ? -1 : ctx.len;
 }
 
+/* The instance table is a singly linked list that only ever grows. New entries are pushed at the
+ * head with a compare-and-swap, so readers never need to take a lock.
+ */
+static struct cwASIOinstance *instances = NULL;
+
+#ifdef _WIN32
+static struct cwASIOinstance *loadInstances(void) {
+    return InterlockedCompareExchangePointer((void *volatile *)&instances, NULL, NULL);
+}
+
+static bool pushInstance(struct cwASIOinstance *head, struct cwASIOinstance *inst) {
+    return InterlockedCompareExchangePointer((void *volatile *)&instances, inst, head) == head;
+}
+#else
+static struct cwASIOinstance *loadInstances(void) {
+    return __atomic_load_n(&instances, __ATOMIC_ACQUIRE);
+}
+
+static bool pushInstance(struct cwASIOinstance *head, struct cwASIOinstance *inst) {
+    return __sync_bool_compare_and_swap(&instances, head, inst);
+}
+#endif
+
+static long readNumber(char const *name, char const *key) {
+    char buf[32] = {0};
+    if (cwASIOgetParameter(name, key, buf, sizeof(buf) - 1) <= 0)
+        return 0;
+    return strtol(buf, NULL, 10);
+}
+
+static struct cwASIOinstance const *lookupInstance(struct cwASIOinstance const *inst, char const *name) {
+    for (; inst; inst = inst->next)
+        if (0 == strcmp(inst->name, name))
+            return inst;
+    return NULL;
+}
+
+MODULE_EXPORT struct cwASIOinstance const *cwASIOgetInstance(char const *name) {
+    if (!name || !name[0] || strlen(name) > 32)
+        return NULL;
+    struct cwASIOinstance *head = loadInstances();
+    struct cwASIOinstance const *found = lookupInstance(head, name);
+    if (found)
+        return found;
+    if (0 != cwASIOgetParameter(name, NULL, NULL, 0))
+        return NULL;    // not registered
+
+    struct cwASIOinstance *inst = calloc(1, sizeof(struct cwASIOinstance));
+    if (!inst)
+        return NULL;
+    strcpy(inst->name, name);
+#ifdef _WIN32
+    char clsid[40] = {0};
+    if (cwASIOgetParameter(name, "CLSID", clsid, sizeof(clsid) - 1) > 0)
+        cwASIOtoGUID(clsid, &inst->guid);
+#endif
+    inst->bufferSize = readNumber(name, "bufferSize");
+    inst->periods = readNumber(name, "periods");
+    inst->priority = readNumber(name, "priority");
+    inst->inputChannels = readNumber(name, "inputChannels");
+    inst->outputChannels = readNumber(name, "outputChannels");
+
+    // another thread may have added the same name in the meantime, so we check again before each attempt
+    for (;;) {
+        inst->next = head;
+        if (pushInstance(head, inst))
+            return inst;
+        head = loadInstances();
+        found = lookupInstance(head, name);
+        if (found) {
+            free(inst);
+            return found;
+        }
+    }
+}
+
+MODULE_EXPORT struct cwASIOinstance const *cwASIOfindInstance(cwASIOGUID const *guid) {
+    static cwASIOGUID const nullGuid = {0};
+    if (!guid || cwASIOcompareGUID(guid, &nullGuid))
+        return NULL;
+    for (struct cwASIOinstance const *inst = loadInstances(); inst; inst = inst->next)
+        if (cwASIOcompareGUID(&inst->guid, guid))
+            return inst;
+    char name[33] = {0};
+    if (cwASIOfindName(guid, name, 32) <= 0)
+        return NULL;
+    return cwASIOgetInstance(name);
+}
+
+/* Command states. The waiter flag tells the realtime thread that it needs to wake the control thread,
+ * so completing a command that nobody waits for doesn't need a system call.
+ */
+enum {
+    commandPending = 0,
+    commandDone = 1,
+    commandWaiting = 2
+};
+
+#ifdef _WIN32
+static uint32_t loadAcquire(uint32_t *p) {
+    return (uint32_t)InterlockedCompareExchange((LONG volatile *)p, 0, 0);
+}
+
+static void storeRelease(uint32_t *p, uint32_t val) {
+    InterlockedExchange((LONG volatile *)p, (LONG)val);
+}
+
+static bool changeState(int32_t *state, int32_t from, int32_t to) {
+    return InterlockedCompareExchange((LONG volatile *)state, to, from) == from;
+}
+
+static int32_t exchangeState(int32_t *state, int32_t to) {
+    return InterlockedExchange((LONG volatile *)state, to);
+}
+
+static void waitState(int32_t *state, int32_t val, long timeoutMs) {
+    WaitOnAddress(state, &val, sizeof(val), timeoutMs < 0 ? INFINITE : (DWORD)timeoutMs);
+}
+
+static void wakeState(int32_t *state) {
+    WakeByAddressSingle(state);
+}
+
+static long long nowMs(void) {
+    return (long long)GetTickCount64();
+}
+#else
+static uint32_t loadAcquire(uint32_t *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void storeRelease(uint32_t *p, uint32_t val) {
+    __atomic_store_n(p, val, __ATOMIC_RELEASE);
+}
+
+static bool changeState(int32_t *state, int32_t from, int32_t to) {
+    return __atomic_compare_exchange_n(state, &from, to, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static int32_t exchangeState(int32_t *state, int32_t to) {
+    return __atomic_exchange_n(state, to, __ATOMIC_ACQ_REL);
+}
+
+static void waitState(int32_t *state, int32_t val, long timeoutMs) {
+    struct timespec ts = { timeoutMs / 1000, (timeoutMs % 1000) * 1000000L };
+    syscall(SYS_futex, state, FUTEX_WAIT_PRIVATE, val, timeoutMs < 0 ? NULL : &ts, NULL, 0);
+}
+
+static void wakeState(int32_t *state) {
+    syscall(SYS_futex, state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static long long nowMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+#endif
+
+MODULE_EXPORT void cwASIOinitQueue(struct cwASIOcommandQueue *queue) {
+    memset(queue, 0, sizeof(*queue));
+}
+
+MODULE_EXPORT bool cwASIOpostCommand(struct cwASIOcommandQueue *queue, struct cwASIOcommand *cmd) {
+    if (!queue || !cmd)
+        return false;
+    uint32_t head = queue->head;    // only we modify it
+    if (head - loadAcquire(&queue->tail) >= cwASIOcommandQueueSize)
+        return false;               // full
+    cmd->state = commandPending;
+    queue->slots[head % cwASIOcommandQueueSize] = cmd;
+    storeRelease(&queue->head, head + 1);
+    return true;
+}
+
+MODULE_EXPORT bool cwASIOwaitCommand(struct cwASIOcommand *cmd, long timeoutMs) {
+    long long deadline = nowMs() + timeoutMs;
+    if (!changeState(&cmd->state, commandPending, commandWaiting))
+        return true;                // already done
+    for (;;) {
+        long remaining = timeoutMs < 0 ? -1 : (long)(deadline - nowMs());
+        if (timeoutMs >= 0 && remaining <= 0)
+            break;
+        waitState(&cmd->state, commandWaiting, remaining);
+        if (changeState(&cmd->state, commandDone, commandDone))
+            return true;
+    }
+    // timed out, but the command may have been completed just now
+    return !changeState(&cmd->state, commandWaiting, commandPending);
+}
+
+MODULE_EXPORT cwASIOError cwASIOsendCommand(struct cwASIOcommandQueue *queue, struct cwASIOcommand *cmd, long timeoutMs) {
+    if (!cwASIOpostCommand(queue, cmd))
+        return ASE_NoMemory;
+    if (!cwASIOwaitCommand(cmd, timeoutMs))
+        return ASE_HWMalfunction;
+    return cmd->result;
+}
+
+MODULE_EXPORT struct cwASIOcommand *cwASIOfetchCommand(struct cwASIOcommandQueue *queue) {
+    uint32_t tail = queue->tail;    // only we modify it
+    if (tail == loadAcquire(&queue->head))
+        return NULL;                // empty
+    struct cwASIOcommand *cmd = queue->slots[tail % cwASIOcommandQueueSize];
+    storeRelease(&queue->tail, tail + 1);
+    return cmd;
+}
+
+MODULE_EXPORT void cwASIOcompleteCommand(struct cwASIOcommand *cmd, cwASIOError result) {
+    cmd->result = result;
+    if (exchangeState(&cmd->state, commandDone) == commandWaiting)
+        wakeState(&cmd->state);
+}
+
+MODULE_EXPORT cwASIOError cwASIOsetUserCallbacks(struct cwASIOhostCallbacks *host, void const *par) {
+    struct cwASIOUserCallbacks const *user = par;
+    if (host->callbacks)
+        return ASE_InvalidMode;
+    if (user && (!user->bufferSwitch || !user->sampleRateDidChange || !user->asioMessage || !user->bufferSwitchTimeInfo))
+        return ASE_InvalidParameter;
+    if (user)
+        host->user = *user;
+    else
+        memset(&host->user, 0, sizeof(host->user));
+    return ASE_SUCCESS;
+}
+
+MODULE_EXPORT void cwASIOresetCallbacks(struct cwASIOhostCallbacks *host) {
+    memset(host, 0, sizeof(*host));
+}
+
+MODULE_EXPORT void cwASIObufferSwitch(struct cwASIOhostCallbacks const *host, long doubleBufferIndex, cwASIOBool directProcess) {
+    if (host->user.bufferSwitch)
+        host->user.bufferSwitch(host->user.userData, doubleBufferIndex, directProcess);
+    else if (host->callbacks)
+        host->callbacks->bufferSwitch(doubleBufferIndex, directProcess);
+}
+
+MODULE_EXPORT void cwASIOsampleRateDidChange(struct cwASIOhostCallbacks const *host, cwASIOSampleRate sRate) {
+    if (host->user.sampleRateDidChange)
+        host->user.sampleRateDidChange(host->user.userData, sRate);
+    else if (host->callbacks)
+        host->callbacks->sampleRateDidChange(sRate);
+}
+
+MODULE_EXPORT long cwASIOasioMessage(struct cwASIOhostCallbacks const *host, long selector, long value, void *message, double *opt) {
+    if (host->user.asioMessage)
+        return host->user.asioMessage(host->user.userData, selector, value, message, opt);
+    if (host->callbacks && host->callbacks->asioMessage)
+        return host->callbacks->asioMessage(selector, value, message, opt);
+    return 0;
+}
+
+MODULE_EXPORT struct cwASIOTime *cwASIObufferSwitchTimeInfo(struct cwASIOhostCallbacks const *host, struct cwASIOTime *params, long doubleBufferIndex, cwASIOBool directProcess) {
+    if (host->user.bufferSwitchTimeInfo)
+        return host->user.bufferSwitchTimeInfo(host->user.userData, params, doubleBufferIndex, directProcess);
+    if (host->callbacks)
+        return host->callbacks->bufferSwitchTimeInfo(params, doubleBufferIndex, directProcess);
+    return params;
+}
+
+#ifndef _WIN32
+
+/* The shared scheduler. Each worker thread waits on an epoll set containing the timerfds of its clients and
+ * an eventfd for waking it up when a command is posted. Adding a client only needs an epoll_ctl() call, which is
+ * threadsafe, but removing a client is done by the worker itself, so it can be sure not to touch it afterwards.
+ * The bookkeeping on the control side is protected by a mutex, which the workers never take.
+ */
+
+enum {
+    maxReady = 64,          // maximum number of events handled in one go
+    cmdRemove = 1,          // remove the client given in `value`
+    cmdExit                 // terminate the worker thread
+};
+
+struct cwASIOworker {
+    pthread_t thread;
+    int cpu;
+    int epfd;
+    int evfd;
+    unsigned clients;
+    struct cwASIOcommandQueue commands;
+    struct epoll_event ready[maxReady];
+    int numReady;
+};
+
+static pthread_mutex_t schedulerMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct cwASIOworker **workers = NULL;        // indexed by CPU
+static int numWorkers = 0;
+static struct cwASIOperiodic *scheduled = NULL;     // all clients
+
+static long long monotonicNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static struct timespec toTimespec(long long ns) {
+    struct timespec ts = { ns / 1000000000LL, ns % 1000000000LL };
+    return ts;
+}
+
+static int armTimer(struct cwASIOperiodic *client, long long start) {
+    struct itimerspec spec = { toTimespec(client->period), toTimespec(start) };
+    return timerfd_settime(client->fd, TFD_TIMER_ABSTIME, &spec, NULL) == 0 ? 0 : errno;
+}
+
+static void removeReady(struct cwASIOworker *w, struct cwASIOperiodic *client) {
+    for (int i = 0; i < w->numReady; ++i)
+        if (w->ready[i].data.ptr == client)
+            w->ready[i].data.ptr = NULL;
+}
+
+static bool handleCommands(struct cwASIOworker *w) {
+    uint64_t count;
+    if (read(w->evfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        return true;
+    bool running = true;
+    struct cwASIOcommand *cmd;
+    while ((cmd = cwASIOfetchCommand(&w->commands))) {
+        if (cmd->selector == cmdRemove) {
+            struct cwASIOperiodic *client = (struct cwASIOperiodic *)(intptr_t)cmd->value;
+            epoll_ctl(w->epfd, EPOLL_CTL_DEL, client->fd, NULL);
+            removeReady(w, client);
+        } else if (cmd->selector == cmdExit) {
+            running = false;
+        }
+        cwASIOcompleteCommand(cmd, ASE_OK);
+    }
+    return running;
+}
+
+static void *workerThread(void *arg) {
+    struct cwASIOworker *w = arg;
+    struct cwASIOperiodic *due[maxReady];
+    unsigned long long missed[maxReady];
+    bool running = true;
+    while (running) {
+        w->numReady = epoll_wait(w->epfd, w->ready, maxReady, -1);
+        if (w->numReady < 0) {
+            w->numReady = 0;
+            continue;       // EINTR
+        }
+        // commands first, because they may invalidate some of the ready clients
+        for (int i = 0; i < w->numReady; ++i)
+            if (w->ready[i].data.ptr == w)
+                running = handleCommands(w) && running;
+        // collect the due clients, sorted by deadline (insertion sort, the list is short)
+        int n = 0;
+        for (int i = 0; i < w->numReady; ++i) {
+            struct cwASIOperiodic *client = w->ready[i].data.ptr;
+            uint64_t count;
+            if (!client || client == (void *)w || read(client->fd, &count, sizeof(count)) != sizeof(count))
+                continue;
+            client->deadline += (long long)count * client->period;
+            int j = n++;
+            for (; j > 0 && due[j - 1]->deadline > client->deadline; --j) {
+                due[j] = due[j - 1];
+                missed[j] = missed[j - 1];
+            }
+            due[j] = client;
+            missed[j] = count - 1;
+        }
+        for (int i = 0; i < n; ++i) {
+            struct cwASIOperiodic *client = due[i];
+            long long period = client->period;
+            client->expired(client, missed[i]);
+            if (client->period != period)
+                armTimer(client, client->deadline);
+        }
+        w->numReady = 0;
+    }
+    return NULL;
+}
+
+static int startWorker(struct cwASIOworker *w, int priority) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(w->cpu, &cpus);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    int err = EPERM;
+    if (priority > 0) {
+        struct sched_param param = { .sched_priority = priority };
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+        err = pthread_create(&w->thread, &attr, &workerThread, w);
+        pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+    }
+    if (err == EPERM || err == EINVAL)      // no realtime priority available, make do without
+        err = pthread_create(&w->thread, &attr, &workerThread, w);
+    pthread_attr_destroy(&attr);
+    return err;
+}
+
+static struct cwASIOworker *makeWorker(int cpu, int priority) {
+    struct cwASIOworker *w = calloc(1, sizeof(struct cwASIOworker));
+    if (!w)
+        return NULL;
+    w->cpu = cpu;
+    cwASIOinitQueue(&w->commands);
+    w->epfd = epoll_create1(EPOLL_CLOEXEC);
+    w->evfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = w };
+    if (w->epfd >= 0 && w->evfd >= 0 && 0 == epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->evfd, &ev) && 0 == startWorker(w, priority))
+        return w;
+    if (w->evfd >= 0)
+        close(w->evfd);
+    if (w->epfd >= 0)
+        close(w->epfd);
+    free(w);
+    return NULL;
+}
+
+static cwASIOError sendToWorker(struct cwASIOworker *w, long selector, long value) {
+    struct cwASIOcommand cmd = { .selector = selector, .value = value };
+    if (!cwASIOpostCommand(&w->commands, &cmd))
+        return ASE_NoMemory;
+    uint64_t one = 1;
+    if (write(w->evfd, &one, sizeof(one)) < 0)
+        return ASE_HWMalfunction;
+    cwASIOwaitCommand(&cmd, -1);
+    return cmd.result;
+}
+
+/* Choose the worker for a client: the one already serving the same clock, or else the least loaded one, where
+ * a CPU without a worker counts as unloaded. Must be called with the scheduler mutex held.
+ */
+static struct cwASIOworker *chooseWorker(struct cwASIOperiodic *client) {
+    if (!workers) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = calloc(n > 0 ? n : 1, sizeof(struct cwASIOworker *));
+        if (!workers)
+            return NULL;
+        numWorkers = n > 0 ? (int)n : 1;
+    }
+    if (client->clock)
+        for (struct cwASIOperiodic *c = scheduled; c; c = c->next)
+            if (c->clock == client->clock)
+                return c->worker;
+    int best = 0;
+    for (int i = 1; i < numWorkers; ++i)
+        if ((workers[i] ? workers[i]->clients : 0) < (workers[best] ? workers[best]->clients : 0))
+            best = i;
+    if (!workers[best])
+        workers[best] = makeWorker(best, client->priority);
+    return workers[best];
+}
+
+MODULE_EXPORT int cwASIOschedule(struct cwASIOperiodic *client, long long start) {
+    if (!client || !client->expired || client->period <= 0)
+        return EINVAL;
+    client->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (client->fd < 0)
+        return errno;
+    if (start <= 0)
+        start = monotonicNow() + client->period;
+    client->deadline = start;
+    int err = armTimer(client, start);
+    pthread_mutex_lock(&schedulerMutex);
+    struct cwASIOworker *w = err ? NULL : chooseWorker(client);
+    if (!w && !err)
+        err = ENOMEM;
+    if (!err) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = client };
+        client->worker = w;
+        if (0 == epoll_ctl(w->epfd, EPOLL_CTL_ADD, client->fd, &ev)) {
+            ++w->clients;
+            client->next = scheduled;
+            scheduled = client;
+        } else {
+            err = errno;
+        }
+    }
+    pthread_mutex_unlock(&schedulerMutex);
+    if (err) {
+        close(client->fd);
+        client->fd = -1;
+        client->worker = NULL;
+    }
+    return err;
+}
+
+MODULE_EXPORT int cwASIOunschedule(struct cwASIOperiodic *client) {
+    if (!client || !client->worker)
+        return EINVAL;
+    pthread_mutex_lock(&schedulerMutex);
+    struct cwASIOworker *w = client->worker;
+    sendToWorker(w, cmdRemove, (long)(intptr_t)client);
+    for (struct cwASIOperiodic **c = &scheduled; *c; c = &(*c)->next) {
+        if (*c == client) {
+            *c = client->next;
+            break;
+        }
+    }
+    if (--w->clients == 0) {
+        sendToWorker(w, cmdExit, 0);
+        pthread_join(w->thread, NULL);
+        close(w->evfd);
+        close(w->epfd);
+        workers[w->cpu] = NULL;
+        free(w);
+    }
+    pthread_mutex_unlock(&schedulerMutex);
+    close(client->fd);
+    client->fd = -1;
+    client->worker = NULL;
+    client->next = NULL;
+    return 0;
+}
+
+#endif
+
 /** @}*/
@@ -55,6 +55,224 @@ enum {
  */
 long cwASIOfindName(cwASIOGUID const *guid, char *buf, size_t size);
 
+/** Descriptor of a registered driver instance.
+ * The descriptor collects the registration info of an instance name, along with
+ * a few commonly used tuning parameters, which are read from the registry (on
+ * Windows) or from `/etc/cwASIO/<name>` (on Linux) under the key given in the
+ * comment. A parameter that is absent or not a number is set to zero, which
+ * means that the driver should use its own default.
+ *
+ * Descriptors are kept in a per-process table. They are loaded once when first
+ * asked for, and shared by all driver instances with the same name. They are
+ * never modified or freed thereafter, so they can be used without locking.
+ */
+struct cwASIOinstance {
+    struct cwASIOinstance const *next;  //!< next entry in the table
+    char name[33];                      //!< instance name, null terminated
+    cwASIOGUID guid;                    //!< `CLSID` (Windows only, zero on Linux)
+    long bufferSize;                    //!< `bufferSize`: preferred buffer size in samples
+    long periods;                       //!< `periods`: number of periods of driver internal buffering
+    long priority;                      //!< `priority`: priority of the driver's realtime thread
+    long inputChannels;                 //!< `inputChannels`: number of input channels
+    long outputChannels;                //!< `outputChannels`: number of output channels
+};
+
+/** Get the descriptor for an instance name.
+ * @param name The instance name as found during enumeration.
+ * @return Pointer to the shared descriptor, or NULL if the name isn't
+ * registered, or memory ran out.
+ *
+ * The registry is consulted only on the first call for a given name, later
+ * calls return the same descriptor from the table. This is meant for use in the
+ * `future()` method of the driver, when handling `kcwASIOsetInstanceName`.
+ */
+struct cwASIOinstance const *cwASIOgetInstance(char const *name);
+
+/** Get the descriptor for a GUID.
+ * @param guid The GUID passed to the `queryInterface()` method of the driver.
+ * @return Pointer to the shared descriptor, or NULL if the GUID is NULL or not
+ * registered.
+ *
+ * Like `cwASIOfindName()`, this only makes sense on Windows, where the registry
+ * is scanned for the GUID only if there isn't already a descriptor for it.
+ */
+struct cwASIOinstance const *cwASIOfindInstance(cwASIOGUID const *guid);
+
+/** A command sent from a control thread to the realtime thread of a driver.
+ * Drivers use commands to apply control calls like `start()`, `stop()`,
+ * `setSampleRate()` or `setClockSource()` at a period boundary, without the
+ * realtime thread ever having to take a lock. The meaning of the selector and
+ * the arguments is defined by the driver.
+ *
+ * The command object is owned by the control thread, which typically keeps it
+ * on its stack while waiting for completion. The realtime thread writes the
+ * result and signals completion with `cwASIOcompleteCommand()`.
+ */
+struct cwASIOcommand {
+    long selector;          //!< driver defined command code
+    long value;             //!< integer argument
+    double number;          //!< floating point argument
+    cwASIOError result;     //!< result, set by the realtime thread
+    int32_t state;          //!< completion state, used internally
+};
+
+enum {
+    cwASIOcommandQueueSize = 16     //!< capacity of a command queue, must be a power of two
+};
+
+/** A single producer, single consumer queue of commands.
+ * The producer is the control thread, i.e. the thread on which the host calls
+ * the driver's methods. The consumer is the driver's realtime thread. If the
+ * host may call from several threads, the driver must serialize the calls that
+ * post commands.
+ */
+struct cwASIOcommandQueue {
+    struct cwASIOcommand *slots[cwASIOcommandQueueSize];
+    uint32_t head;          //!< next slot to write, only modified by the producer
+    uint32_t tail;          //!< next slot to read, only modified by the consumer
+};
+
+/** Initialize a command queue to be empty. */
+void cwASIOinitQueue(struct cwASIOcommandQueue *queue);
+
+/** Post a command to the realtime thread, without waiting for it.
+ * @param queue The queue to post to.
+ * @param cmd The command, which must stay valid until it is completed.
+ * @return true on success, false if the queue is full.
+ */
+bool cwASIOpostCommand(struct cwASIOcommandQueue *queue, struct cwASIOcommand *cmd);
+
+/** Wait for the completion of a command that was posted before.
+ * @param cmd The command to wait for.
+ * @param timeoutMs The maximum time to wait in milliseconds, or a negative
+ * value to wait indefinitely.
+ * @return true if the command was completed, false on timeout.
+ */
+bool cwASIOwaitCommand(struct cwASIOcommand *cmd, long timeoutMs);
+
+/** Post a command and wait for its completion.
+ * @param queue The queue to post to.
+ * @param cmd The command to send.
+ * @param timeoutMs The maximum time to wait in milliseconds, or negative to
+ * wait indefinitely.
+ * @return The result set by the realtime thread, `ASE_NoMemory` if the queue
+ * was full, or `ASE_HWMalfunction` if the realtime thread didn't respond in
+ * time. After a timeout the command may still be completed later, so it must
+ * remain valid until the realtime thread is known to have stopped.
+ */
+cwASIOError cwASIOsendCommand(struct cwASIOcommandQueue *queue, struct cwASIOcommand *cmd, long timeoutMs);
+
+/** Fetch the next command in the realtime thread.
+ * This never blocks, so it can be called at each period boundary.
+ * @param queue The queue to fetch from.
+ * @return The next command, or NULL if there is none.
+ */
+struct cwASIOcommand *cwASIOfetchCommand(struct cwASIOcommandQueue *queue);
+
+/** Complete a command in the realtime thread.
+ * This stores the result and wakes the waiting control thread, if any. It
+ * never blocks. The command must not be touched afterwards.
+ * @param cmd The command obtained from `cwASIOfetchCommand()`.
+ * @param result The result to report back.
+ */
+void cwASIOcompleteCommand(struct cwASIOcommand *cmd, cwASIOError result);
+
+/** The callbacks of the host, as seen by a driver.
+ * A driver keeps this in place of the pointer passed to `createBuffers()`, so
+ * that it supports the `kcwASIOsetUserCallbacks` selector of `future()` by
+ * calling the functions below, which call the callbacks registered with that
+ * selector if there are any, and the ones passed to `createBuffers()`
+ * otherwise.
+ */
+struct cwASIOhostCallbacks {
+    struct cwASIOCallbacks const *callbacks;    //!< passed to `createBuffers()`, NULL while there are no buffers
+    struct cwASIOUserCallbacks user;            //!< registered with `kcwASIOsetUserCallbacks`, all NULL if none
+};
+
+/** Handle the `kcwASIOsetUserCallbacks` selector of `future()`.
+ * @param host The driver's host callbacks.
+ * @param par The parameter passed to `future()`.
+ * @return `ASE_SUCCESS`, `ASE_InvalidMode` while there are buffers, or
+ * `ASE_InvalidParameter` if a callback is missing.
+ */
+cwASIOError cwASIOsetUserCallbacks(struct cwASIOhostCallbacks *host, void const *par);
+
+/** Forget the host's callbacks, in `disposeBuffers()`.
+ * This includes the ones registered with `kcwASIOsetUserCallbacks`, so the
+ * host has to register them again before creating new buffers.
+ */
+void cwASIOresetCallbacks(struct cwASIOhostCallbacks *host);
+
+/** Call the host's `bufferSwitch()` callback. */
+void cwASIObufferSwitch(struct cwASIOhostCallbacks const *host, long doubleBufferIndex, cwASIOBool directProcess);
+
+/** Call the host's `sampleRateDidChange()` callback. */
+void cwASIOsampleRateDidChange(struct cwASIOhostCallbacks const *host, cwASIOSampleRate sRate);
+
+/** Call the host's `asioMessage()` callback.
+ * @return The host's answer, or 0 if there are no callbacks.
+ */
+long cwASIOasioMessage(struct cwASIOhostCallbacks const *host, long selector, long value, void *message, double *opt);
+
+/** Call the host's `bufferSwitchTimeInfo()` callback. */
+struct cwASIOTime *cwASIObufferSwitchTimeInfo(struct cwASIOhostCallbacks const *host, struct cwASIOTime *params, long doubleBufferIndex, cwASIOBool directProcess);
+
+#ifndef _WIN32
+/** A periodic client of the shared realtime scheduler (Linux only).
+ * Instead of spawning a realtime thread of its own, a driver instance can
+ * register a periodic client with the shared scheduler. The scheduler runs one
+ * realtime thread per CPU, each of which serves many clients from an epoll set
+ * of timerfds. This avoids having many realtime threads competing with each
+ * other when a driver is instantiated many times.
+ *
+ * Clients that share the same clock are served by the same thread. When
+ * several clients are due at the same time, they are served in the order of
+ * their deadlines, i.e. earliest deadline first.
+ *
+ * The driver fills in the public members before calling `cwASIOschedule()`,
+ * the remaining members are maintained by the scheduler.
+ */
+struct cwASIOperiodic {
+    /** Called on the realtime thread once per period.
+     * @param self The client.
+     * @param missed The number of periods that were missed since the last call,
+     * because the thread didn't get to serve the client in time.
+     */
+    void (*expired)(struct cwASIOperiodic *self, unsigned long long missed);
+    void const *clock;      //!< identifies the clock this client follows, NULL if not shared
+    long long period;       //!< period in nanoseconds, may be changed by `expired()` to take effect with the next period
+    int priority;           //!< SCHED_FIFO priority requested for the thread, or 0 for normal scheduling
+    long long deadline;     //!< CLOCK_MONOTONIC time in nanoseconds by which the current period must be done
+    int fd;                 //!< the timerfd, used internally
+    struct cwASIOworker *worker;    //!< the thread serving this client, used internally
+    struct cwASIOperiodic *next;    //!< list of all clients, used internally
+};
+
+/** Add a client to the shared scheduler.
+ * @param client The client to add. It must remain valid until removed with
+ * `cwASIOunschedule()`.
+ * @param start The CLOCK_MONOTONIC time in nanoseconds of the first expiration,
+ * or 0 for one period from now.
+ * @return 0 on success, otherwise an errno value.
+ *
+ * The priority of a thread is determined by the client that causes its
+ * creation. If that priority can't be granted, the thread uses normal
+ * scheduling.
+ */
+int cwASIOschedule(struct cwASIOperiodic *client, long long start);
+
+/** Remove a client from the shared scheduler.
+ * @param client The client that was added with `cwASIOschedule()`.
+ * @return 0 on success, otherwise an errno value.
+ *
+ * When this returns, the client's `expired()` function isn't running and won't
+ * be called again. It must not be called from within `expired()`. When the
+ * last client of a thread is removed, the thread terminates, so no thread is
+ * left running when the driver gets unloaded.
+ */
+int cwASIOunschedule(struct cwASIOperiodic *client);
+#endif
+
 /** Make an instance of the driver.
  * This function must be implemented by the driver to create an instance of the driver object and
  * return a pointer to it.
@@ -17,17 +17,18 @@
 struct MyAsioDriver {
     struct cwASIODriver base;   // must be the first struct member
     atomic_ulong references;    // threadsafe reference counter
-    char name[33];              // the name of this instance
+    struct cwASIOinstance const *instance;  // registration info of this instance
+    struct cwASIOhostCallbacks host;        // the host's callbacks while there are buffers
     // ... (more data members here)
 };
 
 static long CWASIO_METHOD queryInterface(struct cwASIODriver *drv, cwASIOGUID const *guid, void **ptr) {
     struct MyAsioDriver *self = drv;
-    long res = cwASIOfindName(guid, self->name, 32);
-    if(res > 0)
-        self->name[32] = '\0';  // ensure null termination
-    if(res < 0)
-        return -res;            // GUID not found in registry
+    if(guid) {
+        self->instance = cwASIOfindInstance(guid);
+        if(!self->instance)
+            return E_NOINTERFACE;   // GUID not found in registry
+    }
     *ptr = drv;
     drv->lpVtbl->addRef(drv);
     return 0;                   // success
@@ -50,16 +51,16 @@ static unsigned long CWASIO_METHOD release(struct cwASIODriver *drv) {
 
 static cwASIOBool CWASIO_METHOD init(struct cwASIODriver *drv, void *sys) {
     struct MyAsioDriver *self = (struct MyAsioDriver*)drv;
-    if(!self || !self->name[0])
+    if(!self || !self->instance)
         return ASIOFalse;
-    // ... (do the driver initialization here)
+    // ... (do the driver initialization here, using the parameters in self->instance)
     return ASIOTrue;
 }
 
 static void CWASIO_METHOD getDriverName(struct cwASIODriver *drv, char *buf) {
     struct MyAsioDriver *self = (struct MyAsioDriver*)drv;
-    if (self && self->name[0] && buf)
-        strcpy(buf, self->name);
+    if (self && self->instance && buf)
+        strcpy(buf, self->instance->name);
 }
 
 static long CWASIO_METHOD getDriverVersion(struct cwASIODriver *drv) {
@@ -148,12 +149,14 @@ static cwASIOError CWASIO_METHOD getChannelInfo(struct cwASIODriver *drv, struct
 static cwASIOError CWASIO_METHOD createBuffers(struct cwASIODriver *drv, struct cwASIOBufferInfo *infos, long num, long size, struct cwASIOCallbacks const *cb) {
     struct MyAsioDriver *self = (struct MyAsioDriver*)drv;
     // ... (insert your code here)
+    self->host.callbacks = cb;  // call back with cwASIObufferSwitch(&self->host, ...) etc.
     return ASE_OK;
 }
 
 static cwASIOError CWASIO_METHOD disposeBuffers(struct cwASIODriver *drv) {
     struct MyAsioDriver *self = (struct MyAsioDriver*)drv;
     // ... (insert your code here)
+    cwASIOresetCallbacks(&self->host);
     return ASE_OK;
 }
 
@@ -170,13 +173,15 @@ static cwASIOError CWASIO_METHOD future(struct cwASIODriver *drv, long sel, void
     case kcwASIOsetInstanceName:
         if (!par || *(char const *)par == '\0')
             return ASE_SUCCESS;
-        if (strlen((char const *)par) > 32)
-            return ASE_NotPresent;
-        if (0 == cwASIOgetParameter((char const *)par, NULL, NULL, 0)) {
-            strncpy(self->name, (char const *)par, 32);
-            return ASE_SUCCESS;
+        {
+            struct cwASIOinstance const *inst = cwASIOgetInstance((char const *)par);
+            if (!inst)
+                return ASE_NotPresent;
+            self->instance = inst;
         }
-        return ASE_NotPresent;
+        return ASE_SUCCESS;
+    case kcwASIOsetUserCallbacks:
+        return cwASIOsetUserCallbacks(&self->host, par);
     default:
         return ASE_InvalidParameter;
     }
@@ -222,7 +227,8 @@ struct cwASIODriver *makeAsioDriver() {
         return NULL;     // lack of sufficient memory
     obj->base.lpVtbl = &myAsioDriverVtbl;
     atomic_init(&obj->references, 1);
-    obj->name[0] = '\0';    // no name yet
+    obj->instance = NULL;   // no name yet
+    cwASIOresetCallbacks(&obj->host);
     // .... (you may do some more member initialization here)
     return &obj->base;
 }
@@ -30,12 +30,11 @@ public:
     }
 
     long queryInterface(cwASIOGUID const *guid, void **ptr) {
-        char buf[33] = {};          // ensure null termination
-        long res = cwASIOfindName(guid, buf, 32);
-        if(res > 0)
-            name.assign(buf);
-        if(res < 0)
-            return -res;            // GUID not found in registry
+        if(guid) {
+            instance = cwASIOfindInstance(guid);
+            if(!instance)
+                return E_NOINTERFACE;   // GUID not found in registry
+        }
         // It's our GUID
         *ptr = this;
         addRef();
@@ -56,15 +55,15 @@ public:
     }
 
     cwASIOBool init(void *sys) {
-        if(name.empty())
+        if(!instance)
             return ASIOFalse;
-        // ... (do the driver initialization here)
+        // ... (do the driver initialization here, using the parameters in *instance)
         return ASIOTrue;
     }
 
     void getDriverName(char *buf) {
-        if (buf && !name.empty())
-            strcpy(buf, name.c_str());
+        if (buf && instance)
+            strcpy(buf, instance->name);
     }
 
     long getDriverVersion() {
@@ -138,11 +137,13 @@ public:
 
     cwASIOError createBuffers(struct cwASIOBufferInfo *infos, long num, long size, struct cwASIOCallbacks const *cb) {
         // ... (insert your code here)
+        host.callbacks = cb;    // call back with cwASIObufferSwitch(&host, ...) etc.
         return ASE_OK;
     }
 
     cwASIOError disposeBuffers() {
         // ... (insert your code here)
+        cwASIOresetCallbacks(&host);
         return ASE_OK;
     }
 
@@ -157,13 +158,13 @@ public:
         case kcwASIOsetInstanceName:
             if (!par || *(char const *)par == '\0')
                 return ASE_SUCCESS;
-            if (strlen((char const *)par) > 32)
-                return ASE_NotPresent;
-            if (0 == cwASIOgetParameter((char const *)par, NULL, NULL, 0)) {
-                name.assign((char const *)par);
+            if (auto inst = cwASIOgetInstance((char const *)par)) {
+                instance = inst;
                 return ASE_SUCCESS;
             }
             return ASE_NotPresent;
+        case kcwASIOsetUserCallbacks:
+            return cwASIOsetUserCallbacks(&host, par);
         default:
             return ASE_InvalidParameter;
         }
@@ -179,7 +180,8 @@ private:
     static struct cwASIODriverVtbl const vtbl;
 
     std::atomic_ulong references;   // threadsafe reference counter
-    std::string name;               // name of this instance
+    cwASIOinstance const *instance = nullptr;   // registration info of this instance
+    cwASIOhostCallbacks host = {};              // the host's callbacks while there are buffers
     // ... (more data members here)
 };
 
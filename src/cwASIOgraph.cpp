@@ -0,0 +1,323 @@
+/** @file       cwASIOgraph.cpp
+ *  @brief      cwASIO processing graph for hosts
+ *  @author     Stefan Heinzmann
+ *  @version    1.0
+ *  @date       2023-2025
+ *  @copyright  See file LICENSE in toplevel directory
+ * @addtogroup cwASIO
+ *  @{
+ */
+
+#include "cwASIOgraph.hpp"
+#include "cwASIOpool.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <utility>
+
+
+namespace {
+    constexpr size_t line = 16;     // floats per cache line, buffers start on a multiple of this
+
+    cwASIO::Port const devicePort{ "device", cwASIO::PortType::audio };
+
+    // Allocates buffers within the block of a schedule, reusing those that are no longer needed.
+    class Allocator {
+    public:
+        explicit Allocator(size_t maxFrames) : audio_{ (maxFrames + line - 1) / line * line } {}
+
+        size_t allocate(cwASIO::PortType type) {
+            std::vector<size_t> &free = free_[unsigned(type)];
+            if (!free.empty()) {
+                size_t offset = free.back();
+                free.pop_back();
+                return offset;
+            }
+            size_t offset = size_;
+            size_ += type == cwASIO::PortType::audio ? audio_ : line;
+            return offset;
+        }
+
+        void release(cwASIO::PortType type, size_t offset) {
+            free_[unsigned(type)].push_back(offset);
+        }
+
+        size_t size() const { return size_; }
+
+    private:
+        size_t audio_;              // size of an audio buffer
+        size_t size_ = 0;
+        std::vector<size_t> free_[2];
+    };
+
+    std::vector<cwASIO::Port> numbered(std::string const &name, unsigned count) {
+        std::vector<cwASIO::Port> ports(count);
+        for (unsigned i = 0; i < count; ++i)
+            ports[i].name = name + " " + std::to_string(i + 1);
+        return ports;
+    }
+
+    struct Before {
+        bool operator()(cwASIO::Endpoint a, cwASIO::Endpoint b) const {
+            return std::pair(a.node, a.port) < std::pair(b.node, b.port);
+        }
+    };
+
+    template<typename T>
+    using EndpointMap = std::map<cwASIO::Endpoint, T, Before>;
+}
+
+
+cwASIO::Control::Control(float value)
+    : Node{ {}, { { "value", PortType::control } } }
+    , value_{ value }
+{}
+
+void cwASIO::Control::process(float const *const *in, float *const *out, size_t frames) {
+    out[0][0] = value_.load(std::memory_order_relaxed);
+}
+
+cwASIO::Gain::Gain()
+    : Node{ { { "in" }, { "gain", PortType::control, 1.f } }, { { "out" } } }
+{}
+
+void cwASIO::Gain::process(float const *const *in, float *const *out, size_t frames) {
+    float const *x = in[0];
+    float const gain = in[1][0];
+    float *y = out[0];
+    for (size_t i = 0; i < frames; ++i)
+        y[i] = x[i] * gain;
+}
+
+cwASIO::Mixer::Mixer(unsigned inputs)
+    : Node{ numbered("in", inputs), { { "out" } } }
+{}
+
+void cwASIO::Mixer::process(float const *const *in, float *const *out, size_t frames) {
+    float *y = out[0];
+    std::fill_n(y, frames, 0.f);
+    for (size_t k = 0; k < inputs().size(); ++k) {
+        float const *x = in[k];
+        for (size_t i = 0; i < frames; ++i)
+            y[i] += x[i];
+    }
+}
+
+
+cwASIO::Graph::Graph(unsigned inputs, unsigned outputs, double sampleRate, size_t maxFrames)
+    : inputs_{ inputs }
+    , outputs_{ outputs }
+    , sampleRate_{ sampleRate }
+    , maxFrames_{ maxFrames }
+{}
+
+unsigned cwASIO::Graph::add(std::shared_ptr<Node> node) {
+    if (!node)
+        throw std::invalid_argument("cwASIO::Graph: null node");
+    node->prepare(sampleRate_, maxFrames_);
+    nodes_.push_back(std::move(node));
+    return unsigned(nodes_.size() - 1);
+}
+
+void cwASIO::Graph::remove(unsigned node) {
+    if (node >= nodes_.size() || !nodes_[node])
+        throw std::invalid_argument("cwASIO::Graph: no such node");
+    nodes_[node].reset();
+    std::erase_if(connections_, [node](Connection const &c) { return c.from.node == node || c.to.node == node; });
+}
+
+void cwASIO::Graph::connect(Endpoint from, Endpoint to) {
+    if (port(from, true).type != port(to, false).type)
+        throw std::invalid_argument("cwASIO::Graph: connecting ports of different types");
+    disconnect(to);
+    connections_.push_back({ from, to });
+}
+
+void cwASIO::Graph::disconnect(Endpoint to) {
+    port(to, false);
+    std::erase_if(connections_, [to](Connection const &c) { return c.to.node == to.node && c.to.port == to.port; });
+}
+
+cwASIO::Port const &cwASIO::Graph::port(Endpoint end, bool output) const {
+    if (end.node == device) {
+        if (end.port >= (output ? inputs_ : outputs_))
+            throw std::invalid_argument("cwASIO::Graph: no such device channel");
+        return devicePort;
+    }
+    if (end.node >= nodes_.size() || !nodes_[end.node])
+        throw std::invalid_argument("cwASIO::Graph: no such node");
+    auto ports = output ? nodes_[end.node]->outputs() : nodes_[end.node]->inputs();
+    if (end.port >= ports.size())
+        throw std::invalid_argument("cwASIO::Graph: no such port");
+    return ports[end.port];
+}
+
+std::unique_ptr<cwASIO::Schedule> cwASIO::Graph::compile() const {
+    // sort the nodes topologically into levels, the nodes of a level only depend on earlier levels
+    std::vector<unsigned> sources(nodes_.size(), 0);    // connections from nodes not yet scheduled
+    for (Connection const &c : connections_) {
+        if (c.from.node != device && c.to.node != device)
+            ++sources[c.to.node];
+    }
+    std::vector<unsigned> order;
+    for (unsigned n = 0; n < nodes_.size(); ++n) {
+        if (nodes_[n] && sources[n] == 0)
+            order.push_back(n);
+    }
+    auto schedule = std::unique_ptr<Schedule>(new Schedule);
+    for (size_t begin = 0, end; begin < order.size(); begin = end) {
+        end = order.size();
+        schedule->levels_.push_back(unsigned(begin));
+        for (size_t i = begin; i < end; ++i) {
+            for (Connection const &c : connections_) {
+                if (c.from.node == order[i] && c.to.node != device && --sources[c.to.node] == 0)
+                    order.push_back(c.to.node);
+            }
+        }
+    }
+    schedule->levels_.push_back(unsigned(order.size()));
+    if (order.size() != size_t(std::count_if(nodes_.begin(), nodes_.end(), [](auto const &n) { return bool(n); })))
+        throw std::invalid_argument("cwASIO::Graph: the connections form a cycle");
+
+    // lay out the buffers, an output buffer is released after the level of its last consumer has run
+    EndpointMap<Endpoint> source;               // of each connected input
+    EndpointMap<unsigned> consumers;            // of each output, device outputs count as never finishing
+    for (Connection const &c : connections_) {
+        source[c.to] = c.from;
+        consumers[c.from] += c.to.node == device ? 1u << 16 : 1u;
+    }
+    Allocator alloc(maxFrames_);
+    size_t const zero = alloc.allocate(PortType::audio);
+    EndpointMap<size_t> buffer;                 // of each output port
+    EndpointMap<size_t> constant;               // of each unconnected control input, before any buffer is reused
+    std::vector<size_t> ports;                  // offsets, turned into pointers at the end
+    for (unsigned i = 0; i < inputs_; ++i) {
+        buffer[{ device, i }] = alloc.allocate(PortType::audio);
+        schedule->inputs_.push_back(buffer[{ device, i }]);
+    }
+    for (unsigned n : order) {
+        for (unsigned p = 0; p < nodes_[n]->inputs().size(); ++p) {
+            if (nodes_[n]->inputs()[p].type == PortType::control && !source.contains({ n, p }))
+                constant[{ n, p }] = alloc.allocate(PortType::control);
+        }
+    }
+    std::vector<std::pair<PortType, size_t>> released;  // within the current level
+    for (size_t i = 0, level = 1; i < order.size(); ++i) {
+        unsigned n = order[i];
+        Node &node = *nodes_[n];
+        Schedule::Step step{ &node, unsigned(ports.size()), 0 };
+        for (unsigned p = 0; p < node.inputs().size(); ++p) {
+            auto it = source.find({ n, p });
+            if (it != source.end()) {
+                ports.push_back(buffer.at(it->second));
+            } else if (node.inputs()[p].type == PortType::control) {
+                ports.push_back(constant.at({ n, p }));
+            } else {
+                ports.push_back(zero);
+            }
+        }
+        step.out = unsigned(ports.size());
+        for (unsigned p = 0; p < node.outputs().size(); ++p) {
+            buffer[{ n, p }] = alloc.allocate(node.outputs()[p].type);
+            ports.push_back(buffer[{ n, p }]);
+        }
+        for (unsigned p = 0; p < node.inputs().size(); ++p) {
+            auto it = source.find({ n, p });
+            if (it != source.end() && it->second.node != device && --consumers[it->second] == 0)
+                released.emplace_back(node.inputs()[p].type, buffer[it->second]);
+        }
+        for (unsigned p = 0; p < node.outputs().size(); ++p) {
+            if (consumers[{ n, p }] == 0)
+                released.emplace_back(node.outputs()[p].type, buffer[{ n, p }]);
+        }
+        schedule->steps_.push_back(step);
+        schedule->nodes_.push_back(nodes_[n]);
+        if (i + 1 == schedule->levels_[level]) {
+            for (auto [type, offset] : released)
+                alloc.release(type, offset);
+            released.clear();
+            ++level;
+        }
+    }
+    for (unsigned i = 0; i < outputs_; ++i) {
+        auto it = source.find({ device, i });
+        schedule->outputs_.push_back(it != source.end() ? buffer.at(it->second) : zero);
+    }
+
+    schedule->maxFrames_ = maxFrames_;
+    schedule->block_.assign(alloc.size(), 0.f);
+    for (auto [end, offset] : constant)
+        schedule->block_[offset] = nodes_[end.node]->inputs()[end.port].value;
+    for (size_t offset : ports)
+        schedule->ports_.push_back(schedule->block_.data() + offset);
+    return schedule;
+}
+
+
+void cwASIO::Schedule::run(size_t frames, ThreadPool *pool) {
+    assert(frames <= maxFrames_);
+    for (size_t l = 0; l + 1 < levels_.size(); ++l) {
+        Step const *steps = &steps_[levels_[l]];
+        size_t count = levels_[l + 1] - levels_[l];
+        auto process = [this, steps, frames](size_t i) {
+            steps[i].node->process(&ports_[steps[i].in], &ports_[steps[i].out], frames);
+        };
+        if (pool && count > 1) {
+            pool->run(count, process);
+        } else {
+            for (size_t i = 0; i < count; ++i)
+                process(i);
+        }
+    }
+}
+
+
+cwASIO::Engine::Engine(std::span<cwASIOBufferInfo const> buffers, std::span<cwASIOSampleType const> types, long frames, ThreadPool *pool)
+    : frames_{ frames }
+    , pool_{ pool }
+{
+    assert(buffers.size() == types.size());
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        Channel channel{ types[i], { buffers[i].buffers[0], buffers[i].buffers[1] } };
+        (buffers[i].isInput ? inputs_ : outputs_).push_back(channel);
+    }
+}
+
+cwASIO::Engine::~Engine() {
+    delete current_;
+    delete pending_.load();
+    delete retired_.load();
+}
+
+void cwASIO::Engine::install(std::unique_ptr<Schedule> schedule) {
+    if (schedule->inputs() != inputs_.size() || schedule->outputs() != outputs_.size())
+        throw std::invalid_argument("cwASIO::Engine: the schedule's channels don't match");
+    if (schedule->maxFrames() < size_t(frames_))
+        throw std::invalid_argument("cwASIO::Engine: the schedule's periods are too short");
+    delete retired_.exchange(nullptr, std::memory_order_acquire);
+    delete pending_.exchange(schedule.release(), std::memory_order_acq_rel);
+}
+
+void cwASIO::Engine::process(long doubleBufferIndex) {
+    // take over a new schedule only when the previous one has been collected, so that nothing is deleted here
+    if (retired_.load(std::memory_order_acquire) == nullptr) {
+        if (Schedule *next = pending_.exchange(nullptr, std::memory_order_acq_rel)) {
+            retired_.store(current_, std::memory_order_release);
+            current_ = next;
+        }
+    }
+    if (current_ == nullptr) {
+        for (Channel const &out : outputs_)
+            memset(out.buffers[doubleBufferIndex], 0, sampleSize(out.type) * frames_);
+        return;
+    }
+    for (unsigned i = 0; i < inputs_.size(); ++i)
+        toFloat(inputs_[i].type, inputs_[i].buffers[doubleBufferIndex], current_->input(i), frames_);
+    current_->run(size_t(frames_), pool_);
+    for (unsigned i = 0; i < outputs_.size(); ++i)
+        fromFloat(outputs_[i].type, current_->output(i), outputs_[i].buffers[doubleBufferIndex], frames_);
+}
+
+/** @}*/
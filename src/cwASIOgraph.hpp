@@ -0,0 +1,256 @@
+/** @file       cwASIOgraph.hpp
+ *  @brief      cwASIO processing graph for hosts
+ *  @author     Stefan Heinzmann
+ *  @version    1.0
+ *  @date       2023-2025
+ *  @copyright  See file LICENSE in toplevel directory
+ * @addtogroup cwASIO
+ *  @{
+ */
+#pragma once
+
+#include "cwASIO.hpp"
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+
+namespace cwASIO {
+
+    /** Signal types of ports, only ports of the same type can be connected. */
+    enum class PortType {
+        audio,      //!< one float per sample frame
+        control     //!< one float per period
+    };
+
+    /** Description of a port of a node. */
+    struct Port {
+        std::string name;
+        PortType type = PortType::audio;
+        float value = 0.f;      //!< what an unconnected control input reads
+    };
+
+    /** Base class of the processing nodes of a `Graph`.
+     * A node declares its ports at construction, and processes one period at a
+     * time in `process()`. It is shared between the graph it was added to and
+     * the schedules compiled from it, so it keeps its state across graph edits.
+     */
+    class Node {
+    public:
+        Node(std::vector<Port> inputs, std::vector<Port> outputs)
+            : inputs_{ std::move(inputs) }, outputs_{ std::move(outputs) } {}
+        virtual ~Node() =default;
+
+        std::span<Port const> inputs() const { return inputs_; }
+        std::span<Port const> outputs() const { return outputs_; }
+
+        /** Get ready for processing, called from `Graph::add()`.
+         * Anything that needs memory should be allocated here.
+         * @param sampleRate The sample rate of the graph.
+         * @param maxFrames The maximum number of frames in one period.
+         */
+        virtual void prepare(double /*sampleRate*/, size_t /*maxFrames*/) {}
+
+        /** Process one period, called from the buffer switch callback.
+         * Audio ports have `frames` samples, control ports have a single value.
+         * Unconnected audio inputs read as silence, unconnected control inputs
+         * read the value given in their `Port`. The buffers don't overlap.
+         * @param in Pointers to the buffers of the input ports.
+         * @param out Pointers to the buffers of the output ports.
+         * @param frames The number of frames in the period.
+         */
+        virtual void process(float const *const *in, float *const *out, size_t frames) =0;
+
+    private:
+        std::vector<Port> inputs_;
+        std::vector<Port> outputs_;
+    };
+
+    /** A node with a control output, which is set from any thread. */
+    class Control : public Node {
+    public:
+        explicit Control(float value =0.f);
+
+        void set(float value) { value_.store(value, std::memory_order_relaxed); }
+        float get() const { return value_.load(std::memory_order_relaxed); }
+
+        void process(float const *const *in, float *const *out, size_t frames) override;
+
+    private:
+        std::atomic<float> value_;
+    };
+
+    /** A node multiplying its audio input with its control input, which reads 1 when unconnected. */
+    class Gain : public Node {
+    public:
+        Gain();
+
+        void process(float const *const *in, float *const *out, size_t frames) override;
+    };
+
+    /** A node summing its audio inputs. */
+    class Mixer : public Node {
+    public:
+        explicit Mixer(unsigned inputs);
+
+        void process(float const *const *in, float *const *out, size_t frames) override;
+    };
+
+    /** One end of a connection, a port of a node. */
+    struct Endpoint {
+        unsigned node;      //!< as returned by `Graph::add()`, or `Graph::device`
+        unsigned port;      //!< index of the port, or of the device channel
+    };
+
+    class Schedule;
+    class ThreadPool;
+
+    /** Editable description of the signal flow between the device channels and a set of nodes.
+     * The graph is edited on a control thread, and compiled into a `Schedule`
+     * for running inside the buffer switch. The device's input channels are the
+     * outputs of the pseudo node `device`, its output channels are the inputs.
+     * Device channels carry audio. Editing errors throw `std::invalid_argument`.
+     */
+    class Graph {
+    public:
+        static constexpr unsigned device = ~0u;
+
+        /** Create an empty graph.
+         * @param inputs The number of device input channels.
+         * @param outputs The number of device output channels.
+         * @param sampleRate The sample rate, passed on to the nodes.
+         * @param maxFrames The maximum number of frames in one period.
+         */
+        Graph(unsigned inputs, unsigned outputs, double sampleRate, size_t maxFrames);
+
+        /** Add a node, and prepare it for processing.
+         * @return The identifier of the node.
+         */
+        unsigned add(std::shared_ptr<Node> node);
+
+        /** Remove a node together with its connections. */
+        void remove(unsigned node);
+
+        /** Connect an output port to an input port.
+         * An output port may feed any number of inputs, but an input port has at
+         * most one source, an earlier connection to it is replaced.
+         */
+        void connect(Endpoint from, Endpoint to);
+
+        /** Remove the connection to an input port, if any. */
+        void disconnect(Endpoint to);
+
+        /** Sort the nodes and lay out their buffers, for running with an `Engine`.
+         * @return The schedule, which refers to the nodes but not to the graph.
+         * @throw std::invalid_argument if the connections form a cycle.
+         */
+        std::unique_ptr<Schedule> compile() const;
+
+    private:
+        struct Connection {
+            Endpoint from;
+            Endpoint to;
+        };
+
+        Port const &port(Endpoint end, bool output) const;
+
+        unsigned inputs_;
+        unsigned outputs_;
+        double sampleRate_;
+        size_t maxFrames_;
+        std::vector<std::shared_ptr<Node>> nodes_;      // null where a node was removed
+        std::vector<Connection> connections_;
+    };
+
+    /** A compiled graph: the nodes in topological order with their buffers, laid out in one block of memory.
+     * The nodes are grouped in levels, each level only depends on earlier ones.
+     * Running it doesn't allocate, lock or branch on the graph's structure.
+     */
+    class Schedule {
+    public:
+        /** @return The buffer of a device input channel, to be filled before `run()`. */
+        float *input(unsigned channel) { return block_.data() + inputs_[channel]; }
+
+        /** @return The buffer of a device output channel, valid after `run()`. */
+        float const *output(unsigned channel) const { return block_.data() + outputs_[channel]; }
+
+        unsigned inputs() const { return unsigned(inputs_.size()); }
+        unsigned outputs() const { return unsigned(outputs_.size()); }
+        size_t maxFrames() const { return maxFrames_; }
+
+        /** Run all nodes once.
+         * @param frames The number of frames in the period.
+         * @param pool If given, the nodes that don't depend on each other run in parallel on it.
+         */
+        void run(size_t frames, ThreadPool *pool =nullptr);
+
+    private:
+        friend class Graph;
+
+        struct Step {
+            Node *node;
+            unsigned in;        // first index into `ports_` for the inputs
+            unsigned out;       // first index into `ports_` for the outputs
+        };
+
+        size_t maxFrames_ = 0;
+        std::vector<float> block_;                  // all buffers, and a zero buffer
+        std::vector<size_t> inputs_;                // offsets into `block_` of the device channels
+        std::vector<size_t> outputs_;
+        std::vector<Step> steps_;
+        std::vector<unsigned> levels_;              // first step of each level, and the end
+        std::vector<float *> ports_;                // buffers of the ports of all steps
+        std::vector<std::shared_ptr<Node>> nodes_;  // keeps the nodes alive
+    };
+
+    /** Runs schedules on the device's buffers, from the buffer switch callback.
+     * A new schedule is installed from a control thread, and taken over by the
+     * next period, so that the graph can be edited while streaming. Retired
+     * schedules are deleted on the control thread, never in the callback.
+     */
+    class Engine {
+    public:
+        /** Create an engine for the buffers created with `Device::createBuffers()`.
+         * The input buffers feed the device inputs of the graph in the order they
+         * appear in `buffers`, and likewise for the outputs.
+         * @param buffers The buffer infos passed to `createBuffers()`.
+         * @param types The sample types of the channels in `buffers`, as reported by `getChannelInfo()`.
+         * @param frames The buffer size.
+         * @param pool Optional thread pool for running the nodes of a level in parallel.
+         */
+        Engine(std::span<cwASIOBufferInfo const> buffers, std::span<cwASIOSampleType const> types, long frames, ThreadPool *pool =nullptr);
+        ~Engine();
+
+        /** Hand over a schedule, which replaces the current one at the next period.
+         * Its numbers of channels must match the engine's, and its maximum number
+         * of frames must cover the buffer size. Also deletes the schedules that
+         * were retired since the last call.
+         */
+        void install(std::unique_ptr<Schedule> schedule);
+
+        /** Process one period, to be called from the buffer switch callback.
+         * Outputs are silent until the first schedule has been installed.
+         */
+        void process(long doubleBufferIndex);
+
+    private:
+        struct Channel {
+            cwASIOSampleType type;
+            void *buffers[2];
+        };
+
+        std::vector<Channel> inputs_;
+        std::vector<Channel> outputs_;
+        long frames_;
+        ThreadPool *pool_;
+        Schedule *current_ = nullptr;               // owned by the callback
+        std::atomic<Schedule *> pending_ = nullptr; // installed, not yet taken over
+        std::atomic<Schedule *> retired_ = nullptr; // taken out of service, to be deleted
+    };
+
+} // namespace
+
+/** @}*/
@@ -0,0 +1,181 @@
+/** @file       cwASIOmeter.cpp
+ *  @brief      cwASIO level meters for hosts and drivers
+ *  @author     Stefan Heinzmann
+ *  @version    1.0
+ *  @date       2023-2025
+ *  @copyright  See file LICENSE in toplevel directory
+ * @addtogroup cwASIO
+ *  @{
+ */
+
+#include "cwASIOmeter.hpp"
+#include "cwASIO.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+
+namespace {
+    constexpr unsigned phases = 4;
+    constexpr unsigned taps = 12;
+    constexpr long block = 256;         // frames filtered or converted in one go
+
+    // The oversampling filter of ITU-R BS.1770-4, annex 2, one row per phase.
+    // The phases are each other's mirror images, so the order of the taps doesn't matter for the peak.
+    alignas(64) constexpr float coefficients[phases][taps] = {
+        {  0.0017089843750f,  0.0109863281250f, -0.0196533203125f,  0.0332031250000f, -0.0594482421875f,  0.1373291015625f,
+           0.9721679687500f, -0.1022949218750f,  0.0476074218750f, -0.0266113281250f,  0.0148925781250f, -0.0083007812500f },
+        { -0.0291748046875f,  0.0292968750000f, -0.0517578125000f,  0.0891113281250f, -0.1665039062500f,  0.4650878906250f,
+           0.7797851562500f, -0.2003173828125f,  0.1015625000000f, -0.0582275390625f,  0.0330810546875f, -0.0189208984375f },
+        { -0.0189208984375f,  0.0330810546875f, -0.0582275390625f,  0.1015625000000f, -0.2003173828125f,  0.7797851562500f,
+           0.4650878906250f, -0.1665039062500f,  0.0891113281250f, -0.0517578125000f,  0.0292968750000f, -0.0291748046875f },
+        { -0.0083007812500f,  0.0148925781250f, -0.0266113281250f,  0.0476074218750f, -0.1022949218750f,  0.9721679687500f,
+           0.1373291015625f, -0.0594482421875f,  0.0332031250000f, -0.0196533203125f,  0.0109863281250f,  0.0017089843750f }
+    };
+
+    // Largest magnitude, in a form that compilers vectorize.
+    inline float peakOf(float const *x, long n) {
+        float acc[8] = {};
+        long i = 0;
+        for (; i + 8 <= n; i += 8)
+            for (unsigned j = 0; j < 8; ++j)
+                acc[j] = std::max(acc[j], std::abs(x[i + j]));
+        for (; i < n; ++i)
+            acc[0] = std::max(acc[0], std::abs(x[i]));
+        return std::max(std::max(std::max(acc[0], acc[4]), std::max(acc[1], acc[5])), std::max(std::max(acc[2], acc[6]), std::max(acc[3], acc[7])));
+    }
+
+    // Sum of squares, in a form that compilers vectorize.
+    inline float squaresOf(float const *x, long n) {
+        float acc[8] = {};
+        long i = 0;
+        for (; i + 8 <= n; i += 8)
+            for (unsigned j = 0; j < 8; ++j)
+                acc[j] += x[i + j] * x[i + j];
+        for (; i < n; ++i)
+            acc[0] += x[i] * x[i];
+        return ((acc[0] + acc[4]) + (acc[1] + acc[5])) + ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+    }
+}
+
+
+cwASIO::Meter::Meter(size_t channels, Options const &options)
+    : channels_(channels)
+    , window_{ std::max(options.window, 1L) }
+    , truePeak_{ options.truePeak }
+    , published_{ std::make_unique<std::atomic<float>[]>(3 * channels) }
+{
+    for (size_t i = 0; i < 3 * channels; ++i)
+        published_[i].store(0.f, std::memory_order_relaxed);
+}
+
+void cwASIO::Meter::process(size_t channel, float const *samples, long frames) {
+    assert(channel < channels_.size());
+    Channel &c = channels_[channel];
+    c.peak = std::max(c.peak, peakOf(samples, frames));
+    c.sumSquares += double(squaresOf(samples, frames));
+    if (truePeak_)
+        c.truePeak = std::max(c.truePeak, oversampledPeak(c, samples, frames));
+}
+
+void cwASIO::Meter::process(size_t channel, cwASIOSampleType type, void const *samples, long frames) {
+    unsigned size = sampleSize(type);
+    if (size == 0)
+        return;
+    float converted[block];
+    auto src = static_cast<std::byte const *>(samples);
+    for (long done = 0; done < frames; done += block) {
+        long n = std::min(block, frames - done);
+        toFloat(type, src + done * size, converted, n);
+        process(channel, converted, n);
+    }
+}
+
+// Filter the samples block by block, one phase at a time over the whole block, so that the loops vectorize.
+float cwASIO::Meter::oversampledPeak(Channel &c, float const *samples, long frames) {
+    float x[history + block];
+    float y[block];
+    float peak = 0.f;
+    memcpy(x, c.past, sizeof(c.past));
+    for (long done = 0; done < frames; done += block) {
+        long n = std::min(block, frames - done);
+        memcpy(x + history, samples + done, n * sizeof(float));
+        for (unsigned p = 0; p < phases; ++p) {
+            std::fill_n(y, n, 0.f);
+            for (unsigned k = 0; k < taps; ++k) {
+                float h = coefficients[p][k];
+                for (long i = 0; i < n; ++i)
+                    y[i] += h * x[i + k];
+            }
+            peak = std::max(peak, peakOf(y, n));
+        }
+        memmove(x, x + n, sizeof(c.past));
+    }
+    memcpy(c.past, x, sizeof(c.past));
+    return peak;
+}
+
+void cwASIO::Meter::publish(long frames) {
+    frames_ += frames;
+    if (frames_ < window_)
+        return;
+    unsigned seq = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < channels_.size(); ++i) {
+        Channel &c = channels_[i];
+        published_[3 * i].store(c.peak, std::memory_order_relaxed);
+        published_[3 * i + 1].store(float(std::sqrt(c.sumSquares / double(frames_))), std::memory_order_relaxed);
+        published_[3 * i + 2].store(truePeak_ ? std::max(c.truePeak, c.peak) : c.peak, std::memory_order_relaxed);
+        c.peak = c.truePeak = 0.f;
+        c.sumSquares = 0.;
+    }
+    sequence_.store(seq + 2, std::memory_order_release);
+    windows_.fetch_add(1, std::memory_order_release);
+    frames_ = 0;
+}
+
+void cwASIO::Meter::reset() {
+    std::fill(channels_.begin(), channels_.end(), Channel{});
+    frames_ = 0;
+}
+
+cwASIO::Levels cwASIO::Meter::levels(size_t channel) const {
+    assert(channel < channels_.size());
+    Levels l;
+    levels({ &l, 1 }, channel);
+    return l;
+}
+
+void cwASIO::Meter::levels(std::span<Levels> levels) const {
+    assert(levels.size() <= channels_.size());
+    this->levels(levels, 0);
+}
+
+// The published levels are read with a sequence lock, so publishing never waits for a reader.
+void cwASIO::Meter::levels(std::span<Levels> levels, size_t first) const {
+    unsigned seq;
+    do {
+        while ((seq = sequence_.load(std::memory_order_acquire)) & 1)
+            ;
+        for (size_t i = 0; i < levels.size(); ++i) {
+            size_t c = 3 * (first + i);
+            levels[i] = {
+                published_[c].load(std::memory_order_relaxed),
+                published_[c + 1].load(std::memory_order_relaxed),
+                published_[c + 2].load(std::memory_order_relaxed)
+            };
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while (seq != sequence_.load(std::memory_order_relaxed));
+}
+
+cwASIOError cwASIO::Meter::get(cwASIOChannelControls *controls) const {
+    if (!controls || controls->channel < 0 || size_t(controls->channel) >= channels_.size())
+        return ASE_InvalidParameter;
+    controls->meter = long(std::min(double(levels(size_t(controls->channel)).peak), 1.) * 0x7fffffff);
+    return ASE_SUCCESS;
+}
+
+/** @}*/
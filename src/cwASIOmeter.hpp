@@ -0,0 +1,118 @@
+/** @file       cwASIOmeter.hpp
+ *  @brief      cwASIO level meters for hosts and drivers
+ *  @author     Stefan Heinzmann
+ *  @version    1.0
+ *  @date       2023-2025
+ *  @copyright  See file LICENSE in toplevel directory
+ * @addtogroup cwASIO
+ *  @{
+ */
+#pragma once
+
+extern "C" {
+    #include "cwASIOtypes.h"
+}
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+
+namespace cwASIO {
+
+    /** The levels of one channel over a metering window, linear, with full scale at 1. */
+    struct Levels {
+        float peak;         //!< largest magnitude of a sample
+        float rms;          //!< root mean square
+        float truePeak;     //!< largest magnitude of the signal between the samples, estimated with 4x oversampling
+    };
+
+    /** Level meters for a number of channels.
+     * The thread processing the periods feeds the samples of each channel with
+     * `process()`, and ends each period with `publish()`. Once a window of
+     * frames is complete, the levels over it are published, and any thread can
+     * read them without locking or disturbing the processing thread, like a
+     * user interface polling at its own pace.
+     *
+     * The true peak is estimated as recommended by ITU-R BS.1770, by
+     * oversampling four times with the filter given there. This costs about
+     * 48 multiplications per sample, and can be turned off.
+     *
+     * A driver can answer the meter selectors of `future()` with `get()`.
+     */
+    class Meter {
+    public:
+        struct Options {
+            long window = 0;            //!< frames per published window, rounded up to whole periods, 0 for one period
+            bool truePeak = true;       //!< whether to estimate the true peak, otherwise it is the same as the peak
+        };
+
+        explicit Meter(size_t channels, Options const &options);
+        explicit Meter(size_t channels) : Meter(channels, Options{}) {}
+
+        Meter(Meter const &) =delete;
+        Meter &operator=(Meter const &) =delete;
+
+        size_t channels() const { return channels_.size(); }
+
+        /** Measure float samples of a channel in the current period, in the processing thread. */
+        void process(size_t channel, float const *samples, long frames);
+
+        /** Measure samples of a channel given in a driver's sample type, in the processing thread.
+         * Unsupported types are ignored.
+         */
+        void process(size_t channel, cwASIOSampleType type, void const *samples, long frames);
+
+        /** End the current period, in the processing thread.
+         * @param frames The length of the period.
+         */
+        void publish(long frames);
+
+        /** Forget the signal so far, in the processing thread, e.g. when streaming starts again. */
+        void reset();
+
+        /** @return The levels of a channel in the last published window, from any thread. */
+        Levels levels(size_t channel) const;
+
+        /** Read the levels of all channels in the last published window, from any thread.
+         * @param levels One entry per channel.
+         */
+        void levels(std::span<Levels> levels) const;
+
+        /** @return The number of windows published so far, from any thread, for noticing new levels. */
+        uint64_t windows() const { return windows_.load(std::memory_order_acquire); }
+
+        /** Answer `kAsioGetInputMeter` or `kAsioGetOutputMeter` for a driver, with the peak of a channel.
+         * @param controls The channel on input, the meter on return, ranging from 0 to 0x7fffffff at full scale.
+         * @return `ASE_SUCCESS`, or `ASE_InvalidParameter` for a channel out of range.
+         */
+        cwASIOError get(cwASIOChannelControls *controls) const;
+
+    private:
+        static constexpr unsigned history = 11;     // samples kept for the oversampling filter
+
+        struct Channel {
+            double sumSquares = 0.;
+            float peak = 0.f;
+            float truePeak = 0.f;
+            float past[history] = {};
+        };
+
+        float oversampledPeak(Channel &c, float const *samples, long frames);
+        void levels(std::span<Levels> levels, size_t first) const;
+
+        std::vector<Channel> channels_;             // accumulating, owned by the processing thread
+        long window_;
+        bool truePeak_;
+        long frames_ = 0;                           // accumulated in the current window
+        // the published levels, with a sequence lock
+        std::unique_ptr<std::atomic<float>[]> published_;
+        std::atomic<unsigned> sequence_ = 0;
+        std::atomic<uint64_t> windows_ = 0;
+    };
+
+} // namespace
+
+/** @}*/
@@ -0,0 +1,243 @@
+/** @file       cwASIOpool.cpp
+ *  @brief      cwASIO realtime thread pool for hosts
+ *  @author     Stefan Heinzmann
+ *  @version    1.0
+ *  @date       2023-2025
+ *  @copyright  See file LICENSE in toplevel directory
+ * @addtogroup cwASIO
+ *  @{
+ */
+
+#include "cwASIOpool.hpp"
+#include "cwASIO.hpp"
+#include <algorithm>
+#include <cassert>
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    #include <immintrin.h>
+#endif
+
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    // The tasks of a participant not yet taken, [begin, end), together with the generation of the job they belong to.
+    // Tagging them with the generation keeps participants that are late for a job from taking tasks of the next.
+    constexpr uint64_t pack(uint32_t generation, uint32_t begin, uint32_t end) {
+        return uint64_t(generation) << 32 | uint64_t(begin) << 16 | end;
+    }
+    constexpr uint32_t generationOf(uint64_t range) { return uint32_t(range >> 32); }
+    constexpr uint32_t beginOf(uint64_t range) { return uint32_t(range >> 16) & 0xffff; }
+    constexpr uint32_t endOf(uint64_t range) { return uint32_t(range) & 0xffff; }
+
+    inline void relax() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+        _mm_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    // Pin a thread to a CPU and raise its priority, like the driver's scheduler does, @return false if the priority wasn't granted.
+    bool setup(std::thread &thread, int cpu, int priority) {
+#ifdef _WIN32
+        SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << cpu);
+        return priority <= 0 || SetThreadPriority(thread.native_handle(), THREAD_PRIORITY_TIME_CRITICAL);
+#else
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+        if (priority <= 0)
+            return true;
+        struct sched_param param = { .sched_priority = priority };
+        return 0 == pthread_setschedparam(thread.native_handle(), SCHED_FIFO, &param);
+#endif
+    }
+}
+
+
+struct alignas(64) cwASIO::ThreadPool::Participant {
+    std::atomic<uint64_t> range = 0;
+    // statistics, only written by the participant itself
+    std::atomic<uint64_t> jobs = 0;
+    std::atomic<uint64_t> tasks = 0;
+    std::atomic<uint64_t> steals = 0;
+    std::atomic<uint64_t> sleeps = 0;
+    std::atomic<int64_t> busy = 0;
+};
+
+
+cwASIO::ThreadPool::ThreadPool(Options const &options)
+    : spin_{ options.spin }
+{
+    unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+    unsigned workers = options.workers ? options.workers : cpus - 1;
+    participants_ = std::make_unique<Participant[]>(workers + 1);
+    threads_.reserve(workers);
+    for (unsigned i = 0; i < workers; ++i) {
+        threads_.emplace_back(&ThreadPool::work, this, i + 1);
+        int cpu = i < options.cpus.size() ? options.cpus[i] : int((i + 1) % cpus);
+        if (!setup(threads_.back(), cpu, options.priority))
+            realtime_ = false;
+    }
+}
+
+cwASIO::ThreadPool::~ThreadPool() {
+    stop_.store(true);
+    generation_.fetch_add(1);
+    generation_.notify_all();
+    for (std::thread &t : threads_)
+        t.join();
+}
+
+void cwASIO::ThreadPool::run(size_t count, Task task, void *context) {
+    assert(count <= 0xffff);
+    if (count == 0)
+        return;
+    Participant &caller = participants_[0];
+    if (threads_.empty() || count == 1) {
+        auto start = Clock::now();
+        for (size_t i = 0; i < count; ++i)
+            task(context, i);
+        caller.jobs.store(caller.jobs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        caller.tasks.store(caller.tasks.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+        caller.busy.store(caller.busy.load(std::memory_order_relaxed) + (Clock::now() - start).count(), std::memory_order_relaxed);
+        return;
+    }
+
+    // publish the job, then wake the workers if any of them is sleeping
+    uint32_t generation = generation_.load(std::memory_order_relaxed) + 1;
+    unsigned n = workers() + 1;
+    task_.store(task, std::memory_order_relaxed);
+    context_.store(context, std::memory_order_relaxed);
+    remaining_.store(uint32_t(count), std::memory_order_relaxed);
+    uint32_t begin = 0;
+    for (unsigned p = 0; p < n; ++p) {
+        uint32_t end = begin + uint32_t(count / n + (p < count % n));
+        participants_[p].range.store(pack(generation, begin, end), std::memory_order_relaxed);
+        begin = end;
+    }
+    generation_.store(generation);
+    if (sleepers_.load() > 0)
+        generation_.notify_all();
+
+    participate(0, generation, task, context);
+
+    // join, spinning first
+    auto deadline = Clock::now() + spin_;
+    for (unsigned i = 1; remaining_.load(std::memory_order_acquire) != 0; ++i) {
+        relax();
+        if (i % 64 == 0 && Clock::now() > deadline) {
+            joining_.store(true);
+            for (uint32_t r; (r = remaining_.load()) != 0;)
+                remaining_.wait(r);
+            joining_.store(false, std::memory_order_relaxed);
+            break;
+        }
+    }
+}
+
+void cwASIO::ThreadPool::work(unsigned self) {
+    Participant &me = participants_[self];
+    uint32_t seen = 0;
+    for (;;) {
+        // wait for the next job, spinning first
+        auto deadline = Clock::now() + spin_;
+        uint32_t generation;
+        for (unsigned i = 1; (generation = generation_.load(std::memory_order_acquire)) == seen; ++i) {
+            relax();
+            if (i % 64 == 0 && Clock::now() > deadline) {
+                me.sleeps.store(me.sleeps.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                sleepers_.fetch_add(1);
+                generation_.wait(seen);
+                sleepers_.fetch_sub(1);
+            }
+        }
+        if (stop_.load(std::memory_order_relaxed))
+            return;
+        seen = generation;
+        RealtimeScope scope("ThreadPool task");
+        participate(self, generation, task_.load(std::memory_order_relaxed), context_.load(std::memory_order_relaxed));
+    }
+}
+
+void cwASIO::ThreadPool::participate(unsigned self, uint32_t generation, Task task, void *context) {
+    Participant &me = participants_[self];
+    auto start = Clock::now();
+    uint32_t done = 0, steals = 0;
+    for (;;) {
+        size_t index;
+        if (pop(self, generation, index)) {
+            task(context, index);
+            ++done;
+        } else if (steal(self, generation)) {
+            ++steals;
+        } else {
+            break;
+        }
+    }
+    me.jobs.store(me.jobs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    me.tasks.store(me.tasks.load(std::memory_order_relaxed) + done, std::memory_order_relaxed);
+    me.steals.store(me.steals.load(std::memory_order_relaxed) + steals, std::memory_order_relaxed);
+    me.busy.store(me.busy.load(std::memory_order_relaxed) + (Clock::now() - start).count(), std::memory_order_relaxed);
+    if (done > 0 && remaining_.fetch_sub(done) == done && joining_.load())
+        remaining_.notify_one();
+}
+
+bool cwASIO::ThreadPool::pop(unsigned self, uint32_t generation, size_t &index) {
+    std::atomic<uint64_t> &range = participants_[self].range;
+    uint64_t r = range.load(std::memory_order_acquire);
+    while (generationOf(r) == generation && beginOf(r) < endOf(r)) {
+        if (range.compare_exchange_weak(r, pack(generation, beginOf(r) + 1, endOf(r)), std::memory_order_acq_rel)) {
+            index = beginOf(r);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool cwASIO::ThreadPool::steal(unsigned self, uint32_t generation) {
+    unsigned n = workers() + 1;
+    for (unsigned k = 1; k < n; ++k) {
+        std::atomic<uint64_t> &victim = participants_[(self + k) % n].range;
+        uint64_t r = victim.load(std::memory_order_acquire);
+        while (generationOf(r) == generation && beginOf(r) < endOf(r)) {
+            uint32_t begin = beginOf(r), end = endOf(r), mid = begin + (end - begin) / 2;
+            if (victim.compare_exchange_weak(r, pack(generation, begin, mid), std::memory_order_acq_rel)) {
+                participants_[self].range.store(pack(generation, mid, end), std::memory_order_release);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+cwASIO::ThreadPool::Stats cwASIO::ThreadPool::stats(unsigned participant) const {
+    Participant const &p = participants_[participant];
+    return {
+        p.jobs.load(std::memory_order_relaxed),
+        p.tasks.load(std::memory_order_relaxed),
+        p.steals.load(std::memory_order_relaxed),
+        p.sleeps.load(std::memory_order_relaxed),
+        std::chrono::nanoseconds(p.busy.load(std::memory_order_relaxed))
+    };
+}
+
+void cwASIO::ThreadPool::resetStats() {
+    for (unsigned i = 0; i <= workers(); ++i) {
+        Participant &p = participants_[i];
+        p.jobs.store(0, std::memory_order_relaxed);
+        p.tasks.store(0, std::memory_order_relaxed);
+        p.steals.store(0, std::memory_order_relaxed);
+        p.sleeps.store(0, std::memory_order_relaxed);
+        p.busy.store(0, std::memory_order_relaxed);
+    }
+}
+
+/** @}*/
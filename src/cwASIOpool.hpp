@@ -0,0 +1,113 @@
+/** @file       cwASIOpool.hpp
+ *  @brief      cwASIO realtime thread pool for hosts
+ *  @author     Stefan Heinzmann
+ *  @version    1.0
+ *  @date       2023-2025
+ *  @copyright  See file LICENSE in toplevel directory
+ * @addtogroup cwASIO
+ *  @{
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+
+namespace cwASIO {
+
+    /** Work-stealing thread pool for spreading the work of a period over several cores.
+     * The buffer switch callback forks a number of independent tasks with
+     * `run()`, takes part in executing them, and returns when all of them are
+     * done. The tasks are initially split evenly between the calling thread and
+     * the workers, and whoever runs out of tasks steals half of the remaining
+     * ones of another participant. Forking and joining doesn't allocate memory
+     * or take locks.
+     *
+     * Between periods the workers spin for a while before they go to sleep on a
+     * futex, so that they react quickly when the periods are short. The workers
+     * are pinned to CPUs, and get realtime priority where available.
+     */
+    class ThreadPool {
+    public:
+        struct Options {
+            unsigned workers = 0;       //!< number of worker threads, 0 for one less than the number of CPUs
+            std::vector<int> cpus;      //!< CPU for each worker, by default CPUs 1, 2, ... in turn
+            int priority = 0;           //!< SCHED_FIFO priority of the workers, or 0 for normal scheduling
+            std::chrono::nanoseconds spin = std::chrono::microseconds(100);    //!< how long to spin before sleeping
+        };
+
+        /** Statistics of one participant, accumulated since construction or `resetStats()`. */
+        struct Stats {
+            uint64_t jobs;              //!< calls of `run()` taken part in
+            uint64_t tasks;             //!< tasks executed
+            uint64_t steals;            //!< successful steals
+            uint64_t sleeps;            //!< times gone to sleep after spinning
+            std::chrono::nanoseconds busy;  //!< time spent executing tasks and stealing
+        };
+
+        using Task = void (*)(void *context, size_t index);
+
+        explicit ThreadPool(Options const &options);
+        ThreadPool() : ThreadPool(Options{}) {}
+        ~ThreadPool();
+
+        ThreadPool(ThreadPool const &) =delete;
+        ThreadPool &operator=(ThreadPool const &) =delete;
+
+        /** @return The number of worker threads, not counting the caller of `run()`. */
+        unsigned workers() const { return unsigned(threads_.size()); }
+
+        /** @return true if all workers got realtime priority. */
+        bool realtime() const { return realtime_; }
+
+        /** Execute tasks in parallel, and wait until all are done.
+         * Only one thread at a time may call this, normally the buffer switch callback.
+         * @param count The number of tasks, at most 65535.
+         * @param task The function executing a task, it is called with `context` and the index of the task.
+         * @param context Passed on to `task`.
+         */
+        void run(size_t count, Task task, void *context);
+
+        /** Execute tasks in parallel, by calling `f(index)` for each. */
+        template<typename F>
+        void run(size_t count, F &&f) {
+            using T = std::remove_reference_t<F>;
+            run(count, [](void *context, size_t index) { (*static_cast<T *>(context))(index); }, const_cast<std::remove_const_t<T> *>(&f));
+        }
+
+        /** @return The statistics of a participant, 0 for the caller of `run()`, 1 and up for the workers. */
+        Stats stats(unsigned participant) const;
+
+        /** Start counting from zero, must not be called while `run()` is executing. */
+        void resetStats();
+
+    private:
+        struct Participant;
+
+        void work(unsigned self);
+        void participate(unsigned self, uint32_t generation, Task task, void *context);
+        bool pop(unsigned self, uint32_t generation, size_t &index);
+        bool steal(unsigned self, uint32_t generation);
+
+        std::chrono::nanoseconds spin_;
+        bool realtime_ = true;
+        std::unique_ptr<Participant[]> participants_;   // the caller of `run()`, followed by the workers
+        std::vector<std::thread> threads_;
+        std::atomic<uint32_t> generation_ = 0;  // counts calls of `run()`, workers wait for it to change
+        std::atomic<uint32_t> remaining_ = 0;   // tasks not yet done
+        std::atomic<Task> task_ = nullptr;
+        std::atomic<void *> context_ = nullptr;
+        std::atomic<unsigned> sleepers_ = 0;    // workers sleeping on `generation_`
+        std::atomic_bool joining_ = false;      // the caller of `run()` sleeps on `remaining_`
+        std::atomic_bool stop_ = false;
+    };
+
+} // namespace
+
+/** @}*/
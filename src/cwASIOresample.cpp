@@ -0,0 +1,182 @@
+/** @file       cwASIOresample.cpp
+ *  @brief      cwASIO sample rate converter for hosts
+ *  @author     Stefan Heinzmann
+ *  @version    1.0
+ *  @date       2023-2025
+ *  @copyright  See file LICENSE in toplevel directory
+ * @addtogroup cwASIO
+ *  @{
+ */
+
+#include "cwASIOresample.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+
+namespace {
+    struct Preset {
+        unsigned taps;
+        unsigned phases;    // in variable ratio mode
+        double beta;        // Kaiser window parameter
+        double rolloff;     // cutoff relative to the Nyquist frequency
+    };
+
+    Preset const presets[] = {
+        { 16, 64, 6., 0.85 },
+        { 32, 256, 8., 0.91 },
+        { 64, 1024, 10., 0.95 }
+    };
+
+    constexpr unsigned maxFixedPhases = 1024;
+    constexpr size_t chunk = 1024;      // input frames taken in one go
+
+    // Zeroth order modified Bessel function of the first kind, for the Kaiser window.
+    double besselI0(double x) {
+        double sum = 1., term = 1.;
+        for (int k = 1; k < 50 && term > 1e-12 * sum; ++k) {
+            term *= (x / (2. * k)) * (x / (2. * k));
+            sum += term;
+        }
+        return sum;
+    }
+
+    // Dot product in a form that compilers vectorize, `n` must be a multiple of 8.
+    inline float dot(float const *a, float const *b, unsigned n) {
+        float acc[8] = {};
+        for (unsigned i = 0; i < n; i += 8)
+            for (unsigned j = 0; j < 8; ++j)
+                acc[j] += a[i + j] * b[i + j];
+        return ((acc[0] + acc[4]) + (acc[1] + acc[5])) + ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+    }
+}
+
+
+cwASIO::Resampler::Resampler(unsigned channels, double inRate, double outRate, Quality quality, bool variable)
+    : channels_{ channels }
+    , variable_{ variable }
+    , ratio_{ inRate / outRate }
+{
+    assert(channels > 0 && inRate > 0. && outRate > 0.);
+    Preset const &p = presets[unsigned(quality)];
+    taps_ = p.taps;
+    phases_ = p.phases;
+    if (!variable && inRate == std::floor(inRate) && outRate == std::floor(outRate)) {
+        auto g = std::gcd((unsigned long)inRate, (unsigned long)outRate);
+        if (outRate / g <= maxFixedPhases) {
+            phases_ = unsigned(outRate / g);
+            step_ = unsigned(inRate / g);
+        }
+    }
+    if (step_ == 0)
+        variable_ = true;   // ratio isn't a suitable fraction, interpolate between branches
+    makeTable(p.rolloff * std::min(1., outRate / inRate), p.beta);
+    capacity_ = taps_ + chunk;
+    history_.assign(capacity_ * channels_, 0.f);
+    reset();
+}
+
+void cwASIO::Resampler::makeTable(double cutoff, double beta) {
+    table_.assign(size_t(phases_ + 1) * taps_, 0.f);
+    double half = taps_ / 2.;
+    double norm = besselI0(beta);
+    for (unsigned p = 0; p <= phases_; ++p) {
+        float *row = &table_[size_t(p) * taps_];
+        double center = half - 1. + double(p) / phases_;
+        double sum = 0.;
+        for (unsigned k = 0; k < taps_; ++k) {
+            double x = k - center;
+            double w = x / half;
+            double win = std::abs(w) < 1. ? besselI0(beta * std::sqrt(1. - w * w)) / norm : 0.;
+            double arg = 3.14159265358979323846 * cutoff * x;
+            double sinc = x == 0. ? 1. : std::sin(arg) / arg;
+            row[k] = float(win * sinc);
+            sum += row[k];
+        }
+        for (unsigned k = 0; k < taps_; ++k)     // unity gain at DC for each branch
+            row[k] = float(row[k] / sum);
+    }
+}
+
+void cwASIO::Resampler::setRatio(double ratio) {
+    assert(variable_ && ratio > 0.);
+    ratio_ = ratio;
+}
+
+void cwASIO::Resampler::reset() {
+    std::fill(history_.begin(), history_.end(), 0.f);
+    // start with half a filter of silence, so the first output is aligned with the first input
+    fill_ = taps_ / 2 - 1;
+    pos_ = 0;
+    frac_ = 0.;
+    phase_ = 0;
+}
+
+size_t cwASIO::Resampler::inputFor(size_t outFrames) const {
+    if (outFrames == 0)
+        return 0;
+    double last = variable_ ? frac_ + (outFrames - 1) * ratio_ : (phase_ + double(outFrames - 1) * step_) / phases_;
+    size_t needed = pos_ + size_t(last) + taps_;
+    return needed > fill_ ? needed - fill_ : 0;
+}
+
+size_t cwASIO::Resampler::process(float const *const *in, size_t inFrames, float *const *out, size_t outFrames, size_t &consumed) {
+    size_t produced = 0;
+    consumed = 0;
+    for (;;) {
+        // produce as much as the history allows
+        if (variable_) {
+            while (produced < outFrames && pos_ + taps_ <= fill_) {
+                double phase = frac_ * phases_;
+                unsigned p = unsigned(phase);
+                float f = float(phase - p);
+                float const *h0 = &table_[size_t(p) * taps_];
+                float const *h1 = h0 + taps_;
+                for (unsigned c = 0; c < channels_; ++c) {
+                    float const *x = &history_[c * capacity_ + pos_];
+                    float a = dot(x, h0, taps_);
+                    float b = dot(x, h1, taps_);
+                    out[c][produced] = a + f * (b - a);
+                }
+                ++produced;
+                frac_ += ratio_;
+                double whole = std::floor(frac_);
+                pos_ += size_t(whole);
+                frac_ -= whole;
+            }
+        } else {
+            while (produced < outFrames && pos_ + taps_ <= fill_) {
+                float const *h = &table_[size_t(phase_) * taps_];
+                for (unsigned c = 0; c < channels_; ++c)
+                    out[c][produced] = dot(&history_[c * capacity_ + pos_], h, taps_);
+                ++produced;
+                phase_ += step_;
+                pos_ += phase_ / phases_;
+                phase_ %= phases_;
+            }
+        }
+        if (produced == outFrames || consumed == inFrames)
+            return produced;
+        // make room and take more input
+        if (pos_ >= fill_) {            // nothing to keep, and maybe some input to skip entirely
+            size_t skip = std::min(pos_ - fill_, inFrames - consumed);
+            consumed += skip;
+            pos_ -= fill_ + skip;
+            fill_ = 0;
+        } else if (pos_ > 0) {
+            fill_ -= pos_;
+            for (unsigned c = 0; c < channels_; ++c)
+                memmove(&history_[c * capacity_], &history_[c * capacity_ + pos_], fill_ * sizeof(float));
+            pos_ = 0;
+        }
+        size_t n = std::min(capacity_ - fill_, inFrames - consumed);
+        for (unsigned c = 0; c < channels_; ++c)
+            memcpy(&history_[c * capacity_ + fill_], in[c] + consumed, n * sizeof(float));
+        fill_ += n;
+        consumed += n;
+    }
+}
+
+/** @}*/
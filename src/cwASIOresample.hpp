@@ -0,0 +1,109 @@
+/** @file       cwASIOresample.hpp
+ *  @brief      cwASIO sample rate converter for hosts
+ *  @author     Stefan Heinzmann
+ *  @version    1.0
+ *  @date       2023-2025
+ *  @copyright  See file LICENSE in toplevel directory
+ * @addtogroup cwASIO
+ *  @{
+ */
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+
+namespace cwASIO {
+
+    /** Polyphase sample rate converter working on planar float buffers.
+     * The converter filters with a windowed sinc lowpass, stored as a table of
+     * polyphase branches. It has two modes:
+     *
+     * - Fixed ratio: When the ratio of the two sample rates is a fraction with
+     *   a small enough denominator, there is one branch for each output phase,
+     *   and the conversion is exact.
+     * - Variable ratio: The ratio can be changed at any time with `setRatio()`,
+     *   for example to track the drift between two clocks as measured by a
+     *   `ClockEstimator`. Each output sample is interpolated between the two
+     *   nearest branches.
+     *
+     * The inner loops are written such that the compiler can vectorize them,
+     * the number of taps is always a multiple of 8 for this purpose. No memory
+     * is allocated after construction, so `process()` may be called from a
+     * buffer switch callback.
+     */
+    class Resampler {
+    public:
+        /** Quality presets, trading CPU load for stopband attenuation and passband width. */
+        enum class Quality {
+            fast,       //!< 16 taps, for monitoring and drift compensation
+            medium,     //!< 32 taps, good for most purposes
+            high        //!< 64 taps, for mastering and measurements
+        };
+
+        /** Create a converter.
+         * @param channels Number of channels.
+         * @param inRate Sample rate of the input.
+         * @param outRate Sample rate of the output.
+         * @param quality Quality preset.
+         * @param variable true to allow changing the ratio later with `setRatio()`.
+         */
+        Resampler(unsigned channels, double inRate, double outRate, Quality quality =Quality::medium, bool variable =false);
+
+        /** Change the ratio, only allowed in variable ratio mode.
+         * @param ratio The number of input samples per output sample. The
+         * lowpass filter keeps the cutoff frequency determined by the rates given
+         * at construction, so the ratio should stay close to `inRate / outRate`.
+         */
+        void setRatio(double ratio);
+
+        /** @return The number of input samples per output sample. */
+        double ratio() const { return ratio_; }
+
+        /** @return true in variable ratio mode. */
+        bool variable() const { return variable_; }
+
+        /** @return The delay of the filter, in input samples. */
+        double latency() const { return taps_ / 2.; }
+
+        /** Forget all past input, as if newly constructed. */
+        void reset();
+
+        /** @return The number of input frames still needed for producing `outFrames` output frames. */
+        size_t inputFor(size_t outFrames) const;
+
+        /** Convert a block of samples.
+         * @param in Pointers to the input samples of each channel.
+         * @param inFrames Number of input frames available.
+         * @param out Pointers to the output buffers of each channel.
+         * @param outFrames Number of output frames requested.
+         * @param consumed Receives the number of input frames consumed.
+         * @return Number of output frames produced. This is less than requested
+         * when the input frames were insufficient.
+         *
+         * Consumed input is buffered inside the converter, so the caller
+         * continues with the next unconsumed input frame in the next call.
+         */
+        size_t process(float const *const *in, size_t inFrames, float *const *out, size_t outFrames, size_t &consumed);
+
+    private:
+        void makeTable(double cutoff, double beta);
+
+        unsigned channels_;
+        unsigned taps_;             // filter length, multiple of 8
+        unsigned phases_;           // number of polyphase branches
+        unsigned step_ = 0;         // fixed ratio mode: input samples per output sample, times `phases_`
+        bool variable_;
+        double ratio_;
+        std::vector<float> table_;  // `phases_ + 1` branches of `taps_` coefficients
+        std::vector<float> history_;    // per channel: `capacity_` samples
+        size_t capacity_;
+        size_t fill_ = 0;           // valid samples in each history
+        size_t pos_ = 0;            // first history sample for the next output
+        double frac_ = 0.;          // variable ratio mode: fractional position after `pos_`
+        unsigned phase_ = 0;        // fixed ratio mode: branch for the next output
+    };
+
+} // namespace
+
+/** @}*/
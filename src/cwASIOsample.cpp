@@ -0,0 +1,140 @@
+/** @file       cwASIOsample.cpp
+ *  @brief      cwASIO sample format conversions for hosts and drivers
+ *  @author     Stefan Heinzmann
+ *  @version    1.0
+ *  @date       2023-2025
+ *  @copyright  See file LICENSE in toplevel directory
+ * @addtogroup cwASIO
+ *  @{
+ */
+
+#include "cwASIO.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+
+namespace {
+    struct SampleFormat {
+        unsigned bytes;     // size of one sample
+        bool msb;           // big endian
+        bool isFloat;
+        int shift;          // left shift that brings an integer sample to full 32 bit scale
+    };
+
+    bool formatOf(cwASIOSampleType type, SampleFormat &fmt) {
+        switch (type) {
+        case ASIOSTInt16MSB:   fmt = { 2, true, false, 16 }; return true;
+        case ASIOSTInt24MSB:   fmt = { 3, true, false, 8 }; return true;
+        case ASIOSTInt32MSB:   fmt = { 4, true, false, 0 }; return true;
+        case ASIOSTFloat32MSB: fmt = { 4, true, true, 0 }; return true;
+        case ASIOSTFloat64MSB: fmt = { 8, true, true, 0 }; return true;
+        case ASIOSTInt32MSB16: fmt = { 4, true, false, 16 }; return true;
+        case ASIOSTInt32MSB18: fmt = { 4, true, false, 14 }; return true;
+        case ASIOSTInt32MSB20: fmt = { 4, true, false, 12 }; return true;
+        case ASIOSTInt32MSB24: fmt = { 4, true, false, 8 }; return true;
+        case ASIOSTInt16LSB:   fmt = { 2, false, false, 16 }; return true;
+        case ASIOSTInt24LSB:   fmt = { 3, false, false, 8 }; return true;
+        case ASIOSTInt32LSB:   fmt = { 4, false, false, 0 }; return true;
+        case ASIOSTFloat32LSB: fmt = { 4, false, true, 0 }; return true;
+        case ASIOSTFloat64LSB: fmt = { 8, false, true, 0 }; return true;
+        case ASIOSTInt32LSB16: fmt = { 4, false, false, 16 }; return true;
+        case ASIOSTInt32LSB18: fmt = { 4, false, false, 14 }; return true;
+        case ASIOSTInt32LSB20: fmt = { 4, false, false, 12 }; return true;
+        case ASIOSTInt32LSB24: fmt = { 4, false, false, 8 }; return true;
+        default:               return false;
+        }
+    }
+
+    // Load/store the bytes of a sample as an unsigned integer in native byte order.
+    uint64_t loadBits(unsigned char const *p, SampleFormat const &fmt) {
+        uint64_t v = 0;
+        for (unsigned i = 0; i < fmt.bytes; ++i)
+            v |= uint64_t(p[fmt.msb ? i : fmt.bytes - 1 - i]) << (8 * (fmt.bytes - 1 - i));
+        return v;
+    }
+
+    void storeBits(unsigned char *p, uint64_t v, SampleFormat const &fmt) {
+        for (unsigned i = 0; i < fmt.bytes; ++i)
+            p[fmt.msb ? i : fmt.bytes - 1 - i] = (unsigned char)(v >> (8 * (fmt.bytes - 1 - i)));
+    }
+}
+
+unsigned cwASIO::sampleSize(cwASIOSampleType type) {
+    SampleFormat fmt;
+    return formatOf(type, fmt) ? fmt.bytes : 0;
+}
+
+bool cwASIO::toFloat(cwASIOSampleType type, void const *src, float *dst, long count) {
+    SampleFormat fmt;
+    if (!formatOf(type, fmt))
+        return false;
+    auto p = static_cast<unsigned char const *>(src);
+    switch (type) {     // fast paths for the native formats
+    case ASIOSTFloat32LSB:
+        memcpy(dst, src, count * sizeof(float));
+        return true;
+    case ASIOSTInt32LSB:
+        for (long i = 0; i < count; ++i) {
+            int32_t v;
+            memcpy(&v, p + 4 * i, 4);
+            dst[i] = float(v) * (1.f / 2147483648.f);
+        }
+        return true;
+    case ASIOSTInt16LSB:
+        for (long i = 0; i < count; ++i) {
+            int16_t v;
+            memcpy(&v, p + 2 * i, 2);
+            dst[i] = float(v) * (1.f / 32768.f);
+        }
+        return true;
+    default:
+        break;
+    }
+    for (long i = 0; i < count; ++i, p += fmt.bytes) {
+        uint64_t bits = loadBits(p, fmt);
+        if (fmt.bytes == 8) {
+            double d;
+            memcpy(&d, &bits, 8);
+            dst[i] = float(d);
+        } else if (fmt.isFloat) {
+            uint32_t b = uint32_t(bits);
+            memcpy(&dst[i], &b, 4);
+        } else {
+            int32_t v = int32_t(uint32_t(bits << (32 - 8 * fmt.bytes + (fmt.bytes == 4 ? fmt.shift : 0))));
+            dst[i] = float(v) * (1.f / 2147483648.f);
+        }
+    }
+    return true;
+}
+
+bool cwASIO::fromFloat(cwASIOSampleType type, float const *src, void *dst, long count) {
+    SampleFormat fmt;
+    if (!formatOf(type, fmt))
+        return false;
+    auto p = static_cast<unsigned char *>(dst);
+    if (type == ASIOSTFloat32LSB) {
+        memcpy(dst, src, count * sizeof(float));
+        return true;
+    }
+    for (long i = 0; i < count; ++i, p += fmt.bytes) {
+        if (fmt.bytes == 8) {
+            double d = src[i];
+            uint64_t bits;
+            memcpy(&bits, &d, 8);
+            storeBits(p, bits, fmt);
+        } else if (fmt.isFloat) {
+            uint32_t bits;
+            memcpy(&bits, &src[i], 4);
+            storeBits(p, bits, fmt);
+        } else {
+            double d = std::clamp(double(src[i]) * 2147483648., -2147483648., 2147483647.);
+            int32_t v = int32_t(std::lrint(d));
+            int shift = fmt.bytes == 4 ? fmt.shift : 32 - 8 * int(fmt.bytes);
+            storeBits(p, uint32_t(v >> shift), fmt);
+        }
+    }
+    return true;
+}
+
+/** @}*/
@@ -0,0 +1,216 @@
+/** @file       cwASIOstream.cpp
+ *  @brief      cwASIO blocking stream for hosts
+ *  @author     Stefan Heinzmann
+ *  @version    1.0
+ *  @date       2023-2025
+ *  @copyright  See file LICENSE in toplevel directory
+ * @addtogroup cwASIO
+ *  @{
+ */
+
+#include "cwASIOstream.hpp"
+#include <algorithm>
+#include <cstring>
+#include <system_error>
+
+
+cwASIO::Stream::Stream(Device &device, std::span<long const> inputs, std::span<long const> outputs, long bufferSize, unsigned depth)
+    : device_{ device }
+    , frames_{ bufferSize }
+{
+    std::vector<cwASIOBufferInfo> infos;
+    for (long ch : inputs)
+        infos.push_back({ .isInput = ASIOTrue, .channelNum = ch });
+    for (long ch : outputs)
+        infos.push_back({ .isInput = ASIOFalse, .channelNum = ch });
+    if (auto err = device_.createBuffers(infos.data(), long(infos.size()), bufferSize))
+        throw std::system_error(err, err_category(), "when trying to create the buffers");
+    for (cwASIOBufferInfo const &b : infos) {
+        cwASIOChannelInfo info = {};
+        info.channel = b.channelNum;
+        info.isInput = b.isInput;
+        auto err = device_.getChannelInfo(info);
+        if (!err && sampleSize(info.type) == 0)
+            err = ASE_InvalidMode;
+        if (err) {
+            device_.disposeBuffers();
+            throw std::system_error(err, err_category(), "when reading the info for channel " + std::to_string(b.channelNum));
+        }
+        Fifo &fifo = b.isInput ? in_ : out_;
+        fifo.types.push_back(info.type);
+        fifo.capacity = size_t(depth) * size_t(bufferSize);
+        fifo.data.emplace_back(fifo.capacity * sampleSize(info.type));
+    }
+    task_.emplace(pump());
+}
+
+cwASIO::Stream::~Stream() {
+    stop();
+    device_.disposeBuffers();
+}
+
+cwASIOError cwASIO::Stream::start() {
+    running_.store(true);
+    return device_.start();
+}
+
+cwASIOError cwASIO::Stream::stop() {
+    auto err = device_.stop();
+    running_.store(false);
+    in_.notify();
+    out_.notify();
+    return err;
+}
+
+size_t cwASIO::Stream::readAvailable() const {
+    return size_t(in_.head.load(std::memory_order_acquire) - in_.tail.load(std::memory_order_relaxed));
+}
+
+size_t cwASIO::Stream::writeAvailable() const {
+    return out_.capacity - size_t(out_.head.load(std::memory_order_relaxed) - out_.tail.load(std::memory_order_acquire));
+}
+
+size_t cwASIO::Stream::read(float *const *channels, size_t frames) {
+    return transfer<true>(in_, frames, [this, channels](size_t ch, uint64_t position, size_t done, size_t n) {
+        if (!channels[ch])
+            return;
+        // convert straight out of the ring, in up to two pieces
+        size_t size = sampleSize(in_.types[ch]);
+        size_t offset = size_t(position % in_.capacity);
+        size_t first = std::min(n, in_.capacity - offset);
+        toFloat(in_.types[ch], in_.data[ch].data() + offset * size, channels[ch] + done, long(first));
+        toFloat(in_.types[ch], in_.data[ch].data(), channels[ch] + done + first, long(n - first));
+    });
+}
+
+size_t cwASIO::Stream::readRaw(void *const *channels, size_t frames) {
+    return transfer<true>(in_, frames, [this, channels](size_t ch, uint64_t position, size_t done, size_t n) {
+        if (channels[ch])
+            in_.get(ch, position, static_cast<std::byte *>(channels[ch]) + done * sampleSize(in_.types[ch]), n);
+    });
+}
+
+size_t cwASIO::Stream::write(float const *const *channels, size_t frames) {
+    return transfer<false>(out_, frames, [this, channels](size_t ch, uint64_t position, size_t done, size_t n) {
+        size_t size = sampleSize(out_.types[ch]);
+        size_t offset = size_t(position % out_.capacity);
+        size_t first = std::min(n, out_.capacity - offset);
+        std::byte *dst = out_.data[ch].data();
+        if (!channels[ch]) {
+            memset(dst + offset * size, 0, first * size);
+            memset(dst, 0, (n - first) * size);
+            return;
+        }
+        fromFloat(out_.types[ch], channels[ch] + done, dst + offset * size, long(first));
+        fromFloat(out_.types[ch], channels[ch] + done + first, dst, long(n - first));
+    });
+}
+
+size_t cwASIO::Stream::writeRaw(void const *const *channels, size_t frames) {
+    return transfer<false>(out_, frames, [this, channels](size_t ch, uint64_t position, size_t done, size_t n) {
+        if (channels[ch]) {
+            out_.put(ch, position, static_cast<std::byte const *>(channels[ch]) + done * sampleSize(out_.types[ch]), n);
+        } else {
+            size_t size = sampleSize(out_.types[ch]);
+            size_t offset = size_t(position % out_.capacity);
+            size_t first = std::min(n, out_.capacity - offset);
+            memset(out_.data[ch].data() + offset * size, 0, first * size);
+            memset(out_.data[ch].data(), 0, (n - first) * size);
+        }
+    });
+}
+
+/** Move frames between the caller and a FIFO, sleeping while the FIFO is empty (reading) or full (writing). */
+template<bool isRead, typename Convert>
+size_t cwASIO::Stream::transfer(Fifo &fifo, size_t frames, Convert &&convert) {
+    size_t done = 0;
+    while (done < frames) {
+        uint64_t head = fifo.head.load(std::memory_order_acquire);
+        uint64_t tail = fifo.tail.load(std::memory_order_acquire);
+        size_t ready = isRead ? size_t(head - tail) : fifo.capacity - size_t(head - tail);
+        if (ready == 0) {
+            if (!running_.load())
+                break;      // nothing more will come
+            uint32_t signal = fifo.signal.load();
+            fifo.waiting.store(true);
+            if (size_t(fifo.head.load() - fifo.tail.load()) == (isRead ? 0 : fifo.capacity) && running_.load())
+                fifo.signal.wait(signal);
+            fifo.waiting.store(false, std::memory_order_relaxed);
+            if (!running_.load())
+                break;
+            continue;
+        }
+        size_t n = std::min(ready, frames - done);
+        uint64_t position = isRead ? tail : head;
+        for (size_t ch = 0; ch < fifo.types.size(); ++ch)
+            convert(ch, position, done, n);
+        if constexpr (isRead)
+            fifo.tail.store(tail + n, std::memory_order_release);
+        else
+            fifo.head.store(head + n, std::memory_order_release);
+        done += n;
+    }
+    return done;
+}
+
+/** Exchange the device's buffers with the FIFOs, each period. */
+cwASIO::Task cwASIO::Stream::pump() {
+    for (;;) {
+        Period period = co_await device_.nextPeriod();
+        size_t frames = size_t(period.frames());
+        std::span<Buffer const> inputs = period.buffers.first(in_.types.size());
+        std::span<Buffer const> outputs = period.buffers.subspan(in_.types.size());
+
+        uint64_t head = in_.head.load(std::memory_order_relaxed);
+        if (in_.capacity - size_t(head - in_.tail.load(std::memory_order_acquire)) >= frames) {
+            for (size_t ch = 0; ch < inputs.size(); ++ch)
+                in_.put(ch, head, inputs[ch].data, frames);
+            in_.head.store(head + frames, std::memory_order_release);
+            in_.notify();
+        } else if (!inputs.empty()) {
+            overflows_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        uint64_t tail = out_.tail.load(std::memory_order_relaxed);
+        head = out_.head.load(std::memory_order_acquire);
+        size_t n = std::min(size_t(head - tail), frames);
+        if (n < frames && head != 0)
+            underflows_.fetch_add(1, std::memory_order_relaxed);
+        for (size_t ch = 0; ch < outputs.size(); ++ch) {
+            size_t size = sampleSize(outputs[ch].type);
+            out_.get(ch, tail, outputs[ch].data, n);
+            memset(static_cast<std::byte *>(outputs[ch].data) + n * size, 0, (frames - n) * size);
+        }
+        if (n > 0) {
+            out_.tail.store(tail + n, std::memory_order_release);
+            out_.notify();
+        }
+    }
+}
+
+void cwASIO::Stream::Fifo::put(size_t channel, uint64_t position, void const *src, size_t frames) {
+    size_t size = sampleSize(types[channel]);
+    size_t offset = size_t(position % capacity);
+    size_t first = std::min(frames, capacity - offset);
+    std::byte *ring = data[channel].data();
+    memcpy(ring + offset * size, src, first * size);
+    memcpy(ring, static_cast<std::byte const *>(src) + first * size, (frames - first) * size);
+}
+
+void cwASIO::Stream::Fifo::get(size_t channel, uint64_t position, void *dst, size_t frames) const {
+    size_t size = sampleSize(types[channel]);
+    size_t offset = size_t(position % capacity);
+    size_t first = std::min(frames, capacity - offset);
+    std::byte const *ring = data[channel].data();
+    memcpy(dst, ring + offset * size, first * size);
+    memcpy(static_cast<std::byte *>(dst) + first * size, ring, (frames - first) * size);
+}
+
+/** Tell a waiting caller that the FIFO has changed, without a system call if nobody waits. */
+void cwASIO::Stream::Fifo::notify() {
+    signal.fetch_add(1);
+    if (waiting.load())
+        signal.notify_one();
+}
+
+/** @}*/
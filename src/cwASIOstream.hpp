@@ -0,0 +1,126 @@
+/** @file       cwASIOstream.hpp
+ *  @brief      cwASIO blocking stream for hosts
+ *  @author     Stefan Heinzmann
+ *  @version    1.0
+ *  @date       2023-2025
+ *  @copyright  See file LICENSE in toplevel directory
+ * @addtogroup cwASIO
+ *  @{
+ */
+#pragma once
+
+#include "cwASIO.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+
+namespace cwASIO {
+
+    /** Blocking read and write access to the channels of a device, instead of callbacks.
+     * The stream takes over the device's buffer switch, using its coroutine
+     * mode. Each period the inputs are appended to a FIFO, and the outputs are
+     * taken from another FIFO, both lock-free and holding the device's sample
+     * types. The caller's thread reads and writes any number of frames,
+     * converting to and from float if desired, and sleeps on a futex while the
+     * FIFOs don't allow it to continue.
+     *
+     * When the input FIFO is full, the period's input is dropped and counted
+     * as an overflow. When the output FIFO runs empty after writing has begun,
+     * the rest of the period is silent and counted as an underflow. Writing
+     * before `start()` primes the outputs.
+     */
+    class Stream {
+    public:
+        /** Create the buffers for the channels.
+         * @param device The device, initialized, but without buffers.
+         * @param inputs The input channel numbers, in the order the stream delivers them.
+         * @param outputs The output channel numbers, in the order the stream takes them.
+         * @param bufferSize The buffer size of the device.
+         * @param depth The capacity of each FIFO, in periods.
+         * @throw std::system_error if the device refuses the channels.
+         */
+        Stream(Device &device, std::span<long const> inputs, std::span<long const> outputs, long bufferSize, unsigned depth =4);
+        ~Stream();
+
+        Stream(Stream const &) =delete;
+        Stream &operator=(Stream const &) =delete;
+
+        cwASIOError start();
+
+        /** Stop the device, and release the threads blocked in reading or writing. */
+        cwASIOError stop();
+
+        size_t inputs() const { return in_.types.size(); }
+        size_t outputs() const { return out_.types.size(); }
+        cwASIOSampleType inputType(size_t channel) const { return in_.types[channel]; }
+        cwASIOSampleType outputType(size_t channel) const { return out_.types[channel]; }
+        long bufferSize() const { return frames_; }
+
+        /** @return The number of frames that can be read without blocking. */
+        size_t readAvailable() const;
+
+        /** @return The number of frames that can be written without blocking. */
+        size_t writeAvailable() const;
+
+        /** Read input frames, waiting until enough are available.
+         * @param channels One buffer per input channel, null to skip a channel.
+         * @param frames The number of frames to read.
+         * @return The number of frames read, less than requested only if the stream was stopped.
+         */
+        size_t read(float *const *channels, size_t frames);
+
+        /** Read input frames in the device's sample types, see `read()`. */
+        size_t readRaw(void *const *channels, size_t frames);
+
+        /** Write output frames, waiting until there is enough space.
+         * @param channels One buffer per output channel, null for silence.
+         * @param frames The number of frames to write.
+         * @return The number of frames written, less than requested only if the stream was stopped.
+         */
+        size_t write(float const *const *channels, size_t frames);
+
+        /** Write output frames in the device's sample types, see `write()`. */
+        size_t writeRaw(void const *const *channels, size_t frames);
+
+        /** @return The number of input periods dropped because the input FIFO was full. */
+        uint64_t overflows() const { return overflows_.load(std::memory_order_relaxed); }
+
+        /** @return The number of output periods not filled completely because the output FIFO was empty. */
+        uint64_t underflows() const { return underflows_.load(std::memory_order_relaxed); }
+
+    private:
+        struct Fifo {
+            std::vector<cwASIOSampleType> types;
+            std::vector<std::vector<std::byte>> data;   // one ring per channel
+            size_t capacity = 0;                    // in frames
+            std::atomic<uint64_t> head = 0;         // frames written
+            std::atomic<uint64_t> tail = 0;         // frames read
+            std::atomic<uint32_t> signal = 0;       // changes each period, for waiting on
+            std::atomic_bool waiting = false;       // the caller sleeps on `signal`
+
+            void put(size_t channel, uint64_t position, void const *src, size_t frames);
+            void get(size_t channel, uint64_t position, void *dst, size_t frames) const;
+            void notify();
+        };
+
+        Task pump();
+        template<bool isRead, typename Convert>
+        size_t transfer(Fifo &fifo, size_t frames, Convert &&convert);
+
+        Device &device_;
+        long frames_;
+        Fifo in_;
+        Fifo out_;
+        std::atomic<uint64_t> overflows_ = 0;
+        std::atomic<uint64_t> underflows_ = 0;
+        std::atomic_bool running_ = false;
+        std::optional<Task> task_;
+    };
+
+} // namespace
+
+/** @}*/
@@ -115,7 +115,7 @@ struct cwASIOBufferInfo {
 };
 
 struct cwASIOTimeInfo {
-    double speed;               //!< absolute speed (1. = nominal)
+    double speed;               //!< absolute speed (1. = nominal), in freewheel mode the achieved speed relative to realtime
     cwASIOTimeStamp systemTime; //!< system time related to samplePosition, in nanoseconds on mac, must be derived from `Microseconds()` (not `UpTime()`!) on windows, must be derived from `timeGetTime()`
     cwASIOSamples samplePosition;
     cwASIOSampleRate sampleRate;//!< current rate
@@ -197,6 +197,26 @@ struct cwASIOCallbacks {
     struct cwASIOTime *(*bufferSwitchTimeInfo) (struct cwASIOTime *params, long doubleBufferIndex, cwASIOBool directProcess);
 };
 
+/** Callbacks that pass a context pointer of the host.
+ * A host registers them with the `kcwASIOsetUserCallbacks` selector of
+ * `future()` before calling `createBuffers()`. The driver copies the struct,
+ * and calls these callbacks instead of the ones passed to `createBuffers()`,
+ * until `disposeBuffers()`. The callbacks passed to `createBuffers()` must
+ * nevertheless be valid. Passing NULL cancels a registration. While buffers
+ * exist, the selector is rejected with `ASE_InvalidMode`.
+ *
+ * Drivers that don't know the selector return `ASE_InvalidParameter`, in which
+ * case the host must fall back to the plain callbacks, as
+ * `cwASIOcreateBuffers()` does.
+ */
+struct cwASIOUserCallbacks {
+    void *userData;     //!< passed as the first argument to each of the callbacks
+    void (*bufferSwitch) (void *userData, long doubleBufferIndex, cwASIOBool directProcess);
+    void (*sampleRateDidChange) (void *userData, cwASIOSampleRate sRate);
+    long (*asioMessage) (void *userData, long selector, long value, void *message, double *opt);
+    struct cwASIOTime *(*bufferSwitchTimeInfo) (void *userData, struct cwASIOTime *params, long doubleBufferIndex, cwASIOBool directProcess);
+};
+
 //! asioMessage selectors
 enum cwASIOMessageSel {
     kAsioSelectorSupported = 1, //!< selector in <value>, returns 1L if supported, 0 otherwise
@@ -268,7 +288,9 @@ enum cwASIOFutureSel {
     kAsioGetInternalBufferSamples = 0x25042012,  //!< cwASIOInternalBufferInfo * in params. Deliver size of driver internal buffering, return `ASE_SUCCESS` if supported
 
     // cwASIO extensions
-    kcwASIOsetInstanceName = 0x7F000001   //!< char const * to name in params
+    kcwASIOsetInstanceName = 0x7F000001,  //!< char const * to name in params
+    kcwASIOsetFreewheel = 0x7F000002,     //!< cwASIOBool const * in params, ASIOTrue enables freewheel, ASIOFalse disables it
+    kcwASIOsetUserCallbacks = 0x7F000003  //!< struct cwASIOUserCallbacks const * in params, or NULL, see there
 };
 
 struct cwASIOInputMonitor {
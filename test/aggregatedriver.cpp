@@ -0,0 +1,922 @@
+/** @file       aggregatedriver.cpp
+ *  @brief      cwASIO driver combining several cwASIO devices into one
+ *  @author     Stefan Heinzmann
+ *  @version    1.0
+ *  @date       2023-2025
+ *  @copyright  See file LICENSE in toplevel directory
+ * @addtogroup cwASIO_test
+ *  @{
+ *
+ * This driver loads several other cwASIO driver instances, its members, and
+ * presents their channels as one device. The first member is the clock master:
+ * its buffer switches drive the buffer switches of the aggregate. The other
+ * members run on their own clocks, and their channels are passed through FIFOs
+ * and adaptively resampled to the master clock.
+ *
+ * The resampling ratio of each member is steered by its sample position. The
+ * buffer switches of the master and of the member are timed with a
+ * `cwASIO::ClockEstimator` each, whose measured sample rates give the nominal
+ * ratio. A PI controller corrects the remaining deviation of the FIFO fill,
+ * estimated from the member's sample position at the time of the master's
+ * buffer switch, from its target. Should the fill nevertheless leave its bounds,
+ * for example because a member stalled, the FIFO is reset to its target, so
+ * the latency remains bounded.
+ *
+ * All channels are presented as `ASIOSTFloat32LSB`, the conversion to and from
+ * the members' sample types is done by the driver.
+ *
+ * The driver is configured through the registry, i.e. the files in
+ * `/etc/cwASIO/<name>` on Linux. The following keys are recognized:
+ *
+ * - `members`: Comma separated list of the instance names of the members, the
+ *   first one being the clock master.
+ * - `latency`: Additional FIFO latency in samples for the non-master members
+ *   (default 0), as a safety margin against scheduling jitter.
+ */
+
+extern "C" {
+    #include "cwASIOdriver.h"
+}
+#include "cwASIO.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+std::atomic_uint activeInstances = 0;
+
+class AggregateDriver;
+
+/** A member device of an aggregate. */
+struct Member {
+    AggregateDriver *owner = nullptr;
+    std::string name;
+    cwASIODriver *drv = nullptr;
+    bool master = false;
+    long numInputs = 0;
+    long numOutputs = 0;
+    long firstInput = 0;                // index of the first input channel in the aggregate
+    long firstOutput = 0;               // index of the first output channel in the aggregate
+    long bufferSize = 0;
+    std::vector<cwASIOSampleType> inputTypes;
+    std::vector<cwASIOSampleType> outputTypes;
+    std::vector<cwASIOBufferInfo> buffers;      // active channels of this member
+    std::vector<long> channelMap;       // aggregate channel for each entry in `buffers`, -1 for the master's dummy channel
+    bool created = false;               // whether the member's buffers exist
+
+    // State for non-master members, shared between the member's and the master's callbacks.
+    cwASIO::ClockEstimator clock;
+    std::vector<float> inFifo;          // interleaved frames, power of two size
+    std::vector<float> outFifo;
+    std::vector<float> stage;           // one period of one channel, for the member's callback
+    size_t fifoFrames = 0;
+    size_t inWidth = 0;                 // number of active channels in the FIFOs
+    size_t outWidth = 0;
+    std::atomic<uint64_t> inWritten = 0;    // frames, written by the member's callback
+    std::atomic<uint64_t> inRead = 0;       // frames, written by the master's callback
+    std::atomic<uint64_t> outWritten = 0;   // frames, written by the master's callback
+    std::atomic<uint64_t> outRead = 0;      // frames, written by the member's callback
+    uint64_t position = 0;              // sample position of the member's callback, counted from the start
+    uint64_t offset = 0;                // from the member's reported sample position to `position`
+    bool anchored = false;              // whether `offset` is known
+    std::atomic_bool resync = false;    // the FIFOs need to be reset to the target fill
+
+    // State of the master's callback for this member.
+    double inPhase = 0.;                // fractional read position into the input FIFO
+    double outPhase = 0.;               // fractional read position into the master's period
+    double integral = 0.;               // integral term of the PI controller
+    double ratio = 1.;                  // member samples per master sample
+    std::vector<float> lastOut;         // last output frame of the previous period
+};
+
+class AggregateDriver : public cwASIODriver {
+    AggregateDriver(AggregateDriver &&) =delete;  // no move/copy
+
+public:
+    AggregateDriver()
+        : cwASIODriver{ &vtbl }
+        , references{1}
+    {
+        activeInstances.fetch_add(1);
+    }
+
+    ~AggregateDriver() {
+        stop();
+        disposeBuffers();
+        unloadMembers();
+    }
+
+    long queryInterface(cwASIOGUID const *guid, void **ptr) {
+        if(guid) {
+            instance = cwASIOfindInstance(guid);
+            if(!instance)
+                return E_NOINTERFACE;   // GUID not found in registry
+        }
+        // It's our GUID
+        *ptr = this;
+        addRef();
+        return 0;       // success
+    }
+
+    unsigned long addRef() {
+        return references.fetch_add(1) + 1;
+    }
+
+    unsigned long release() {
+        unsigned long res = references.fetch_sub(1) - 1;
+        if (res == 0) {
+            delete this;
+            atomic_fetch_sub(&activeInstances, 1);
+        }
+        return res;
+    }
+
+    cwASIOBool init(void *sys);
+
+    void getDriverName(char *buf) {
+        if (buf && instance)
+            strcpy(buf, instance->name);
+    }
+
+    long getDriverVersion() {
+        return 1;
+    }
+
+    void getErrorMessage(char *buf) {
+        if (buf) {
+            strncpy(buf, errorMessage.c_str(), 123);
+            buf[123] = '\0';
+        }
+    }
+
+    cwASIOError start();
+    cwASIOError stop();
+
+    cwASIOError getChannels(long *in, long *out) {
+        if (!in || !out)
+            return ASE_InvalidParameter;
+        if (members.empty())
+            return ASE_NotPresent;
+        *in = long(inputs.size());
+        *out = long(outputs.size());
+        return ASE_OK;
+    }
+
+    cwASIOError getLatencies(long *in, long *out) {
+        if (members.empty())
+            return ASE_NotPresent;
+        if (auto err = master().drv->lpVtbl->getLatencies(master().drv, in, out))
+            return err;
+        *in += extraLatency();
+        *out += extraLatency();
+        return ASE_OK;
+    }
+
+    cwASIOError getBufferSize(long *min, long *max, long *pref, long *gran) {
+        if (members.empty())
+            return ASE_NotPresent;
+        return master().drv->lpVtbl->getBufferSize(master().drv, min, max, pref, gran);
+    }
+
+    cwASIOError canSampleRate(double srate) {
+        if (members.empty())
+            return ASE_NotPresent;
+        for (auto &m : members)
+            if (auto err = m->drv->lpVtbl->canSampleRate(m->drv, srate))
+                return err;
+        return ASE_OK;
+    }
+
+    cwASIOError getSampleRate(double *srate) {
+        if (members.empty())
+            return ASE_NotPresent;
+        return master().drv->lpVtbl->getSampleRate(master().drv, srate);
+    }
+
+    cwASIOError setSampleRate(double srate) {
+        if (auto err = canSampleRate(srate))
+            return err;
+        for (auto &m : members)
+            if (auto err = m->drv->lpVtbl->setSampleRate(m->drv, srate))
+                return err;
+        return ASE_OK;
+    }
+
+    cwASIOError getClockSources(struct cwASIOClockSource *clocks, long *num) {
+        if (members.empty())
+            return ASE_NotPresent;
+        return master().drv->lpVtbl->getClockSources(master().drv, clocks, num);
+    }
+
+    cwASIOError setClockSource(long ref) {
+        if (members.empty())
+            return ASE_NotPresent;
+        return master().drv->lpVtbl->setClockSource(master().drv, ref);
+    }
+
+    cwASIOError getSamplePosition(cwASIOSamples *sPos, cwASIOTimeStamp *tStamp) {
+        if (!sPos || !tStamp)
+            return ASE_InvalidParameter;
+        if (!running || switchTime.load() == 0)
+            return ASE_SPNotAdvancing;
+        cwASIO::setQWord(*tStamp, uint64_t(switchTime.load()));      // as in the time info of the last buffer switch
+        cwASIO::setQWord(*sPos, uint64_t(switchPosition.load()));
+        return ASE_OK;
+    }
+
+    cwASIOError getChannelInfo(struct cwASIOChannelInfo *info);
+    cwASIOError createBuffers(struct cwASIOBufferInfo *infos, long num, long size, struct cwASIOCallbacks const *cb);
+    cwASIOError disposeBuffers();
+
+    cwASIOError controlPanel() {
+        return ASE_NotPresent;
+    }
+
+    cwASIOError future(long sel, void *par) {
+        switch (sel) {
+        case kAsioCanTimeInfo:
+            return ASE_SUCCESS;
+        case kcwASIOsetInstanceName:
+            if (!par || *(char const *)par == '\0')
+                return ASE_SUCCESS;
+            if (auto inst = cwASIOgetInstance((char const *)par)) {
+                instance = inst;
+                return ASE_SUCCESS;
+            }
+            return ASE_NotPresent;
+        case kcwASIOsetUserCallbacks:
+            return cwASIOsetUserCallbacks(&host, par);
+        default:
+            return ASE_InvalidParameter;
+        }
+        return ASE_OK;
+    }
+
+    cwASIOError outputReady() {
+        return ASE_NotPresent;
+    }
+
+    // Called through the callbacks of the members.
+    void bufferSwitch(Member &m, long index, cwASIOTime *time);
+    long asioMessage(Member &m, long selector, long value, void *message, double *opt);
+    void sampleRateDidChange(Member &m, double rate);
+
+private:
+    struct Channel {
+        Member *member = nullptr;
+        long channel = 0;               // channel number within the member
+        bool active = false;
+        std::vector<float> buffers[2];
+    };
+
+    static struct cwASIODriverVtbl const vtbl;
+
+    static long long now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    Member &master() { return *members.front(); }
+
+    long extraLatency() const {         // latency added by the FIFOs of the non-master members
+        return members.size() > 1 ? target : 0;
+    }
+
+    bool loadMember(std::string const &name, void *sys);
+    void unloadMembers();
+    void resetFifo(Member &m);
+    void receive(Member &m, long index);
+    void transmit(Member &m, long index);
+    void steer(Member &m, long long time);
+    void resampleIn(Member &m, long index);
+    void resampleOut(Member &m, long index);
+
+    std::atomic_ulong references;   // threadsafe reference counter
+    cwASIOinstance const *instance = nullptr;   // registration info of this instance
+    std::string errorMessage;
+    std::vector<std::unique_ptr<Member>> members;
+    std::vector<Channel> inputs;
+    std::vector<Channel> outputs;
+    long bufferSize = 0;
+    long margin = 0;                // additional FIFO latency from the configuration
+    long target = 0;                // target FIFO fill in samples
+    double sampleRate = 0.;
+    cwASIOhostCallbacks host = {};  // the host's callbacks while there are buffers
+    bool timeInfo = false;
+    bool running = false;
+    uint64_t position = 0;          // sample position of the aggregate
+    std::atomic<long long> switchPosition = 0;  // aggregate sample position of the last buffer switch
+    std::atomic<long long> switchTime = 0;      // and its system time, 0 before the first one
+    cwASIO::ClockEstimator clock;   // timing of the master's buffer switches
+};
+
+
+/* The members call back with their member as the context, see cwASIOcreateBuffers(). */
+namespace {
+    void memberBufferSwitch(void *m, long index, cwASIOBool) {
+        static_cast<Member*>(m)->owner->bufferSwitch(*static_cast<Member*>(m), index, nullptr);
+    }
+
+    void memberSampleRateDidChange(void *m, double rate) {
+        static_cast<Member*>(m)->owner->sampleRateDidChange(*static_cast<Member*>(m), rate);
+    }
+
+    long memberAsioMessage(void *m, long selector, long value, void *message, double *opt) {
+        return static_cast<Member*>(m)->owner->asioMessage(*static_cast<Member*>(m), selector, value, message, opt);
+    }
+
+    cwASIOTime *memberBufferSwitchTimeInfo(void *m, cwASIOTime *params, long index, cwASIOBool) {
+        static_cast<Member*>(m)->owner->bufferSwitch(*static_cast<Member*>(m), index, params);
+        return params;
+    }
+
+    /** Read a numeric parameter from the registry, with a default. */
+    long getNumber(std::string const &name, char const *key, long dflt) {
+        char buf[32] = {};
+        if (cwASIOgetParameter(name.c_str(), key, buf, sizeof(buf) - 1) <= 0)
+            return dflt;
+        char *end;
+        long val = strtol(buf, &end, 10);
+        return end != buf ? val : dflt;
+    }
+
+    /** The system time and sample position of a buffer switch as reported by the member, false if it can't tell. */
+    bool reported(Member const &m, cwASIOTime const *time, long long &systemTime, uint64_t &position) {
+        if (time && (time->timeInfo.flags & (kSystemTimeValid | kSamplePositionValid)) == (kSystemTimeValid | kSamplePositionValid)) {
+            systemTime = (long long)cwASIO::qWord(time->timeInfo.systemTime);
+            position = cwASIO::qWord(time->timeInfo.samplePosition);
+            return true;
+        }
+        cwASIOSamples asp;
+        cwASIOTimeStamp ats;
+        if (m.drv->lpVtbl->getSamplePosition(m.drv, &asp, &ats) != ASE_OK)
+            return false;
+        systemTime = (long long)cwASIO::qWord(ats);
+        position = cwASIO::qWord(asp);
+        return true;
+    }
+
+    size_t roundUpPow2(size_t n) {
+        size_t p = 1;
+        while (p < n)
+            p *= 2;
+        return p;
+    }
+}
+
+
+cwASIOBool AggregateDriver::init(void *sys) {
+    if (!instance) {
+        errorMessage = "no instance name set";
+        return ASIOFalse;
+    }
+    stop();
+    disposeBuffers();
+    unloadMembers();
+    char list[2048] = {};
+    if (cwASIOgetParameter(instance->name, "members", list, sizeof(list) - 1) <= 0) {
+        errorMessage = "no members configured";
+        return ASIOFalse;
+    }
+    margin = std::max(0L, getNumber(instance->name, "latency", 0));
+    std::string names = list;
+    for (size_t pos = 0; pos <= names.size();) {
+        size_t end = std::min(names.find(',', pos), names.size());
+        std::string name = names.substr(pos, end - pos);
+        name.erase(0, name.find_first_not_of(" \t"));
+        name.erase(name.find_last_not_of(" \t") + 1);
+        if (!name.empty() && !loadMember(name, sys)) {
+            unloadMembers();
+            return ASIOFalse;
+        }
+        pos = end + 1;
+    }
+    if (members.empty()) {
+        errorMessage = "no members configured";
+        return ASIOFalse;
+    }
+    master().master = true;
+    errorMessage.clear();
+    return ASIOTrue;
+}
+
+bool AggregateDriver::loadMember(std::string const &name, void *sys) {
+#ifdef _WIN32
+    char const *idkey = "CLSID";
+#else
+    char const *idkey = "driver";
+#endif
+    char id[2048] = {};
+    if (cwASIOgetParameter(name.c_str(), idkey, id, sizeof(id) - 1) <= 0) {
+        errorMessage = "member not registered: " + name;
+        return false;
+    }
+    auto m = std::make_unique<Member>();
+    m->owner = this;
+    m->name = name;
+    if (cwASIOload(id, &m->drv) || !m->drv) {
+        errorMessage = "can't load member: " + name;
+        return false;
+    }
+    members.push_back(std::move(m));    // from now on, unloadMembers() takes care of it
+    Member &mem = *members.back();
+    auto vt = mem.drv->lpVtbl;
+    cwASIOError err = vt->future(mem.drv, kcwASIOsetInstanceName, const_cast<char*>(name.c_str()));
+    if (err != ASE_SUCCESS && err != ASE_InvalidParameter) {
+        errorMessage = "member instance not found: " + name;
+        return false;
+    }
+    if (!vt->init(mem.drv, sys)) {
+        char msg[124] = {};
+        vt->getErrorMessage(mem.drv, msg);
+        errorMessage = name + ": " + msg;
+        return false;
+    }
+    if (vt->getChannels(mem.drv, &mem.numInputs, &mem.numOutputs)) {
+        errorMessage = "can't get channels of member: " + name;
+        return false;
+    }
+    mem.firstInput = long(inputs.size());
+    mem.firstOutput = long(outputs.size());
+    for (long i = 0; i < mem.numInputs + mem.numOutputs; ++i) {
+        cwASIOChannelInfo info = {};
+        info.isInput = i < mem.numInputs ? ASIOTrue : ASIOFalse;
+        info.channel = info.isInput ? i : i - mem.numInputs;
+        if (vt->getChannelInfo(mem.drv, &info) || cwASIO::sampleSize(info.type) == 0) {
+            errorMessage = "unsupported sample type in member: " + name;
+            return false;
+        }
+        (info.isInput ? mem.inputTypes : mem.outputTypes).push_back(info.type);
+        (info.isInput ? inputs : outputs).push_back(Channel{ .member = &mem, .channel = info.channel });
+    }
+    return true;
+}
+
+void AggregateDriver::unloadMembers() {
+    for (auto &m : members)
+        if (m->drv)
+            cwASIOunload(m->drv);
+    members.clear();
+    inputs.clear();
+    outputs.clear();
+}
+
+cwASIOError AggregateDriver::getChannelInfo(struct cwASIOChannelInfo *info) {
+    if (!info)
+        return ASE_InvalidParameter;
+    auto &channels = info->isInput ? inputs : outputs;
+    if (info->channel < 0 || info->channel >= long(channels.size()))
+        return ASE_InvalidParameter;
+    Channel &ch = channels[info->channel];
+    cwASIOChannelInfo mine = { .channel = ch.channel, .isInput = info->isInput };
+    if (auto err = ch.member->drv->lpVtbl->getChannelInfo(ch.member->drv, &mine))
+        return err;
+    info->isActive = ch.active ? ASIOTrue : ASIOFalse;
+    info->channelGroup = long(std::find_if(members.begin(), members.end(), [&](auto &m){ return m.get() == ch.member; }) - members.begin());
+    info->type = ASIOSTFloat32LSB;
+    snprintf(info->name, sizeof(info->name), "%s", (ch.member->name + ": " + mine.name).c_str());
+    return ASE_OK;
+}
+
+cwASIOError AggregateDriver::createBuffers(struct cwASIOBufferInfo *infos, long num, long size, struct cwASIOCallbacks const *cb) {
+    if (!infos || !cb || num <= 0)
+        return ASE_InvalidParameter;
+    if (members.empty())
+        return ASE_NotPresent;
+    if (host.callbacks)
+        return ASE_InvalidMode;
+    for (long i = 0; i < num; ++i) {
+        auto &channels = infos[i].isInput ? inputs : outputs;
+        if (infos[i].channelNum < 0 || infos[i].channelNum >= long(channels.size()))
+            return ASE_InvalidParameter;
+    }
+    if (auto err = master().drv->lpVtbl->getSampleRate(master().drv, &sampleRate))
+        return err;
+    long maxMember = size;
+    for (auto &m : members) {
+        long min, max, pref, gran;
+        if (auto err = m->drv->lpVtbl->getBufferSize(m->drv, &min, &max, &pref, &gran))
+            return err;
+        m->bufferSize = m->master ? size : pref;
+        maxMember = std::max(maxMember, m->bufferSize);
+        m->buffers.clear();
+        m->channelMap.clear();
+    }
+    // one member period and one master period, plus the configured margin
+    target = maxMember + size + margin;
+    for (long i = 0; i < num; ++i) {
+        Channel &ch = (infos[i].isInput ? inputs : outputs)[infos[i].channelNum];
+        ch.active = true;
+        ch.buffers[0].assign(size, 0.f);
+        ch.buffers[1].assign(size, 0.f);
+        infos[i].buffers[0] = ch.buffers[0].data();
+        infos[i].buffers[1] = ch.buffers[1].data();
+        ch.member->buffers.push_back(cwASIOBufferInfo{ .isInput = infos[i].isInput, .channelNum = ch.channel });
+        ch.member->channelMap.push_back(infos[i].channelNum);
+    }
+    // the master drives the aggregate's callbacks, so it needs buffers even when none of its channels are used
+    if (Member &m = master(); m.buffers.empty()) {
+        if (m.numOutputs == 0 && m.numInputs == 0)
+            return ASE_NotPresent;
+        m.buffers.push_back(cwASIOBufferInfo{ .isInput = m.numOutputs == 0, .channelNum = 0 });
+        m.channelMap.push_back(-1);
+    }
+    cwASIOError err = ASE_OK;
+    for (auto &m : members) {
+        if (m->buffers.empty() && !m->master)
+            continue;           // nothing to do for this member
+        m->inWidth = std::count_if(m->buffers.begin(), m->buffers.end(), [](auto &b){ return b.isInput; });
+        m->outWidth = m->buffers.size() - m->inWidth;
+        if (!m->master) {
+            m->fifoFrames = roundUpPow2(4 * target);
+            m->inFifo.assign(m->fifoFrames * m->inWidth, 0.f);
+            m->outFifo.assign(m->fifoFrames * m->outWidth, 0.f);
+            m->lastOut.assign(m->outWidth, 0.f);
+            m->stage.assign(m->bufferSize, 0.f);
+        }
+        cwASIOUserCallbacks const memberCallbacks = {
+            m.get(), &memberBufferSwitch, &memberSampleRateDidChange, &memberAsioMessage, &memberBufferSwitchTimeInfo
+        };
+        err = cwASIOcreateBuffers(m->drv, m->buffers.data(), long(m->buffers.size()), m->bufferSize, &memberCallbacks);
+        if (err)
+            break;
+        m->created = true;
+        if (m->master && m->channelMap.front() < 0 && !m->buffers.front().isInput) {
+            size_t bytes = cwASIO::sampleSize(m->outputTypes[0]) * size_t(size);
+            memset(m->buffers.front().buffers[0], 0, bytes);   // the dummy output stays silent
+            memset(m->buffers.front().buffers[1], 0, bytes);
+        }
+    }
+    bufferSize = size;
+    host.callbacks = cb;
+    if (err) {
+        disposeBuffers();
+        return err;
+    }
+    timeInfo = cwASIOasioMessage(&host, kAsioSelectorSupported, kAsioSupportsTimeInfo, nullptr, nullptr) == 1
+        && cwASIOasioMessage(&host, kAsioSupportsTimeInfo, 0, nullptr, nullptr) == 1;
+    return ASE_OK;
+}
+
+cwASIOError AggregateDriver::disposeBuffers() {
+    if (!host.callbacks)
+        return ASE_InvalidMode;
+    stop();
+    for (auto &m : members) {
+        if (!m->created)
+            continue;
+        cwASIOdisposeBuffers(m->drv);
+        m->created = false;
+    }
+    for (auto &ch : inputs)
+        ch = Channel{ .member = ch.member, .channel = ch.channel };
+    for (auto &ch : outputs)
+        ch = Channel{ .member = ch.member, .channel = ch.channel };
+    cwASIOresetCallbacks(&host);
+    bufferSize = 0;
+    return ASE_OK;
+}
+
+cwASIOError AggregateDriver::start() {
+    if (!host.callbacks)
+        return ASE_InvalidMode;
+    if (running)
+        return ASE_OK;
+    position = 0;
+    switchTime = 0;
+    clock.reset(sampleRate);
+    for (auto &m : members) {
+        if (m->master || !m->created)
+            continue;
+        m->clock.reset(sampleRate);
+        m->position = 0;
+        m->anchored = false;
+        m->integral = 0.;
+        m->ratio = 1.;
+        resetFifo(*m);
+    }
+    // start the other members before the master, so their FIFOs fill up
+    for (auto it = members.rbegin(); it != members.rend(); ++it) {
+        if (!(*it)->created)
+            continue;
+        if (auto err = (*it)->drv->lpVtbl->start((*it)->drv)) {
+            while (it != members.rbegin()) {    // stop the ones started so far
+                --it;
+                if ((*it)->created)
+                    (*it)->drv->lpVtbl->stop((*it)->drv);
+            }
+            return err;
+        }
+    }
+    running = true;
+    return ASE_OK;
+}
+
+cwASIOError AggregateDriver::stop() {
+    if (!running)
+        return ASE_OK;
+    cwASIOError result = ASE_OK;
+    for (auto &m : members)
+        if (m->created)
+            if (auto err = m->drv->lpVtbl->stop(m->drv))
+                result = err;
+    running = false;
+    return result;
+}
+
+long AggregateDriver::asioMessage(Member &m, long selector, long value, void *message, double *opt) {
+    switch (selector) {
+    case kAsioSelectorSupported:
+        return value == kAsioEngineVersion || value == kAsioSupportsTimeInfo || value == kAsioResetRequest
+            || value == kAsioResyncRequest || value == kAsioLatenciesChanged || value == kAsioOverload;
+    case kAsioEngineVersion:
+        return 2;
+    case kAsioSupportsTimeInfo:
+        return 1;
+    case kAsioResyncRequest:
+        if (!m.master) {        // the member lost samples, start over with its FIFO
+            m.resync.store(true);
+            return 1;
+        }
+        [[fallthrough]];
+    case kAsioResetRequest:
+    case kAsioLatenciesChanged:
+    case kAsioOverload:
+        return cwASIOasioMessage(&host, selector, value, message, opt);
+    default:
+        return 0;
+    }
+}
+
+/* The master's rate is the aggregate's, the others only change their resampling ratio. */
+void AggregateDriver::sampleRateDidChange(Member &m, double rate) {
+    if (m.master) {
+        sampleRate = rate;
+        for (auto &mem : members)
+            if (!mem->master)
+                mem->resync.store(true);        // the ratios start over from the new rate
+        cwASIOsampleRateDidChange(&host, rate);
+    } else {
+        m.resync.store(true);                   // start over with the member's FIFOs
+    }
+}
+
+/* Reset the FIFOs of a member to the target fill. Called on the master's callback, or before starting. */
+void AggregateDriver::resetFifo(Member &m) {
+    uint64_t written = m.inWritten.load(std::memory_order_acquire);
+    uint64_t read = written > uint64_t(target) ? written - target : 0;
+    m.inRead.store(read, std::memory_order_release);
+    m.inPhase = 0.;
+    uint64_t out = m.outRead.load(std::memory_order_acquire);
+    uint64_t stale = std::min<uint64_t>(m.outWritten.load(std::memory_order_relaxed) - out, m.fifoFrames);
+    if (stale < uint64_t(target))
+        stale = target;
+    size_t mask = m.fifoFrames - 1;
+    for (uint64_t k = 0; k < stale; ++k)    // don't replay old audio, whether it's ahead or behind the new fill
+        std::fill_n(m.outFifo.begin() + ((out + k) & mask) * m.outWidth, m.outWidth, 0.f);
+    m.outWritten.store(out + target, std::memory_order_release);
+    m.outPhase = 0.;
+    m.integral = 0.;
+    m.resync.store(false);
+}
+
+void AggregateDriver::bufferSwitch(Member &m, long index, cwASIOTime *time) {
+    long long t = now();
+    uint64_t pos;
+    bool known = reported(m, time, t, pos);
+    if (!m.master) {
+        if (known) {
+            if (!m.anchored || pos + m.offset < m.position) {  // first period, or the member started over
+                m.offset = m.position - pos;
+                m.anchored = true;
+            }
+            m.position = pos + m.offset;
+        }
+        m.clock.update(std::chrono::nanoseconds(t), m.position);
+        receive(m, index);
+        transmit(m, index);
+        m.position += m.bufferSize;
+        return;
+    }
+    clock.update(std::chrono::nanoseconds(t), position);
+    // gather the inputs
+    for (size_t i = 0; i < m.buffers.size(); ++i) {
+        if (!m.buffers[i].isInput || m.channelMap[i] < 0)
+            continue;
+        Channel &ch = inputs[m.channelMap[i]];
+        cwASIO::toFloat(m.inputTypes[ch.channel], m.buffers[i].buffers[index], ch.buffers[index].data(), bufferSize);
+    }
+    for (auto &mem : members) {
+        if (mem->master || !mem->created)
+            continue;
+        steer(*mem, t);
+        resampleIn(*mem, index);
+    }
+    // let the host do its processing
+    long long stamp = time && (time->timeInfo.flags & kSystemTimeValid) ? (long long)cwASIO::qWord(time->timeInfo.systemTime) : t;
+    switchPosition = (long long)position;
+    switchTime = stamp;
+    if (timeInfo) {
+        cwASIOTime params = {};
+        if (time)
+            params = *time;
+        else
+            params.timeInfo.flags = kSystemTimeValid | kSamplePositionValid | kSampleRateValid;
+        cwASIO::setQWord(params.timeInfo.systemTime, uint64_t(stamp));
+        cwASIO::setQWord(params.timeInfo.samplePosition, position);
+        params.timeInfo.sampleRate = sampleRate;
+        params.timeInfo.flags |= kSystemTimeValid | kSamplePositionValid | kSampleRateValid;
+        cwASIObufferSwitchTimeInfo(&host, &params, index, ASIOTrue);
+    } else {
+        cwASIObufferSwitch(&host, index, ASIOTrue);
+    }
+    // distribute the outputs
+    for (size_t i = 0; i < m.buffers.size(); ++i) {
+        if (m.buffers[i].isInput || m.channelMap[i] < 0)
+            continue;
+        Channel &ch = outputs[m.channelMap[i]];
+        cwASIO::fromFloat(m.outputTypes[ch.channel], ch.buffers[index].data(), m.buffers[i].buffers[index], bufferSize);
+    }
+    for (auto &mem : members)
+        if (!mem->master && mem->created)
+            resampleOut(*mem, index);
+    position += bufferSize;
+}
+
+/* Member callback: push the member's inputs into its input FIFO. */
+void AggregateDriver::receive(Member &m, long index) {
+    if (m.inWidth == 0) {
+        m.inWritten.fetch_add(m.bufferSize, std::memory_order_release);
+        return;
+    }
+    uint64_t w = m.inWritten.load(std::memory_order_relaxed);
+    if (w + m.bufferSize - m.inRead.load(std::memory_order_acquire) > m.fifoFrames)
+        return;                         // overflow, the master will notice and reset
+    size_t mask = m.fifoFrames - 1;
+    size_t c = 0;
+    for (size_t i = 0; i < m.buffers.size(); ++i) {
+        if (!m.buffers[i].isInput)
+            continue;
+        Channel &ch = inputs[m.channelMap[i]];
+        cwASIO::toFloat(m.inputTypes[ch.channel], m.buffers[i].buffers[index], m.stage.data(), m.bufferSize);
+        for (long k = 0; k < m.bufferSize; ++k)
+            m.inFifo[((w + k) & mask) * m.inWidth + c] = m.stage[k];
+        ++c;
+    }
+    m.inWritten.store(w + m.bufferSize, std::memory_order_release);
+}
+
+/* Member callback: pop the member's outputs from its output FIFO. */
+void AggregateDriver::transmit(Member &m, long index) {
+    uint64_t r = m.outRead.load(std::memory_order_relaxed);
+    uint64_t avail = m.outWritten.load(std::memory_order_acquire) - r;
+    long n = long(std::min<uint64_t>(avail, m.bufferSize));
+    size_t mask = m.fifoFrames - 1;
+    size_t c = 0;
+    for (size_t i = 0; i < m.buffers.size(); ++i) {
+        if (m.buffers[i].isInput)
+            continue;
+        Channel &ch = outputs[m.channelMap[i]];
+        for (long k = 0; k < n; ++k)
+            m.stage[k] = m.outFifo[((r + k) & mask) * m.outWidth + c];
+        std::fill(m.stage.begin() + n, m.stage.end(), 0.f);     // underrun
+        cwASIO::fromFloat(m.outputTypes[ch.channel], m.stage.data(), m.buffers[i].buffers[index], m.bufferSize);
+        ++c;
+    }
+    m.outRead.store(r + n, std::memory_order_release);     // never past what was written
+    if (n < m.bufferSize)
+        m.resync.store(true);           // the master restores the target fill
+}
+
+/* Master callback: adjust the resampling ratio of a member from its FIFO fill. */
+void AggregateDriver::steer(Member &m, long long time) {
+    // estimated number of frames written to the FIFO at this time, interpolated from the member's sample position
+    uint64_t written = m.inWritten.load(std::memory_order_acquire);
+    double produced = double(written);
+    if (m.clock.valid())
+        produced = m.clock.positionAt(std::chrono::duration<double, std::nano>(double(time))) + m.bufferSize;
+    double fill = produced - (double(m.inRead.load(std::memory_order_relaxed)) + m.inPhase);
+    if (m.resync.load(std::memory_order_relaxed) || fill < bufferSize * m.ratio || fill > 2. * target + bufferSize) {
+        resetFifo(m);                   // lost, or out of bounds
+        return;
+    }
+    double nominal = 1.;
+    if (m.clock.valid() && clock.valid())
+        nominal = m.clock.sampleRate() / clock.sampleRate();
+    // PI controller, settling in the order of a second
+    double err = (fill - target) / sampleRate;
+    double periods = sampleRate / bufferSize;
+    m.integral = std::clamp(m.integral + err / periods, -1e-3, 1e-3);
+    m.ratio = nominal * (1. + std::clamp(0.5 * err + 0.1 * m.integral, -1e-3, 1e-3));
+}
+
+/* Master callback: read one master period from a member's input FIFO, with linear interpolation. */
+void AggregateDriver::resampleIn(Member &m, long index) {
+    uint64_t r = m.inRead.load(std::memory_order_relaxed);
+    uint64_t avail = m.inWritten.load(std::memory_order_acquire) - r;
+    size_t mask = m.fifoFrames - 1;
+    double phase = m.inPhase;
+    double needed = phase + (bufferSize - 1) * m.ratio + 2.;
+    bool underrun = double(avail) < needed;
+    size_t c = 0;
+    for (size_t i = 0; i < m.buffers.size(); ++i) {
+        if (!m.buffers[i].isInput)
+            continue;
+        float *dst = inputs[m.channelMap[i]].buffers[index].data();
+        if (underrun) {
+            std::fill(dst, dst + bufferSize, 0.f);
+        } else {
+            double p = phase;
+            for (long k = 0; k < bufferSize; ++k, p += m.ratio) {
+                size_t n = size_t(p);
+                float frac = float(p - double(n));
+                float a = m.inFifo[((r + n) & mask) * m.inWidth + c];
+                float b = m.inFifo[((r + n + 1) & mask) * m.inWidth + c];
+                dst[k] = a + frac * (b - a);
+            }
+        }
+        ++c;
+    }
+    if (underrun) {
+        m.resync.store(true);           // reset on the next period
+        return;
+    }
+    phase += bufferSize * m.ratio;
+    uint64_t whole = uint64_t(phase);
+    m.inPhase = phase - double(whole);
+    m.inRead.store(r + whole, std::memory_order_release);
+}
+
+/* Master callback: convert one master period of outputs to the member's rate and push it into its output FIFO. */
+void AggregateDriver::resampleOut(Member &m, long index) {
+    if (m.outWidth == 0)
+        return;
+    uint64_t w = m.outWritten.load(std::memory_order_relaxed);
+    size_t space = m.fifoFrames - size_t(w - m.outRead.load(std::memory_order_acquire));
+    size_t mask = m.fifoFrames - 1;
+    double step = 1. / m.ratio;
+    size_t produced = 0;
+    double p = m.outPhase;
+    // sample at master position p is interpolated between frames p-1 and p, where frame -1 is the last of the previous period
+    for (; p < bufferSize && produced < space; p += step, ++produced) {
+        long n = long(p);
+        float frac = float(p - double(n));
+        size_t c = 0;
+        for (size_t i = 0; i < m.buffers.size(); ++i) {
+            if (m.buffers[i].isInput)
+                continue;
+            float const *src = outputs[m.channelMap[i]].buffers[index].data();
+            float a = n > 0 ? src[n - 1] : m.lastOut[c];
+            m.outFifo[((w + produced) & mask) * m.outWidth + c] = a + frac * (src[n] - a);
+            ++c;
+        }
+    }
+    m.outPhase = std::max(0., p - bufferSize);
+    size_t c = 0;
+    for (size_t i = 0; i < m.buffers.size(); ++i)
+        if (!m.buffers[i].isInput)
+            m.lastOut[c++] = outputs[m.channelMap[i]].buffers[index][bufferSize - 1];
+    m.outWritten.store(w + produced, std::memory_order_release);
+}
+
+struct cwASIODriverVtbl const AggregateDriver::vtbl = {
+    [](cwASIODriver *drv, cwASIOGUID const *guid, void **ptr){ return static_cast<AggregateDriver*>(drv)->queryInterface(guid, ptr); },
+    [](cwASIODriver *drv){ return static_cast<AggregateDriver*>(drv)->addRef(); },
+    [](cwASIODriver *drv){ return static_cast<AggregateDriver*>(drv)->release(); },
+    [](cwASIODriver *drv, void *sys){ return static_cast<AggregateDriver*>(drv)->init(sys); },
+    [](cwASIODriver *drv, char *buf){ static_cast<AggregateDriver*>(drv)->getDriverName(buf); },
+    [](cwASIODriver *drv){ return static_cast<AggregateDriver*>(drv)->getDriverVersion(); },
+    [](cwASIODriver *drv, char *buf){ return static_cast<AggregateDriver*>(drv)->getErrorMessage(buf); },
+    [](cwASIODriver *drv){ return static_cast<AggregateDriver*>(drv)->start(); },
+    [](cwASIODriver *drv){ return static_cast<AggregateDriver*>(drv)->stop(); },
+    [](cwASIODriver *drv, long *in, long *out){ return static_cast<AggregateDriver*>(drv)->getChannels(in, out); },
+    [](cwASIODriver *drv, long *in, long *out){ return static_cast<AggregateDriver*>(drv)->getLatencies(in, out); },
+    [](cwASIODriver *drv, long *min, long *max, long *pref, long *gran){ return static_cast<AggregateDriver*>(drv)->getBufferSize(min, max, pref, gran); },
+    [](cwASIODriver *drv, double srate){ return static_cast<AggregateDriver*>(drv)->canSampleRate(srate); },
+    [](cwASIODriver *drv, double *srate){ return static_cast<AggregateDriver*>(drv)->getSampleRate(srate); },
+    [](cwASIODriver *drv, double srate){ return static_cast<AggregateDriver*>(drv)->setSampleRate(srate); },
+    [](cwASIODriver *drv, cwASIOClockSource *clocks, long *num){ return static_cast<AggregateDriver*>(drv)->getClockSources(clocks, num); },
+    [](cwASIODriver *drv, long ref){ return static_cast<AggregateDriver*>(drv)->setClockSource(ref); },
+    [](cwASIODriver *drv, cwASIOSamples *sPos, cwASIOTimeStamp *tStamp){ return static_cast<AggregateDriver*>(drv)->getSamplePosition(sPos, tStamp); },
+    [](cwASIODriver *drv, cwASIOChannelInfo *info){ return static_cast<AggregateDriver*>(drv)->getChannelInfo(info); },
+    [](cwASIODriver *drv, cwASIOBufferInfo *infos, long num, long size, cwASIOCallbacks const *cb){ return static_cast<AggregateDriver*>(drv)->createBuffers(infos, num, size, cb); },
+    [](cwASIODriver *drv){ return static_cast<AggregateDriver*>(drv)->disposeBuffers(); },
+    [](cwASIODriver *drv){ return static_cast<AggregateDriver*>(drv)->controlPanel(); },
+    [](cwASIODriver *drv, long sel, void *par){ return static_cast<AggregateDriver*>(drv)->future(sel, par); },
+    [](cwASIODriver *drv){ return static_cast<AggregateDriver*>(drv)->outputReady(); }
+};
+
+cwASIODriver *makeAsioDriver() {
+    try {
+        return new AggregateDriver();
+    } catch(std::exception &ex) {
+        return nullptr;
+    }
+}
+
+/** @}*/
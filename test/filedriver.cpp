@@ -0,0 +1,759 @@
+/** @file       filedriver.cpp
+ *  @brief      cwASIO driver playing from and recording to WAV files
+ *  @author     Stefan Heinzmann
+ *  @version    1.0
+ *  @date       2023-2025
+ *  @copyright  See file LICENSE in toplevel directory
+ * @addtogroup cwASIO_test
+ *  @{
+ *
+ * This driver needs no audio hardware. Its input channels are read from a WAV
+ * or RF64 file, and its output channels are written to another one. It can run
+ * at the pace of the wall clock, like a real device, or in freewheel mode, where
+ * the next `bufferSwitch` is issued as soon as the host returns from the
+ * previous one. The latter is useful for offline rendering and for
+ * deterministic host benchmarks.
+ *
+ * The driver is configured through the registry, i.e. the files in
+ * `/etc/cwASIO/<name>` on Linux. The following keys are recognized:
+ *
+ * - `input`: Path of the WAV file providing the input channels (optional).
+ * - `loop`: `1` to restart the input file at its end instead of delivering
+ *   silence.
+ * - `output`: Path of the WAV file receiving the output channels (optional).
+ * - `outputChannels`: Number of output channels (default 2 if `output` is set).
+ * - `outputBits`: Sample size of the output file, 16, 24 or 32 (default 32).
+ * - `sampleRate`: Sample rate when there's no input file (default 48000).
+ * - `bufferSize`: Preferred buffer size in samples (default 256).
+ * - `freewheel`: `1` to start in freewheel mode rather than in realtime.
+ * - `priority`: SCHED_FIFO priority of the realtime thread (default 0).
+ * - `loopback`: When there's no input file, feed the output channels back to
+ *   the input channels, delayed by the given number of samples in addition to
+ *   the two periods of a real device. This simulates a loopback cable for
+ *   latency measurements, the round trip equals the sum of the latencies
+ *   reported by `getLatencies()`.
+ *
+ * Freewheel mode can also be switched on and off by the host at any time with
+ * the `kcwASIOsetFreewheel` selector of `future()`.
+ *
+ * In realtime mode, the periods are driven by the shared scheduler of the
+ * driver framework (see `cwASIOschedule()`), so that many instances of this
+ * driver don't need a thread each. In freewheel mode, and in either mode on
+ * Windows where there's no shared scheduler, each instance runs its own thread.
+ */
+
+extern "C" {
+    #include "cwASIOdriver.h"
+}
+#include "cwASIO.hpp"
+#include "cwASIOmeter.hpp"
+#include "wavefile/wavefile.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+std::atomic_uint activeInstances = 0;
+
+/** Read a numeric parameter from the registry, with a default. */
+static long getNumber(std::string const &name, char const *key, long dflt) {
+    char buf[32] = {};
+    if (cwASIOgetParameter(name.c_str(), key, buf, sizeof(buf) - 1) <= 0)
+        return dflt;
+    char *end;
+    long val = strtol(buf, &end, 10);
+    return end != buf ? val : dflt;
+}
+
+/** Read a string parameter from the registry, empty if absent. */
+static std::string getString(std::string const &name, char const *key) {
+    char buf[2048] = {};
+    if (cwASIOgetParameter(name.c_str(), key, buf, sizeof(buf) - 1) <= 0)
+        return {};
+    return buf;
+}
+
+static cwASIOSampleType sampleTypeOf(unsigned long bitsPerSample) {
+    switch (bitsPerSample) {
+    case 16: return ASIOSTInt16LSB;
+    case 24: return ASIOSTInt24LSB;
+    case 32: return ASIOSTInt32LSB;
+    default: return ASIOSTLastEntry;
+    }
+}
+
+/** The file driver implemented as a C++ class. */
+class FileDriver : public cwASIODriver {
+    FileDriver(FileDriver &&) =delete;  // no move/copy
+
+    struct Channel {
+        bool active = false;
+        std::byte *buffers[2] = {};
+    };
+
+    enum Command {      // selectors of the commands sent to the period thread
+        cmdStop = 1,
+        cmdSetSampleRate
+    };
+
+#ifdef _WIN32
+    struct Client {};                   // there's no shared scheduler, see paced()
+#else
+    struct Client : cwASIOperiodic {    // our registration with the shared scheduler
+        FileDriver *driver;
+    };
+#endif
+
+public:
+    FileDriver()
+        : cwASIODriver{ &vtbl }
+        , references{1}
+    {
+        cwASIOinitQueue(&commands);
+#ifndef _WIN32
+        client.expired = [](cwASIOperiodic *p, unsigned long long missed){ static_cast<Client*>(p)->driver->expired(missed); };
+        client.driver = this;
+#endif
+        activeInstances.fetch_add(1);
+    }
+
+    ~FileDriver() {
+        stop();
+        disposeBuffers();
+    }
+
+    long queryInterface(cwASIOGUID const *guid, void **ptr) {
+        if(guid) {
+            instance = cwASIOfindInstance(guid);
+            if(!instance)
+                return E_NOINTERFACE;   // GUID not found in registry
+        }
+        // It's our GUID
+        *ptr = this;
+        addRef();
+        return 0;       // success
+    }
+
+    unsigned long addRef() {
+        return references.fetch_add(1) + 1;
+    }
+
+    unsigned long release() {
+        unsigned long res = references.fetch_sub(1) - 1;
+        if (res == 0) {
+            delete this;
+            atomic_fetch_sub(&activeInstances, 1);
+        }
+        return res;
+    }
+
+    cwASIOBool init(void *sys) {
+        if(!instance) {
+            errorMessage = "no instance name set";
+            return ASIOFalse;
+        }
+        std::string name = instance->name;
+        inputPath = getString(name, "input");
+        outputPath = getString(name, "output");
+        loop = getNumber(name, "loop", 0) != 0;
+        freewheel = getNumber(name, "freewheel", 0) != 0;
+        preferredSize = instance->bufferSize ? instance->bufferSize : 256;
+        sampleRate = double(getNumber(name, "sampleRate", 48000));
+        loopback = inputPath.empty() ? getNumber(name, "loopback", -1) : -1;
+        numInputs = 0;
+        numOutputs = outputPath.empty() && loopback < 0 ? 0 : instance->outputChannels ? instance->outputChannels : 2;
+        outputBits = getNumber(name, "outputBits", 32);
+        if (preferredSize < minSize || preferredSize > maxSize) {
+            errorMessage = "buffer size out of range";
+            return ASIOFalse;
+        }
+        if (sampleTypeOf(outputBits) == ASIOSTLastEntry) {
+            errorMessage = "unsupported output sample size";
+            return ASIOFalse;
+        }
+        inputFile.close();
+        if (!inputPath.empty()) {
+            std::string res = inputFile.openMapped(inputPath);
+            if (!res.empty()) {
+                errorMessage = res;
+                return ASIOFalse;
+            }
+            if (inputFile.getSampleType() == ASIOSTLastEntry) {
+                errorMessage = "unsupported input sample size";
+                return ASIOFalse;
+            }
+            numInputs = long(inputFile.getChannels());
+            sampleRate = double(inputFile.getSamplerate());
+        } else if (loopback >= 0) {
+            numInputs = numOutputs;
+        }
+        inputs.assign(numInputs, Channel{});
+        inputPointers.assign(numInputs, nullptr);
+        outputs.assign(numOutputs, Channel{});
+        inputMeter = std::make_unique<cwASIO::Meter>(numInputs, cwASIO::Meter::Options{ .truePeak = false });
+        outputMeter = std::make_unique<cwASIO::Meter>(numOutputs, cwASIO::Meter::Options{ .truePeak = false });
+        errorMessage.clear();
+        return ASIOTrue;
+    }
+
+    void getDriverName(char *buf) {
+        if (buf && instance)
+            strcpy(buf, instance->name);
+    }
+
+    long getDriverVersion() {
+        return 1;
+    }
+
+    void getErrorMessage(char *buf) {
+        if (writeFailed.load(std::memory_order_acquire))
+            errorMessage = "failed to write " + outputPath;
+        if (buf) {
+            strncpy(buf, errorMessage.c_str(), 123);
+            buf[123] = '\0';
+        }
+    }
+
+    cwASIOError start() {
+        if (!host.callbacks)
+            return ASE_InvalidMode;
+        if (running)
+            return ASE_OK;
+        if (!inputPath.empty() && !inputFile.setPosition(0, SEEK_SET))
+            return ASE_HWMalfunction;
+        index = 0;
+        position = 0;
+        rate = sampleRate;
+        lastSwitch = 0;
+        return startStreaming(freewheel);
+    }
+
+    cwASIOError stop() {
+        return running ? stopStreaming() : ASE_OK;
+    }
+
+    cwASIOError getChannels(long *in, long *out) {
+        if (!in || !out)
+            return ASE_InvalidParameter;
+        *in = numInputs;
+        *out = numOutputs;
+        return ASE_OK;
+    }
+
+    cwASIOError getLatencies(long *in, long *out) {
+        if (!in || !out)
+            return ASE_InvalidParameter;
+        *in = *out = bufferSize ? bufferSize : preferredSize;
+        if (loopback > 0)
+            *out += loopback;
+        return ASE_OK;
+    }
+
+    cwASIOError getBufferSize(long *min, long *max, long *pref, long *gran) {
+        if (!min || !max || !pref || !gran)
+            return ASE_InvalidParameter;
+        *min = minSize;
+        *max = maxSize;
+        *pref = preferredSize;
+        *gran = 1;
+        return ASE_OK;
+    }
+
+    cwASIOError canSampleRate(double srate) {
+        if (srate <= 0.)
+            return ASE_NoClock;
+        if (!inputPath.empty() && srate != double(inputFile.getSamplerate()))
+            return ASE_NoClock;     // no sample rate conversion
+        return ASE_OK;
+    }
+
+    cwASIOError getSampleRate(double *srate) {
+        if (!srate)
+            return ASE_InvalidParameter;
+        *srate = sampleRate;
+        return ASE_OK;
+    }
+
+    cwASIOError setSampleRate(double srate) {
+        if (auto err = canSampleRate(srate))
+            return err;
+        if (srate != sampleRate && host.callbacks && !outputPath.empty())
+            return ASE_InvalidMode;     // the output file was opened with the old rate in its header
+        if (running && srate != sampleRate) {
+            cwASIOcommand cmd{ .selector = cmdSetSampleRate, .number = srate };
+            if (auto err = cwASIOsendCommand(&commands, &cmd, -1))
+                return err;
+        }
+        sampleRate = srate;
+        return ASE_OK;
+    }
+
+    cwASIOError getClockSources(struct cwASIOClockSource *clocks, long *num) {
+        if (!clocks || !num || *num < 1)
+            return ASE_InvalidParameter;
+        clocks[0] = cwASIOClockSource{ .index = 0, .associatedChannel = -1, .associatedGroup = -1, .isCurrentSource = ASIOTrue, .name = "Internal" };
+        *num = 1;
+        return ASE_OK;
+    }
+
+    cwASIOError setClockSource(long ref) {
+        return ref == 0 ? ASE_OK : ASE_InvalidParameter;
+    }
+
+    cwASIOError getSamplePosition(cwASIOSamples *sPos, cwASIOTimeStamp *tStamp) {
+        if (!sPos || !tStamp)
+            return ASE_InvalidParameter;
+        if (!running)
+            return ASE_SPNotAdvancing;
+        cwASIO::setQWord(*tStamp, uint64_t(systemTime.load()));
+        cwASIO::setQWord(*sPos, uint64_t(samplePosition.load()));
+        return ASE_OK;
+    }
+
+    cwASIOError getChannelInfo(struct cwASIOChannelInfo *info) {
+        if (!info)
+            return ASE_InvalidParameter;
+        auto &channels = info->isInput ? inputs : outputs;
+        if (info->channel < 0 || info->channel >= long(channels.size()))
+            return ASE_InvalidParameter;
+        info->isActive = channels[info->channel].active ? ASIOTrue : ASIOFalse;
+        info->channelGroup = 0;
+        info->type = info->isInput ? inputType() : outputType();
+        snprintf(info->name, sizeof(info->name), "%s %ld", info->isInput ? "In" : "Out", info->channel + 1);
+        return ASE_OK;
+    }
+
+    cwASIOError createBuffers(struct cwASIOBufferInfo *infos, long num, long size, struct cwASIOCallbacks const *cb) {
+        if (!infos || !cb || num <= 0 || size < minSize || size > maxSize)
+            return ASE_InvalidParameter;
+        if (host.callbacks)
+            return ASE_InvalidMode;
+        for (long i = 0; i < num; ++i) {
+            auto &channels = infos[i].isInput ? inputs : outputs;
+            if (infos[i].channelNum < 0 || infos[i].channelNum >= long(channels.size()))
+                return ASE_InvalidParameter;
+        }
+        if (!outputPath.empty()) {
+            std::string res = outputFile.openAsync(outputPath, (unsigned long)sampleRate, outputBits, numOutputs);
+            if (!res.empty()) {
+                errorMessage = res;
+                return ASE_HWMalfunction;
+            }
+            writeFailed = false;
+        }
+        size_t inBytes = size * inputBytes();
+        size_t outBytes = size * outputBytes();
+        memory.assign(2 * (numInputs * inBytes + numOutputs * outBytes), std::byte{});
+        std::byte *p = memory.data();
+        for (auto &ch : inputs) {
+            ch.buffers[0] = p;
+            ch.buffers[1] = p + inBytes;
+            p += 2 * inBytes;
+        }
+        for (auto &ch : outputs) {
+            ch.buffers[0] = p;
+            ch.buffers[1] = p + outBytes;
+            p += 2 * outBytes;
+        }
+        for (long i = 0; i < num; ++i) {
+            auto &ch = (infos[i].isInput ? inputs : outputs)[infos[i].channelNum];
+            ch.active = true;
+            infos[i].buffers[0] = ch.buffers[0];
+            infos[i].buffers[1] = ch.buffers[1];
+        }
+        interleaved.assign(size * numOutputs * outputBytes(), std::byte{});
+        delayLine.assign(loopback >= 0 ? (2 * size + loopback) * numOutputs * outputBytes() : 0, std::byte{});
+        delayPosition = 0;
+        bufferSize = size;
+        host.callbacks = cb;
+        timeInfo = cwASIOasioMessage(&host, kAsioSelectorSupported, kAsioSupportsTimeInfo, nullptr, nullptr) == 1
+            && cwASIOasioMessage(&host, kAsioSupportsTimeInfo, 0, nullptr, nullptr) == 1;
+        return ASE_OK;
+    }
+
+    cwASIOError disposeBuffers() {
+        if (!host.callbacks)
+            return ASE_InvalidMode;
+        stop();
+        outputFile.close();
+        for (auto &ch : inputs)
+            ch = Channel{};
+        for (auto &ch : outputs)
+            ch = Channel{};
+        memory.clear();
+        interleaved.clear();
+        delayLine.clear();
+        bufferSize = 0;
+        cwASIOresetCallbacks(&host);
+        return ASE_OK;
+    }
+
+    cwASIOError controlPanel() {
+        return ASE_NotPresent;
+    }
+
+    cwASIOError future(long sel, void *par) {
+        switch (sel) {
+        case kAsioCanTimeInfo:
+            return ASE_SUCCESS;
+        case kAsioCanInputMeter:
+        case kAsioCanOutputMeter:
+            metering = true;
+            return ASE_SUCCESS;
+        case kAsioGetInputMeter:
+        case kAsioGetOutputMeter:
+            if (!inputMeter)
+                return ASE_NotPresent;
+            metering = true;        // the levels follow from the next period on
+            return (sel == kAsioGetInputMeter ? inputMeter : outputMeter)->get((cwASIOChannelControls *)par);
+        case kAsioGetInternalBufferSamples:
+            if (!par)
+                return ASE_InvalidParameter;
+            *(cwASIOInternalBufferInfo *)par = { 0, loopback > 0 ? loopback : 0 };
+            return ASE_SUCCESS;
+        case kcwASIOsetUserCallbacks:
+            return cwASIOsetUserCallbacks(&host, par);
+        case kcwASIOsetFreewheel:
+            if (!par)
+                return ASE_InvalidParameter;
+            if (bool on = *(cwASIOBool const *)par != ASIOFalse; on != freewheel) {
+                bool restart = running;
+                if (restart)        // switch between own thread and shared scheduler, keeping the position
+                    stopStreaming();
+                freewheel = on;
+                if (restart)
+                    if (auto err = startStreaming(on))
+                        return err;
+            }
+            return ASE_SUCCESS;
+        case kcwASIOsetInstanceName:
+            if (!par || *(char const *)par == '\0')
+                return ASE_SUCCESS;
+            if (auto inst = cwASIOgetInstance((char const *)par)) {
+                instance = inst;
+                return ASE_SUCCESS;
+            }
+            return ASE_NotPresent;
+        default:
+            return ASE_InvalidParameter;
+        }
+        return ASE_OK;
+    }
+
+    cwASIOError outputReady() {
+        return ASE_NotPresent;
+    }
+
+private:
+    static struct cwASIODriverVtbl const vtbl;
+    static constexpr long minSize = 16;
+    static constexpr long maxSize = 16384;
+
+    static long long now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    cwASIOSampleType inputType() const {
+        return loopback >= 0 ? outputType() : inputFile.getSampleType();
+    }
+
+    cwASIOSampleType outputType() const {
+        return sampleTypeOf(outputBits);
+    }
+
+    size_t inputBytes() const {
+        return loopback >= 0 ? outputBytes() : inputFile.getBytesPerSample();
+    }
+
+    size_t outputBytes() const {
+        return (outputBits + 7) / 8;
+    }
+
+    long long periodOf(double srate) const {
+        return (long long)(bufferSize / srate * 1e9);
+    }
+
+    /** Start the periods, either on our own thread in freewheel mode, or on the shared scheduler. */
+    cwASIOError startStreaming(bool fw) {
+        if (fw) {
+            worker = std::thread{ [this]{ while (step()) ; } };
+        } else {
+#ifdef _WIN32
+            worker = std::thread{ [this]{ paced(); } };
+#else
+            client.period = periodOf(rate);
+            client.priority = instance ? int(instance->priority) : 0;
+            if (int err = cwASIOschedule(&client, 0)) {
+                errorMessage = strerror(err);
+                return ASE_HWMalfunction;
+            }
+#endif
+        }
+        running = true;
+        return ASE_OK;
+    }
+
+    /** Stop the periods. When this returns, no more buffer switches happen. */
+    cwASIOError stopStreaming() {
+        cwASIOError err = ASE_OK;
+        if (worker.joinable()) {
+            cwASIOcommand cmd{ .selector = cmdStop };
+            err = cwASIOsendCommand(&commands, &cmd, -1);
+            worker.join();
+        } else {
+#ifndef _WIN32
+            cwASIOunschedule(&client);
+#endif
+            while (auto cmd = cwASIOfetchCommand(&commands))     // no period thread left to pick these up
+                cwASIOcompleteCommand(cmd, ASE_InvalidMode);
+        }
+        running = false;
+        return err;
+    }
+
+#ifdef _WIN32
+    /** Do the periods in realtime mode on our own thread, paced by the wall clock. */
+    void paced() {
+        auto period = [this]{ return std::chrono::nanoseconds(periodOf(rate)); };
+        auto next = std::chrono::steady_clock::now() + period();
+        for (;;) {
+            std::this_thread::sleep_until(next);
+            if (!step())
+                return;
+            next += period();
+            if (auto late = std::chrono::steady_clock::now() - next; late > period()) {
+                auto missed = late / period();
+                position += (long long)missed * bufferSize;     // the sample clock keeps running when we're late
+                next += missed * period();
+            }
+        }
+    }
+#else
+    /** Called by the shared scheduler once per period. */
+    void expired(unsigned long long missed) {
+        position += (long long)missed * bufferSize;     // the sample clock keeps running when we're late
+        step();
+        client.period = periodOf(rate);
+    }
+#endif
+
+    /** Do one period.
+     * Control calls that affect the running stream arrive through the command
+     * queue, and are applied at the period boundary.
+     * @return false if asked to stop.
+     */
+    bool step() {
+        unsigned long flags = 0;
+        while (auto cmd = cwASIOfetchCommand(&commands)) {
+            switch (cmd->selector) {
+            case cmdStop:
+                cwASIOcompleteCommand(cmd, ASE_OK);
+                return false;
+            case cmdSetSampleRate:
+                rate = cmd->number;
+                flags |= kSampleRateChanged;
+                cwASIOcompleteCommand(cmd, ASE_OK);
+                break;
+            default:
+                cwASIOcompleteCommand(cmd, ASE_InvalidParameter);
+                break;
+            }
+        }
+        processPeriod(index, position, rate, flags);
+        index = 1 - index;
+        position += bufferSize;
+        return true;
+    }
+
+    /** Process one period using the given half of the double buffers, starting at the given sample position. */
+    void processPeriod(long index, long long pos, double rate, unsigned long flags) {
+        readInputs(index);
+        if (metering)
+            measure(*inputMeter, inputs, inputType(), index);
+        long long time = now();
+        double speed = 1.;
+        if (freewheel && lastSwitch && time > lastSwitch)
+            speed = bufferSize / rate * 1e9 / double(time - lastSwitch);
+        lastSwitch = time;
+        systemTime = time;
+        samplePosition = pos;
+        if (timeInfo) {
+            cwASIOTime params = {};
+            params.timeInfo.speed = speed;
+            cwASIO::setQWord(params.timeInfo.systemTime, uint64_t(time));
+            cwASIO::setQWord(params.timeInfo.samplePosition, uint64_t(pos));
+            params.timeInfo.sampleRate = rate;
+            params.timeInfo.flags = flags | kSystemTimeValid | kSamplePositionValid | kSampleRateValid | kSpeedValid;
+            cwASIObufferSwitchTimeInfo(&host, &params, index, ASIOTrue);
+        } else {
+            cwASIObufferSwitch(&host, index, ASIOTrue);
+        }
+        if (metering)
+            measure(*outputMeter, outputs, outputType(), index);
+        writeOutputs(index);
+    }
+
+    /** Feed the active channels' buffers to a meter, once the host has asked for meters. */
+    void measure(cwASIO::Meter &meter, std::vector<Channel> const &channels, cwASIOSampleType type, long index) {
+        for (size_t c = 0; c < channels.size(); ++c) {
+            if (channels[c].active)
+                meter.process(c, type, channels[c].buffers[index], bufferSize);
+        }
+        meter.publish(bufferSize);
+    }
+
+    /** Fill the input buffers by deinterleaving straight from the memory mapped input file. */
+    void readInputs(long index) {
+        if (numInputs == 0)
+            return;
+        if (loopback >= 0) {
+            readDelayLine(index);
+            return;
+        }
+        cwASIOSampleType type = inputFile.getSampleType();
+        size_t bytes = inputFile.getBytesPerSample();
+        long done = 0;
+        while (done < bufferSize) {
+            for (long c = 0; c < numInputs; ++c)
+                inputPointers[c] = inputs[c].active ? inputs[c].buffers[index] + done * bytes : nullptr;
+            long n = long(inputFile.readAs(type, inputPointers.data(), bufferSize - done));
+            done += n;
+            if (n == 0 && (!loop || inputFile.getTotalSamples() == 0 || !inputFile.setPosition(0, SEEK_SET)))
+                break;
+        }
+        for (long c = 0; c < numInputs; ++c) {
+            if (inputs[c].active)
+                std::fill(inputs[c].buffers[index] + done * bytes, inputs[c].buffers[index] + bufferSize * bytes, std::byte{});
+        }
+    }
+
+    /** Interleave the output buffers and write them to the output file. */
+    void writeOutputs(long index) {
+        if (numOutputs == 0)
+            return;
+        if (loopback >= 0)
+            writeDelayLine(index);
+        if (outputPath.empty() || writeFailed.load(std::memory_order_relaxed))
+            return;
+        size_t bytes = outputFile.getBytesPerSample();
+        size_t frame = numOutputs * bytes;
+        for (long c = 0; c < numOutputs; ++c) {
+            std::byte const *src = outputs[c].buffers[index];
+            std::byte *dst = interleaved.data() + c * bytes;
+            for (long i = 0; i < bufferSize; ++i, src += bytes, dst += frame)
+                memcpy(dst, src, bytes);
+        }
+        // only flag the failure here, getErrorMessage() makes the message on the control thread
+        if (outputFile.hasFailed() || !outputFile.write(interleaved.data(), bufferSize).empty())
+            writeFailed.store(true, std::memory_order_release);
+    }
+
+    /** Fill the input buffers from the delay line, i.e. with the outputs of earlier periods. */
+    void readDelayLine(long index) {
+        size_t bytes = outputBytes();
+        size_t frames = delayLine.size() / (numOutputs * bytes);
+        for (long c = 0; c < numInputs; ++c) {
+            if (!inputs[c].active)
+                continue;
+            std::byte const *line = delayLine.data() + c * frames * bytes;
+            for (long i = 0; i < bufferSize; ++i)
+                memcpy(inputs[c].buffers[index] + i * bytes, line + ((delayPosition + i) % frames) * bytes, bytes);
+        }
+    }
+
+    /** Put the output buffers into the delay line, where they replace what has just been read. */
+    void writeDelayLine(long index) {
+        size_t bytes = outputBytes();
+        size_t frames = delayLine.size() / (numOutputs * bytes);
+        for (long c = 0; c < numOutputs; ++c) {
+            std::byte *line = delayLine.data() + c * frames * bytes;
+            for (long i = 0; i < bufferSize; ++i)
+                memcpy(line + ((delayPosition + i) % frames) * bytes, outputs[c].buffers[index] + i * bytes, bytes);
+        }
+        delayPosition = (delayPosition + bufferSize) % frames;
+    }
+
+    std::atomic_ulong references;   // threadsafe reference counter
+    cwASIOinstance const *instance = nullptr;   // registration info of this instance
+    std::string errorMessage;
+    std::atomic_bool writeFailed = false;   // the period thread couldn't write the output file
+    std::string inputPath;
+    std::string outputPath;
+    WaveFile inputFile;
+    WaveFile outputFile;
+    bool loop = false;
+    long loopback = -1;                     // additional loopback delay, or -1 if not looping back
+    bool freewheel = false;
+    long preferredSize = 256;
+    long bufferSize = 0;
+    double sampleRate = 48000.;
+    long numInputs = 0;
+    long numOutputs = 0;
+    unsigned long outputBits = 32;
+    std::vector<Channel> inputs;
+    std::vector<void *> inputPointers;      // where readAs() continues in each active input buffer
+    std::vector<Channel> outputs;
+    std::unique_ptr<cwASIO::Meter> inputMeter;  // peak levels for the meter selectors of future()
+    std::unique_ptr<cwASIO::Meter> outputMeter;
+    std::atomic_bool metering = false;      // a host has asked for meters
+    std::vector<std::byte> memory;          // the double buffers of all channels
+    std::vector<std::byte> interleaved;     // output file buffer for one period
+    std::vector<std::byte> delayLine;       // loopback mode: ring buffer per output channel
+    size_t delayPosition = 0;
+    cwASIOhostCallbacks host = {};          // the host's callbacks while there are buffers
+    bool timeInfo = false;
+    bool running = false;
+    std::thread worker;                     // the period thread in freewheel mode, or on Windows
+    Client client = {};                     // the period client in realtime mode
+    cwASIOcommandQueue commands;            // from the control thread to the period thread
+    long index = 0;                         // the following are owned by the period thread while running
+    long long position = 0;
+    double rate = 48000.;
+    std::atomic<long long> samplePosition = 0;
+    std::atomic<long long> systemTime = 0;
+    long long lastSwitch = 0;               // time of the previous buffer switch
+};
+
+struct cwASIODriverVtbl const FileDriver::vtbl = {
+    [](cwASIODriver *drv, cwASIOGUID const *guid, void **ptr){ return static_cast<FileDriver*>(drv)->queryInterface(guid, ptr); },
+    [](cwASIODriver *drv){ return static_cast<FileDriver*>(drv)->addRef(); },
+    [](cwASIODriver *drv){ return static_cast<FileDriver*>(drv)->release(); },
+    [](cwASIODriver *drv, void *sys){ return static_cast<FileDriver*>(drv)->init(sys); },
+    [](cwASIODriver *drv, char *buf){ static_cast<FileDriver*>(drv)->getDriverName(buf); },
+    [](cwASIODriver *drv){ return static_cast<FileDriver*>(drv)->getDriverVersion(); },
+    [](cwASIODriver *drv, char *buf){ return static_cast<FileDriver*>(drv)->getErrorMessage(buf); },
+    [](cwASIODriver *drv){ return static_cast<FileDriver*>(drv)->start(); },
+    [](cwASIODriver *drv){ return static_cast<FileDriver*>(drv)->stop(); },
+    [](cwASIODriver *drv, long *in, long *out){ return static_cast<FileDriver*>(drv)->getChannels(in, out); },
+    [](cwASIODriver *drv, long *in, long *out){ return static_cast<FileDriver*>(drv)->getLatencies(in, out); },
+    [](cwASIODriver *drv, long *min, long *max, long *pref, long *gran){ return static_cast<FileDriver*>(drv)->getBufferSize(min, max, pref, gran); },
+    [](cwASIODriver *drv, double srate){ return static_cast<FileDriver*>(drv)->canSampleRate(srate); },
+    [](cwASIODriver *drv, double *srate){ return static_cast<FileDriver*>(drv)->getSampleRate(srate); },
+    [](cwASIODriver *drv, double srate){ return static_cast<FileDriver*>(drv)->setSampleRate(srate); },
+    [](cwASIODriver *drv, cwASIOClockSource *clocks, long *num){ return static_cast<FileDriver*>(drv)->getClockSources(clocks, num); },
+    [](cwASIODriver *drv, long ref){ return static_cast<FileDriver*>(drv)->setClockSource(ref); },
+    [](cwASIODriver *drv, cwASIOSamples *sPos, cwASIOTimeStamp *tStamp){ return static_cast<FileDriver*>(drv)->getSamplePosition(sPos, tStamp); },
+    [](cwASIODriver *drv, cwASIOChannelInfo *info){ return static_cast<FileDriver*>(drv)->getChannelInfo(info); },
+    [](cwASIODriver *drv, cwASIOBufferInfo *infos, long num, long size, cwASIOCallbacks const *cb){ return static_cast<FileDriver*>(drv)->createBuffers(infos, num, size, cb); },
+    [](cwASIODriver *drv){ return static_cast<FileDriver*>(drv)->disposeBuffers(); },
+    [](cwASIODriver *drv){ return static_cast<FileDriver*>(drv)->controlPanel(); },
+    [](cwASIODriver *drv, long sel, void *par){ return static_cast<FileDriver*>(drv)->future(sel, par); },
+    [](cwASIODriver *drv){ return static_cast<FileDriver*>(drv)->outputReady(); }
+};
+
+cwASIODriver *makeAsioDriver() {
+    try {
+        return new FileDriver();
+    } catch(std::exception &ex) {
+        return nullptr;
+    }
+}
+
+/** @}*/
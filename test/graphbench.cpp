@@ -0,0 +1,110 @@
+/** @file       graphbench.cpp
+ *  @brief      cwASIO processing graph and thread pool benchmark
+ *  @author     Stefan Heinzmann
+ *  @version    1.0
+ *  @date       2023-2025
+ *  @copyright  See file LICENSE in toplevel directory
+ * @addtogroup cwASIO_test
+ *  @{
+ *
+ * Measures how long a `cwASIO::Schedule` takes for a period when its nodes run
+ * on the calling thread alone, and when they are spread over a
+ * `cwASIO::ThreadPool`. The graph has a number of independent filter nodes,
+ * each fed by one of the device inputs, which are summed by a mixer into the
+ * device output, so all filters are in the same level. The statistics of the
+ * pool's participants are printed after the parallel run. The number of nodes,
+ * the work per node, the number of periods and the number of workers can be
+ * given on the command line.
+ */
+
+#include "cwASIOgraph.hpp"
+#include "cwASIOpool.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+namespace {
+    constexpr double pi = 3.14159265358979323846;
+    constexpr unsigned channels = 2;
+    constexpr size_t block = 256;       // frames per period
+    constexpr double sampleRate = 48000.;
+
+    /** A node with a configurable amount of work: a cascade of one pole lowpass filters. */
+    class Filter : public cwASIO::Node {
+    public:
+        explicit Filter(unsigned stages)
+            : Node{ { { "in" } }, { { "out" } } }
+            , state_(stages, 0.f)
+        {}
+
+        void process(float const *const *in, float *const *out, size_t frames) override {
+            for (size_t i = 0; i < frames; ++i) {
+                float x = in[0][i];
+                for (float &s : state_)
+                    x = s += 0.1f * (x - s);
+                out[0][i] = x;
+            }
+        }
+
+    private:
+        std::vector<float> state_;
+    };
+
+    /** @return The average time per period in microseconds. */
+    double run(cwASIO::Schedule &schedule, unsigned periods, cwASIO::ThreadPool *pool) {
+        for (unsigned ch = 0; ch < channels; ++ch)
+            for (size_t i = 0; i < block; ++i)
+                schedule.input(ch)[i] = float(0.5 * std::sin(2. * pi * 1000. * i / sampleRate + ch));
+        schedule.run(block, pool);     // warm up
+        if (pool)
+            pool->resetStats();
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned p = 0; p < periods; ++p)
+            schedule.run(block, pool);
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / periods;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    unsigned nodes = argc > 1 ? unsigned(strtoul(argv[1], nullptr, 10)) : 64;
+    unsigned stages = argc > 2 ? unsigned(strtoul(argv[2], nullptr, 10)) : 16;
+    unsigned periods = argc > 3 ? unsigned(strtoul(argv[3], nullptr, 10)) : 2000;
+    cwASIO::ThreadPool::Options options;
+    options.workers = argc > 4 ? unsigned(strtoul(argv[4], nullptr, 10)) : 0;
+    if (nodes == 0 || stages == 0 || periods == 0) {
+        fprintf(stderr, "Usage: graphbench [<nodes> [<filter stages> [<periods> [<workers>]]]]\n");
+        return 2;
+    }
+
+    cwASIO::Graph graph{ channels, channels, sampleRate, block };
+    unsigned mixer = graph.add(std::make_shared<cwASIO::Mixer>(nodes));
+    for (unsigned n = 0; n < nodes; ++n) {
+        unsigned filter = graph.add(std::make_shared<Filter>(stages));
+        graph.connect({ cwASIO::Graph::device, n % channels }, { filter, 0 });
+        graph.connect({ filter, 0 }, { mixer, n });
+    }
+    graph.connect({ mixer, 0 }, { cwASIO::Graph::device, 0 });
+    auto schedule = graph.compile();
+
+    double period = block / sampleRate * 1e6;
+    printf("%u nodes with %u filter stages, %zu frames per period of %.0f us\n", nodes, stages, block, period);
+    double single = run(*schedule, periods, nullptr);
+    printf("single thread: %8.1f us per period, %5.1f%% of the period\n", single, 100. * single / period);
+
+    cwASIO::ThreadPool pool{ options };
+    double parallel = run(*schedule, periods, &pool);
+    printf("%2u workers:    %8.1f us per period, %5.1f%% of the period, speedup %.2f%s\n", pool.workers(), parallel
+        , 100. * parallel / period, single / parallel, pool.realtime() ? "" : " (no realtime priority)");
+    printf("participant      jobs     tasks    steals    sleeps   busy ms\n");
+    for (unsigned i = 0; i <= pool.workers(); ++i) {
+        auto s = pool.stats(i);
+        printf("%11u %9llu %9llu %9llu %9llu %9.1f\n", i, (unsigned long long)s.jobs, (unsigned long long)s.tasks
+            , (unsigned long long)s.steals, (unsigned long long)s.sleeps, std::chrono::duration<double, std::milli>(s.busy).count());
+    }
+    return 0;
+}
+
+/** @}*/
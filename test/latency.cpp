@@ -0,0 +1,251 @@
+/** @file       latency.cpp
+ *  @brief      cwASIO round trip latency measurement
+ *  @author     Stefan Heinzmann
+ *  @version    1.0
+ *  @date       2023-2025
+ *  @copyright  See file LICENSE in toplevel directory
+ * @addtogroup cwASIO_test
+ *  @{
+ *
+ * Measures the round trip latency from an output channel to an input channel,
+ * which have to be connected with a loopback cable. A maximum length sequence
+ * (MLS) is played on the output and captured on the input, and the latency is
+ * found at the peak of the cross correlation of the two. The measurement is
+ * repeated several times, and the statistics are reported alongside the
+ * latencies that the driver claims.
+ *
+ * The latency is given as the distance between the positions of a sample in the
+ * output buffers and in the input buffers, in samples. This is what the sum of
+ * the input and output latencies reported by `getLatencies()` should describe.
+ */
+
+#include "cwASIO.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::literals;
+
+static constexpr unsigned mlsOrder = 12;
+static constexpr size_t mlsLength = (1u << mlsOrder) - 1;
+static constexpr float level = 0.5f;
+
+static std::vector<float> sequence;         // the MLS, as +-level
+static std::vector<float> capture;          // captured input for one run
+static std::vector<float> scratch;          // one period
+static cwASIOBufferInfo bufferInfos[2];     // output, input
+static cwASIOChannelInfo channelInfos[2];
+static long blocksize = 0;
+static std::atomic_bool runRequested = false;
+static std::atomic_bool runDone = false;
+static size_t played = 0;                   // position within the current run, in samples
+static bool running = false;
+static std::sig_atomic_t volatile signalStatus = 0;
+
+
+static void signalHandler(int signal) {
+    signalStatus = signal;
+}
+
+static void bufferSwitch(long doubleBufferIndex, cwASIOBool directProcess) {
+    if (!running && runRequested.exchange(false)) {
+        running = true;
+        played = 0;
+    }
+    // output: the sequence followed by silence
+    std::fill(scratch.begin(), scratch.end(), 0.f);
+    if (running) {
+        for (long i = 0; i < blocksize && played + i < sequence.size(); ++i)
+            scratch[i] = sequence[played + i];
+    }
+    cwASIO::fromFloat(channelInfos[0].type, scratch.data(), bufferInfos[0].buffers[doubleBufferIndex], blocksize);
+    // input: captured from the period in which the sequence started
+    if (running) {
+        cwASIO::toFloat(channelInfos[1].type, bufferInfos[1].buffers[doubleBufferIndex], scratch.data(), blocksize);
+        size_t n = std::min(size_t(blocksize), capture.size() - played);
+        std::copy_n(scratch.begin(), n, capture.begin() + played);
+        played += n;
+        if (played == capture.size()) {
+            running = false;
+            runDone = true;
+        }
+    }
+}
+
+static void sampleRateDidChange(cwASIOSampleRate sRate) {
+}
+
+static long asioMessage(long selector, long value, void *message, double *opt) {
+    return 0;
+}
+
+static struct cwASIOTime *bufferSwitchTimeInfo(struct cwASIOTime *params, long doubleBufferIndex, cwASIOBool directProcess) {
+    bufferSwitch(doubleBufferIndex, directProcess);
+    return params;
+}
+
+static cwASIOCallbacks const callbacks = {
+    .bufferSwitch = &bufferSwitch,
+    .sampleRateDidChange = &sampleRateDidChange,
+    .asioMessage = &asioMessage,
+    .bufferSwitchTimeInfo = &bufferSwitchTimeInfo
+};
+
+/** Generate a maximum length sequence with a Galois LFSR. */
+static std::vector<float> makeSequence() {
+    std::vector<float> seq(mlsLength);
+    unsigned state = 1;
+    for (auto &s : seq) {
+        s = (state & 1) ? level : -level;
+        state = (state >> 1) ^ ((state & 1) ? 0xE08u : 0u);    // x^12 + x^11 + x^10 + x^4 + 1
+    }
+    return seq;
+}
+
+/** Find the lag of the correlation peak between the sequence and the capture, with sub-sample resolution.
+ * @return The lag, or a negative value if no clear peak was found.
+ */
+static double findPeak(size_t maxLag) {
+    std::vector<float> corr(maxLag);
+    for (size_t lag = 0; lag < maxLag; ++lag) {
+        float const *x = capture.data() + lag;
+        float acc = 0.f;
+        for (size_t i = 0; i < mlsLength; ++i)
+            acc += sequence[i] * x[i];
+        corr[lag] = std::abs(acc);
+    }
+    size_t peak = std::max_element(corr.begin(), corr.end()) - corr.begin();
+    double sum = 0.;
+    for (float c : corr)
+        sum += c;
+    double mean = (sum - corr[peak]) / double(maxLag - 1);
+    if (!(corr[peak] > 10. * mean))
+        return -1.;         // no clear peak, probably no loopback connection
+    if (peak == 0 || peak + 1 == maxLag)
+        return double(peak);
+    // parabolic interpolation around the peak
+    double a = corr[peak - 1], b = corr[peak], c = corr[peak + 1];
+    double denom = a - 2. * b + c;
+    return double(peak) + (denom != 0. ? 0.5 * (a - c) / denom : 0.);
+}
+
+int main(int argc, char const *argv[]) {
+    if(argc < 4 || argc > 5) {
+        std::cout << "Usage: latency <ASIO device> <output channel index> <input channel index> [<number of runs>]\n";
+        return 1;
+    }
+
+    try {
+        std::error_code ec;
+        cwASIO::Device driver(argv[1]);
+        long outChannel = strtol(argv[2], nullptr, 10);
+        long inChannel = strtol(argv[3], nullptr, 10);
+        int runs = argc > 4 ? atoi(argv[4]) : 10;
+
+        cwASIODriverInfo driverinfo = driver.init(nullptr);
+        if(driverinfo.errorMessage[0] != '\0')
+            throw std::runtime_error("Can't init driver "s + driverinfo.name + ": " + driverinfo.errorMessage);
+
+        auto [numInputChannels, numOutputChannels] = driver.getChannels(ec);
+        if(ec)
+            throw std::system_error(ec, "when reading number of channels");
+        if(outChannel < 0 || outChannel >= numOutputChannels || inChannel < 0 || inChannel >= numInputChannels)
+            throw std::runtime_error("channel index out of range");
+
+        auto [_0, _1, preferredSize, _2] = driver.getBufferSize(ec);
+        if(ec)
+            throw std::system_error(ec, "when reading supported buffer sizes");
+
+        double samplerate = driver.getSampleRate(ec);
+        if(ec)
+            throw std::system_error(ec, "when reading sampling rate");
+
+        bufferInfos[0] = cwASIOBufferInfo{ .isInput = ASIOFalse, .channelNum = outChannel };
+        bufferInfos[1] = cwASIOBufferInfo{ .isInput = ASIOTrue, .channelNum = inChannel };
+        blocksize = preferredSize;
+        scratch.resize(blocksize);
+        if(auto err = driver.createBuffers(bufferInfos, 2, preferredSize, &callbacks))
+            throw std::system_error(err, cwASIO::err_category(), "when trying to create the buffers");
+
+        for(int i = 0; i < 2; ++i) {
+            channelInfos[i].channel = bufferInfos[i].channelNum;
+            channelInfos[i].isInput = bufferInfos[i].isInput;
+            if(auto err = driver.getChannelInfo(channelInfos[i]))
+                throw std::system_error(err, cwASIO::err_category(), "when reading the channel info");
+            if(cwASIO::sampleSize(channelInfos[i].type) == 0)
+                throw std::runtime_error("Sample type not supported on channel "s + channelInfos[i].name);
+        }
+
+        auto [inputLatency, outputLatency] = driver.getLatencies(ec);
+        if(ec)
+            throw std::system_error(ec, "when reading latencies");
+        cwASIOInternalBufferInfo internal = {};
+        bool haveInternal = driver.future(kAsioGetInternalBufferSamples, &internal) == ASE_SUCCESS;
+
+        // search up to four times the claimed latency, but at least 8192 samples
+        size_t maxLag = std::max<size_t>(8192, 4 * size_t(inputLatency + outputLatency));
+        sequence = makeSequence();
+        capture.assign(mlsLength + maxLag, 0.f);
+
+        std::signal(SIGINT, signalHandler);
+        if(auto err = driver.start())
+            throw std::system_error(err, cwASIO::err_category(), "when trying to start streaming");
+
+        std::cout << "Measuring " << driver.getDriverName() << " from " << channelInfos[0].name
+            << " to " << channelInfos[1].name << " at " << samplerate << " Hz, buffer size " << blocksize << "\n";
+
+        std::vector<double> results;
+        for(int run = 0; run < runs && signalStatus == 0; ++run) {
+            runDone = false;
+            runRequested = true;
+            while(!runDone && signalStatus == 0)
+                std::this_thread::sleep_for(10ms);
+            if(signalStatus != 0)
+                break;
+            double lag = findPeak(maxLag);
+            if(lag < 0.) {
+                std::cout << "run " << (run + 1) << ": no signal found\n";
+                continue;
+            }
+            std::cout << "run " << (run + 1) << ": " << lag << " samples\n";
+            results.push_back(lag);
+        }
+        driver.stop();
+        driver.disposeBuffers();
+
+        std::cout << "reported: input " << inputLatency << ", output " << outputLatency
+            << ", total " << (inputLatency + outputLatency) << " samples";
+        if(haveInternal)
+            std::cout << " (internal buffering: input " << internal.inputSamples << ", output " << internal.outputSamples << ")";
+        std::cout << "\n";
+        if(results.empty()) {
+            std::cout << "measured: no valid runs\n";
+            return 3;
+        }
+        double mean = 0.;
+        for(double r : results)
+            mean += r;
+        mean /= double(results.size());
+        double var = 0.;
+        for(double r : results)
+            var += (r - mean) * (r - mean);
+        double stddev = results.size() > 1 ? std::sqrt(var / double(results.size() - 1)) : 0.;
+        auto [min, max] = std::minmax_element(results.begin(), results.end());
+        std::cout << "measured: mean " << mean << ", min " << *min << ", max " << *max << ", std dev " << stddev
+            << " samples over " << results.size() << " runs (" << (mean / samplerate * 1e3) << " ms)\n";
+        std::cout << "difference: " << (mean - double(inputLatency + outputLatency)) << " samples\n";
+    } catch(std::exception &ex) {
+        std::cerr << "Error: " << ex.what() << "\n";
+        return 2;
+    }
+    return 0;
+}
+
+/** @}*/
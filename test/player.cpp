@@ -9,6 +9,8 @@
  */
 
 #include "cwASIO.hpp"
+#include "cwASIOresample.hpp"
+#include <algorithm>
 #include <bit>
 #include <cassert>
 #include <csignal>
@@ -28,78 +30,67 @@ using namespace std::literals;
 
 static_assert(std::endian::native == std::endian::little);
 
-std::vector<int16_t> fileBuffer16;
-std::vector<int32_t> fileBuffer32;
-unsigned fileBufferIndex = 0;
-cwASIOSampleType sampleType = ASIOSTLastEntry;
+static WaveFile file;                           // read in chunks by the playing coroutine
+static unsigned fileChannels = 0;               // played channels of the file, 1 or 2
+static std::vector<float> fileBuffers[2];       // file samples not yet consumed, one vector per channel
+static std::vector<float *> filePointers;       // where to decode each channel of the file to, null if not played
+static size_t fileFill = 0;
+static std::unique_ptr<cwASIO::Resampler> resampler;   // when the file's sample rate differs from the device's
 static std::vector<cwASIOBufferInfo> bufferInfos(2);
 static long blocksize = 0;
 static cwASIOChannelInfo channelInfos[2];
 static std::sig_atomic_t volatile signalStatus = 0;
-static std::sig_atomic_t volatile stopStatus = 0;
 
 
 static void signalHandler(int signal) {
     signalStatus = signal;
 }
 
-static void bufferSwitch(long doubleBufferIndex, cwASIOBool directProcess) {
-    if (sampleType == ASIOSTInt32LSB) {
-        auto leftCh  = static_cast<int32_t *>(bufferInfos[0].buffers[doubleBufferIndex]);
-        auto rightCh = static_cast<int32_t *>(bufferInfos[1].buffers[doubleBufferIndex]);
-        for(long i = 0; i < blocksize; ++i) {
-            if (fileBufferIndex < fileBuffer32.size()) {
-                *leftCh++  = fileBuffer32.at(fileBufferIndex++);
-                *rightCh++ = fileBuffer32.at(fileBufferIndex++);
-            } else {
-                stopStatus = 1;
-                *leftCh++  = 0;
-                *rightCh++ = 0;
-            }
+/** Top up the file buffers with as much as the next period needs, decoded to float by the wave file. */
+static bool readFile() {
+    size_t needed = resampler ? resampler->inputFor(blocksize) : size_t(blocksize);
+    needed = std::min(needed, fileBuffers[0].size());
+    if (fileFill >= needed)
+        return true;
+    for (unsigned ch = 0; ch < fileChannels; ++ch)
+        filePointers[ch] = fileBuffers[ch].data() + fileFill;
+    size_t got = file.readFloat(filePointers.data(), (unsigned long)(needed - fileFill));
+    fileFill += got;
+    return fileFill == needed;
+}
+
+/** Play the file, one period after the other, resumed by the buffer switch callback. */
+static cwASIO::Task play(cwASIO::Device &driver) {
+    for (;;) {
+        cwASIO::Period period = co_await driver.nextPeriod();
+        bool more = readFile();
+        float const *in[2] = { fileBuffers[0].data(), fileBuffers[fileChannels - 1].data() };
+        // one period, before conversion to the device's sample type
+        float *out[2] = { period.arena->buffer<float>(blocksize).data(), period.arena->buffer<float>(blocksize).data() };
+        size_t produced, consumed;
+        if (resampler) {
+            produced = resampler->process(in, fileFill, out, blocksize, consumed);
+            if (fileChannels == 1)
+                std::copy_n(out[0], produced, out[1]);
+        } else {
+            produced = consumed = std::min(fileFill, size_t(blocksize));
+            for (int ch = 0; ch < 2; ++ch)
+                std::copy_n(in[ch], produced, out[ch]);
         }
-    } else {
-        auto leftCh  = static_cast<int16_t *>(bufferInfos[0].buffers[doubleBufferIndex]);
-        auto rightCh = static_cast<int16_t *>(bufferInfos[1].buffers[doubleBufferIndex]);
-        for(long i = 0; i < blocksize; ++i) {
-            if (fileBufferIndex < fileBuffer16.size()) {
-                *leftCh++  = fileBuffer16.at(fileBufferIndex++);
-                *rightCh++ = fileBuffer16.at(fileBufferIndex++);
-            } else {
-                stopStatus = 1;
-                *leftCh++  = 0;
-                *rightCh++ = 0;
-            }
+        for (unsigned ch = 0; ch < fileChannels; ++ch)
+            std::copy(fileBuffers[ch].begin() + consumed, fileBuffers[ch].begin() + fileFill, fileBuffers[ch].begin());
+        fileFill -= consumed;
+        if (produced < size_t(blocksize)) {
+            for (int ch = 0; ch < 2; ++ch)
+                std::fill(out[ch] + produced, out[ch] + blocksize, 0.f);
         }
+        for (int ch = 0; ch < 2; ++ch)
+            period.buffers[ch].fromFloat(out[ch]);
+        if (produced < size_t(blocksize) && !more)
+            co_return;      // the following periods are silent
     }
 }
 
-static void sampleRateDidChange(cwASIOSampleRate sRate) {
-}
-
-static long asioMessage(long selector, long value, void *message, double *opt) {
-    return 0;
-}
-
-static struct cwASIOTime *bufferSwitchTimeInfo(struct cwASIOTime *params, long doubleBufferIndex, cwASIOBool directProcess) {
-    bufferSwitch(doubleBufferIndex, directProcess);
-    return params;
-}
-
-static cwASIOCallbacks const callbacks = {
-    .bufferSwitch = &bufferSwitch,
-    .sampleRateDidChange = &sampleRateDidChange,
-    .asioMessage = &asioMessage,
-    .bufferSwitchTimeInfo = &bufferSwitchTimeInfo
-};
-
-static bool hasSupportedSampleFormat(WaveFile const &file) {
-    if(file.getBitsPerSample() == 32 && file.getBytesPerSample() == 4)
-        return true;
-    if(file.getBitsPerSample() == 16 && file.getBytesPerSample() == 2)
-        return true;
-    return false;
-}
-
 int main(int argc, char const *argv[]) {
     if(argc != 4) {
         std::cout << "Usage: player <ASIO device> <first channel index> <filename>\n";
@@ -137,71 +128,71 @@ int main(int argc, char const *argv[]) {
         if(ec)
             throw std::system_error(ec, "when reading sampling rate");
 
-        WaveFile file;
-        std::string res = file.open(filepath);
+        std::string res = file.openMapped(filepath);
         if (!res.empty())
             throw std::runtime_error(res);
 
-        if (!::hasSupportedSampleFormat(file))
-            throw std::runtime_error("wave file doesn't have correct sample format");
+        if (file.getSampleType() == ASIOSTLastEntry)
+            throw std::runtime_error("wave file doesn't have a supported sample format");
 
-        if (file.getChannels() != 2)
-            throw std::runtime_error("wave file isn't a stereo file");
+        if (file.getChannels() == 0)
+            throw std::runtime_error("wave file has no channels");
+        if (file.getChannels() > 2)
+            std::cout << "Playing the first 2 of " << file.getChannels() << " channels\n";
+        fileChannels = unsigned(std::min(file.getChannels(), 2UL));
 
         if (file.getSamplerate() != samplerate)
-            throw std::runtime_error("wave file hasn't got matching samplerate");
+            resampler = std::make_unique<cwASIO::Resampler>(fileChannels, file.getSamplerate(), samplerate, cwASIO::Resampler::Quality::high);
 
         bufferInfos[0].isInput = bufferInfos[1].isInput = false;
         bufferInfos[0].channelNum = firstChanIndex;
         bufferInfos[1].channelNum = firstChanIndex + 1;
-        if(auto err = driver.createBuffers(bufferInfos.data(), bufferInfos.size(), preferredSize, &callbacks))
+        if(auto err = driver.createBuffers(bufferInfos.data(), bufferInfos.size(), preferredSize))
             throw std::system_error(err, cwASIO::err_category(), "when trying to create the buffers");
         blocksize = preferredSize;
 
-        sampleType = file.getBytesPerSample() == 4 ? ASIOSTInt32LSB : ASIOSTInt16LSB;
         for(long ch = 0; ch < long(std::size(channelInfos)); ++ch) {
             channelInfos[ch].channel = firstChanIndex + ch;
             channelInfos[ch].isInput = false;
             if(auto err = driver.getChannelInfo(channelInfos[ch]))
                 throw std::system_error(err, cwASIO::err_category(), "when reading the info for channel with index " + std::to_string(ch));
-            if(channelInfos[ch].type != sampleType)
+            if(cwASIO::sampleSize(channelInfos[ch].type) == 0)
                 throw std::runtime_error("Sample type not supported on channel with index " + std::to_string(ch) + " (" + channelInfos[ch].name + ")");
         }
 
+        // enough file samples for one period, all allocated before streaming starts
         uint64_t totalSamples = file.getTotalSamples();
-        if(sampleType == ASIOSTInt32LSB) {
-            fileBuffer32.resize(totalSamples * 2U);
-            uint64_t sampleRead = file.read(totalSamples, fileBuffer32.data());
-            if (sampleRead != totalSamples)
-                throw std::runtime_error("couldn't read all samples of wave file");
-        } else {
-            fileBuffer16.resize(totalSamples * 2U);
-            uint64_t sampleRead = file.read(totalSamples, fileBuffer16.data());
-            if (sampleRead != totalSamples)
-                throw std::runtime_error("couldn't read all samples of wave file");
-        }
-        file.close();
+        size_t capacity = resampler ? resampler->inputFor(blocksize) : size_t(blocksize);
+        filePointers.assign(file.getChannels(), nullptr);
+        for(int ch = 0; ch < 2; ++ch)
+            fileBuffers[ch].resize(capacity);
+        unsigned long fileRate = file.getSamplerate();
 
-        uint64_t totalSeconds = totalSamples / samplerate;
+        uint64_t totalSeconds = totalSamples / fileRate;
         std::cout << "Now playing sound file for " << totalSeconds << " seconds\n";
 
         std::signal(SIGINT, signalHandler);
 
+        cwASIO::Task task = play(driver);
         if(auto err = driver.start())
             throw std::system_error(err, cwASIO::err_category(), "when trying to start streaming");
 
         std::cout << "Playback device " << driver.getDriverName()
             << " (" << channelInfos[0].name << "/" << channelInfos[1].name << ") at " << samplerate << " Hz\n";
 
-        uint32_t limit = uint32_t(uint32_t(0) - 2 * blocksize * 8);     // file size limit 4GB
-        uint32_t last = 0;
-        while(signalStatus == 0 && stopStatus == 0)
+        while(signalStatus == 0 && !task.done())
             std::this_thread::sleep_for(10ms);
         if (signalStatus != 0)
             printf("\nplayback aborted\n");
+        driver.stop();
+        driver.disposeBuffers();
+        file.close();
+        task.rethrow();
     } catch(std::exception &ex) {
         std::cerr << "Error: " << ex.what() << "\n";
         return 2;
     }
     return 0;
 }
+
+/** @}*/
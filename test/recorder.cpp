@@ -6,32 +6,141 @@
  *  @copyright  See file LICENSE in toplevel directory
  * @addtogroup cwASIO_test
  *  @{
+ *
+ * Records any set of input channels into one interleaved WAV file, which turns
+ * into an RF64 file when it grows beyond 4 GB. The device's sample type is
+ * converted to the file's sample format, which is 32-bit integer unless
+ * specified otherwise.
+ *
+ * For sessions with many channels, the `-s` option splits the recording into
+ * one file per group of channels, for example mono files with `-s 1`. The files
+ * are spread over the directories given with `-d`, so several disks can share
+ * the load.
+ *
+ * The buffer switch callback only copies the input buffers into a ring of
+ * preallocated periods. The main thread checks the sample positions and writes
+ * the sidecar, then a pool of worker threads converts and interleaves the
+ * samples, each for its share of the files. The file I/O happens on each
+ * file's own writer thread.
+ *
+ * Besides the WAV file, the recorder writes a sidecar file with the same name
+ * plus the extension `.pos`, which logs the sample position and system time of
+ * each period. It starts with a `PosHeader`, followed by one `PosRecord` per
+ * period, all in little endian byte order.
+ *
+ * When the sample position of a period doesn't continue where the previous one
+ * ended, periods have been lost. The recorder then fills the gap with silence,
+ * so the recording stays aligned with the device's sample clock, and marks the
+ * gap in the sidecar. A jump of more than `maxGap` seconds isn't filled, the
+ * recording just continues from the new position, which is marked as a resync.
  */
 
 #include "cwASIO.hpp"
+#include <algorithm>
+#include <atomic>
 #include <bit>
+#include <cassert>
+#include <charconv>
+#include <functional>
 #include <csignal>
 #include <cstdlib>
+#include <cstring>
 #include <filesystem>
+#include <format>
 #include <fstream>
 #include <iostream>
 #include <memory>
 #include <mutex>
-#include <queue>
 #include <string>
 #include <string_view>
 #include <thread>
 #include <vector>
+#include "wavefile/wavefile.hpp"
 
 using namespace std::literals;
 
 static_assert(std::endian::native == std::endian::little);
 
-static std::mutex bufferMutex;
-static std::queue<std::vector<int32_t>> bufferQueue;
-static std::vector<cwASIOBufferInfo> bufferInfos(2);
+/** One period as passed from the callback to the writer, in the device's sample types. */
+struct Period {
+    std::vector<std::byte> samples; // planar, at `channelOffsets`
+    int64_t samplePosition;
+    int64_t systemTime;             // nanoseconds
+    bool valid;                     // the position and time are valid
+    uint64_t silence;               // frames of silence to write before this period
+    size_t skip;                    // frames to drop at the start of this period
+};
+
+/** Sample formats of the WAV file. */
+struct FileFormat {
+    std::string_view name;
+    cwASIOSampleType type;
+    unsigned bits;
+    bool isFloat;
+};
+
+static FileFormat const fileFormats[] = {
+    { "int16", ASIOSTInt16LSB, 16, false },
+    { "int24", ASIOSTInt24LSB, 24, false },
+    { "int32", ASIOSTInt32LSB, 32, false },
+    { "float32", ASIOSTFloat32LSB, 32, true }
+};
+
+/** Start of the sidecar file. */
+struct PosHeader {
+    char     magic[8] = {'c','w','A','S','I','O','p','s'};
+    uint32_t version = 1;
+    uint32_t sampleRate;
+    uint32_t blockSize;             // frames per period
+    uint32_t recordSize = 32;       // size of a `PosRecord`
+};
+
+/** Sidecar entry for one period. */
+struct PosRecord {
+    enum Flags : uint32_t {
+        invalid = 1,                // the driver didn't deliver a valid position
+        gap = 2,                    // `frames` of silence were inserted before this period
+        overlap = 4,                // `frames` at the start of this period were dropped, because the position went backwards
+        resync = 8                  // the position jumped by more than `maxGap` seconds and was taken as the new reference
+    };
+    uint64_t filePosition;          // frame index within the WAV file at which this period starts
+    int64_t  samplePosition;        // sample position reported by the driver
+    int64_t  systemTime;            // system time reported by the driver, in nanoseconds
+    uint32_t flags;
+    uint32_t frames;
+};
+static_assert(sizeof(PosRecord) == 32);
+
+/** A file with its share of the channels. */
+struct Group {
+    std::vector<size_t> channels;   // indices into `channelInfos`
+    std::filesystem::path path;
+    WaveFile file;
+};
+
+/** A writer thread, serving some of the groups. */
+struct Worker {
+    std::vector<Group *> groups;
+    std::atomic<size_t> tail = 0;   // next period to be written
+    std::thread thread;
+};
+
+static constexpr unsigned maxGap = 10;       // seconds of lost periods to fill with silence at most
+static std::vector<Period> ring;             // FIFO of periods, from the callback to the main thread and on to the workers
+static std::atomic<size_t> ringHead = 0;    // next period to be filled by the callback
+static std::atomic<size_t> ringChecked = 0; // next period to be checked by the main thread
+static std::atomic<unsigned> overruns = 0;  // periods dropped because the ring was full
+static std::vector<std::unique_ptr<Group>> groups;
+static std::vector<std::unique_ptr<Worker>> workers;
+static std::atomic<bool> stopping = false;  // the workers shall end when they are done with all periods
+static std::mutex errorMutex;
+static std::string writeError;              // the first error of a worker
+static std::atomic<bool> failed = false;
+static cwASIO::Device *device = nullptr;
+static std::vector<cwASIOBufferInfo> bufferInfos;
+static std::vector<cwASIOChannelInfo> channelInfos;
+static std::vector<size_t> channelOffsets;  // of each channel's samples within a period
 static long blocksize = 0;
-static cwASIOChannelInfo channelInfos[2];
 static std::sig_atomic_t volatile signalStatus = 0;
 
 
@@ -39,37 +148,55 @@ static void signalHandler(int signal) {
     signalStatus = signal;
 }
 
-static std::vector<int32_t> getNext() {
-    std::vector<int32_t> res;
-    std::lock_guard<std::mutex> guard(bufferMutex);
-    if(bufferQueue.empty())
-        return res;
-    res = std::move(bufferQueue.front());
-    bufferQueue.pop();
-    return res;
+/** @return The number of periods in the ring that are still needed by the slowest worker. */
+static size_t ringUsed(size_t head) {
+    size_t used = 0;
+    for(auto const &worker : workers)
+        used = std::max(used, head - worker->tail.load(std::memory_order_acquire));
+    return used;
 }
 
-static void bufferSwitch(long doubleBufferIndex, cwASIOBool directProcess) {
-    std::vector<int32_t> buf(2*blocksize);
-    auto leftCh  = static_cast<int32_t const *>(bufferInfos[0].buffers[doubleBufferIndex]);
-    auto rightCh = static_cast<int32_t const *>(bufferInfos[1].buffers[doubleBufferIndex]);
-    for(long i = 0; i < blocksize; ++i) {
-        buf[2*i]   = *leftCh++;
-        buf[2*i+1] = *rightCh++;
+static void enqueue(long doubleBufferIndex, int64_t samplePosition, int64_t systemTime, bool valid) {
+    size_t head = ringHead.load(std::memory_order_relaxed);
+    if(ringUsed(head) == ring.size()) {
+        ++overruns;         // the main thread will see a gap in the sample positions and fill it with silence
+        return;
     }
-    std::lock_guard<std::mutex> guard(bufferMutex);
-    bufferQueue.push(std::move(buf));
+    Period &period = ring[head % ring.size()];
+    for(size_t ch = 0; ch < bufferInfos.size(); ++ch)
+        memcpy(period.samples.data() + channelOffsets[ch], bufferInfos[ch].buffers[doubleBufferIndex], blocksize * cwASIO::sampleSize(channelInfos[ch].type));
+    period.samplePosition = samplePosition;
+    period.systemTime = systemTime;
+    period.valid = valid;
+    ringHead.store(head + 1, std::memory_order_release);
+}
+
+static void bufferSwitch(long doubleBufferIndex, cwASIOBool directProcess) {
+    std::error_code ec;
+    auto pos = device->getSamplePosition(ec);
+    enqueue(doubleBufferIndex, int64_t(pos.samplePosition), pos.systemTime.count(), !ec);
 }
 
 static void sampleRateDidChange(cwASIOSampleRate sRate) {
 }
 
 static long asioMessage(long selector, long value, void *message, double *opt) {
-    return 0;
+    switch(selector) {
+    case kAsioSelectorSupported:
+        return value == kAsioEngineVersion || value == kAsioSupportsTimeInfo;
+    case kAsioEngineVersion:
+        return 2;
+    case kAsioSupportsTimeInfo:
+        return 1;
+    default:
+        return 0;
+    }
 }
 
 static struct cwASIOTime *bufferSwitchTimeInfo(struct cwASIOTime *params, long doubleBufferIndex, cwASIOBool directProcess) {
-    bufferSwitch(doubleBufferIndex, directProcess);
+    auto const &info = params->timeInfo;
+    bool valid = (info.flags & (kSystemTimeValid | kSamplePositionValid)) == (kSystemTimeValid | kSamplePositionValid);
+    enqueue(doubleBufferIndex, int64_t(cwASIO::qWord(info.samplePosition)), int64_t(cwASIO::qWord(info.systemTime)), valid);
     return params;
 }
 
@@ -80,68 +207,126 @@ static cwASIOCallbacks const callbacks = {
     .bufferSwitchTimeInfo = &bufferSwitchTimeInfo
 };
 
-struct WAVfile {
-    struct Header {     // simplest possible WAV header
-        char     fileTypeBlocID[4] = {'R','I','F','F'};
-        uint32_t fileSize = 36;         // Overall file size minus 8 bytes
-        char     fileFormatID[4] = {'W','A','V','E'};
-        char     formatBlocID[4] = {'f','m','t',' '};
-        uint32_t blocSize = 16;
-        uint16_t audioFormat = 1;       // PCM integer
-        uint16_t nbrChannels = 2;       // Number of channels
-        uint32_t frequency;             // Sample rate (in Hz)
-        uint32_t bytePerSec;            // Number of bytes to read per second (frequency * bytePerBloc).
-        uint16_t bytePerBloc = 8;       // Number of bytes per block (nbrChannels * bitsPerSample / 8).
-        uint16_t bitsPerSample = 32;    // Number of bits per sample
-        char     dataBlocID[4] = {'d','a','t','a'};
-        uint32_t dataSize = 0;          // sampled data size
-    };
-
-    WAVfile(std::filesystem::path path, uint32_t samplerate)
-        : os_(path, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary)
-    {
-        Header header{ .frequency = samplerate, .bytePerSec = samplerate * 8 };
-        os_.exceptions(std::ofstream::failbit);
-        os_.write(reinterpret_cast<char const *>(&header), sizeof(header));
-        written_ = sizeof(header);
+/** Parse a comma separated list of channel indices and ranges, like `0-3,8`. */
+static std::vector<long> parseChannels(std::string_view list) {
+    std::vector<long> channels;
+    while(!list.empty()) {
+        std::string_view item = list.substr(0, list.find(','));
+        list.remove_prefix(std::min(item.size() + 1, list.size()));
+        long first = -1, last = -1;
+        char const *end = item.data() + item.size();
+        auto result = std::from_chars(item.data(), end, first);
+        if(result.ec == std::errc() && result.ptr != end && *result.ptr == '-')
+            result = std::from_chars(result.ptr + 1, end, last);
+        else
+            last = first;
+        if(result.ec != std::errc() || result.ptr != end || first < 0 || last < first)
+            throw std::runtime_error("invalid channel list item \"" + std::string(item) + "\"");
+        for(long ch = first; ch <= last; ++ch)
+            channels.push_back(ch);
     }
+    if(channels.empty())
+        throw std::runtime_error("no channels given");
+    return channels;
+}
 
-    ~WAVfile() {
-        // we need to fix up the header with the actual sizes
-        std::streampos pos = offsetof(Header, fileSize);
-        os_.seekp(pos);
-        written_ -= pos;
-        os_.write(reinterpret_cast<char const *>(&written_), sizeof(written_));
-        written_ += pos;
-        pos = offsetof(Header, dataSize);
-        os_.seekp(pos);
-        written_ -= pos;
-        os_.write(reinterpret_cast<char const *>(&written_), sizeof(written_));
-        os_.close();
-        std::cout << "Written " << (written_ / 8) << " samples\n";
+/** Convert the samples of a group's channels to the file format, and interleave them. */
+static void convert(Period const &period, Group const &group, FileFormat const &format, std::vector<float> &scratch, std::vector<std::byte> &converted, std::vector<std::byte> &interleaved) {
+    size_t frames = size_t(blocksize) - period.skip;
+    size_t size = cwASIO::sampleSize(format.type);
+    size_t frame = group.channels.size() * size;
+    for(size_t i = 0; i < group.channels.size(); ++i) {
+        size_t ch = group.channels[i];
+        cwASIOSampleType type = channelInfos[ch].type;
+        std::byte const *src = period.samples.data() + channelOffsets[ch] + period.skip * cwASIO::sampleSize(type);
+        if(type != format.type) {
+            cwASIO::toFloat(type, src, scratch.data(), long(frames));
+            cwASIO::fromFloat(format.type, scratch.data(), converted.data(), long(frames));
+            src = converted.data();
+        }
+        std::byte *dst = interleaved.data() + i * size;
+        for(size_t j = 0; j < frames; ++j, src += size, dst += frame)
+            memcpy(dst, src, size);
     }
+}
 
-    uint32_t write(std::vector<int32_t> const &vec) {
-        os_.write(reinterpret_cast<char const *>(vec.data()), vec.size() * sizeof(int32_t));
-        written_ += vec.size() * sizeof(int32_t);
-        return written_;
-    }
+static void fail(std::string const &error) {
+    std::lock_guard<std::mutex> guard(errorMutex);
+    if(!failed.exchange(true))
+        writeError = error;
+}
 
-    std::ofstream os_;
-    uint32_t written_;
-};
+/** Write the checked periods into the worker's files. */
+static void runWorker(Worker &worker, FileFormat const &format) {
+    size_t largest = 0;
+    for(Group const *group : worker.groups)
+        largest = std::max(largest, group->channels.size());
+    size_t size = cwASIO::sampleSize(format.type);
+    std::vector<float> scratch(blocksize);
+    std::vector<std::byte> converted(blocksize * size);
+    std::vector<std::byte> interleaved(blocksize * size * largest);
+    std::vector<std::byte> const silence(interleaved.size());
+
+    for(;;) {
+        size_t tail = worker.tail.load(std::memory_order_relaxed);
+        if(tail == ringChecked.load(std::memory_order_acquire)) {
+            if(stopping)
+                return;
+            std::this_thread::sleep_for(5ms);
+            continue;
+        }
+        Period const &period = ring[tail % ring.size()];
+        for(Group *group : worker.groups) {
+            std::string res;
+            for(uint64_t done = 0; done < period.silence && res.empty(); ) {
+                auto n = (unsigned long)std::min<uint64_t>(period.silence - done, blocksize);
+                res = group->file.write(silence.data(), n);
+                done += n;
+            }
+            if(res.empty()) {
+                convert(period, *group, format, scratch, converted, interleaved);
+                res = group->file.write(interleaved.data(), (unsigned long)(blocksize - period.skip));
+            }
+            if(!res.empty())
+                fail(group->path.string() + ": " + res);
+        }
+        worker.tail.store(tail + 1, std::memory_order_release);
+    }
+}
 
 int main(int argc, char const *argv[]) {
-    if(argc != 4) {
-        std::cout << "Usage: recorder <ASIO device> <first channel index> <filename>\n";
+    size_t groupSize = 0;                           // 0 for a single file
+    std::vector<std::filesystem::path> directories;
+    int arg = 1;
+    for(; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        if(argv[arg] == "-s"sv)
+            groupSize = strtoul(argv[arg + 1], nullptr, 10);
+        else if(argv[arg] == "-d"sv)
+            directories.emplace_back(argv[arg + 1]);
+        else
+            break;
+    }
+    argc -= arg - 1;
+    argv += arg - 1;
+    if(argc < 4 || argc > 5) {
+        std::cout << "Usage: recorder [-s <channels per file>] [-d <directory>]... <ASIO device> <channel list> <filename> [int16|int24|int32|float32]\n"
+            "The channel list holds input channel indices and ranges, like 0-3,8\n"
+            "With -s, the channels are split into several files named after the first channel of each,\n"
+            "which are distributed over the directories given with -d\n";
         return 1;
     }
 
     try {
         std::error_code ec;
         cwASIO::Device driver(argv[1]);
-        auto firstChanIndex = strtol(argv[2], nullptr, 10);
+        std::vector<long> channels = parseChannels(argv[2]);
         std::filesystem::path filepath(argv[3]);
+        FileFormat const *format = &fileFormats[2];
+        if(argc > 4) {
+            format = std::find_if(std::begin(fileFormats), std::end(fileFormats), [&](auto const &f) { return f.name == argv[4]; });
+            if(format == std::end(fileFormats))
+                throw std::runtime_error("unknown file format "s + argv[4]);
+        }
 
         cwASIODriverInfo driverinfo = driver.init(nullptr);
         if(driverinfo.errorMessage[0] != '\0')
@@ -153,60 +338,169 @@ int main(int argc, char const *argv[]) {
         auto [numInputChannels, _] = driver.getChannels(ec);
         if(ec)
             throw std::system_error(ec, "when reading number of channels");
-        if(firstChanIndex < 0)
-            throw std::runtime_error("first channel index must not be negative");
-        if(firstChanIndex + 2 > numInputChannels)
-            throw std::runtime_error("not enough input channels");
+        for(long ch : channels) {
+            if(ch >= numInputChannels)
+                throw std::runtime_error("input channel index " + std::to_string(ch) + " out of range");
+        }
 
         auto [_0, _1, preferredSize, _2] = driver.getBufferSize(ec);
         if(ec)
             throw std::system_error(ec, "when reading supported buffer sizes");
 
-        bufferInfos[0].isInput = bufferInfos[1].isInput = true;
-        bufferInfos[0].channelNum = firstChanIndex;
-        bufferInfos[1].channelNum = firstChanIndex + 1;
-        if(auto err = driver.createBuffers(bufferInfos.data(), bufferInfos.size(), preferredSize, &callbacks))
+        for(long ch : channels)
+            bufferInfos.push_back(cwASIOBufferInfo{ .isInput = ASIOTrue, .channelNum = ch });
+        if(auto err = driver.createBuffers(bufferInfos.data(), long(bufferInfos.size()), preferredSize, &callbacks))
             throw std::system_error(err, cwASIO::err_category(), "when trying to create the buffers");
         blocksize = preferredSize;
 
-        for(long ch = 0; ch < long(std::size(channelInfos)); ++ch) {
-            channelInfos[ch].channel = firstChanIndex + ch;
+        size_t periodBytes = 0;
+        channelInfos.resize(channels.size());
+        for(size_t ch = 0; ch < channels.size(); ++ch) {
+            channelInfos[ch].channel = channels[ch];
             channelInfos[ch].isInput = true;
             if(auto err = driver.getChannelInfo(channelInfos[ch]))
-                throw std::system_error(err, cwASIO::err_category(), "when reading the info for channel with index " + std::to_string(ch));
-            if(channelInfos[ch].type != ASIOSTInt32LSB)
-                throw std::runtime_error("Sample type not supported on channel with index " + std::to_string(ch) + " (" + channelInfos[ch].name + ")");
+                throw std::system_error(err, cwASIO::err_category(), "when reading the info for channel with index " + std::to_string(channels[ch]));
+            if(cwASIO::sampleSize(channelInfos[ch].type) == 0)
+                throw std::runtime_error("Sample type not supported on channel with index " + std::to_string(channels[ch]) + " (" + channelInfos[ch].name + ")");
+            channelOffsets.push_back(periodBytes);
+            periodBytes += blocksize * cwASIO::sampleSize(channelInfos[ch].type);
         }
 
         uint32_t samplerate = uint32_t(driver.getSampleRate(ec));
         if(ec)
             throw std::system_error(ec, "when reading sampling rate");
 
-        WAVfile file(filepath, samplerate);
+        // room for two seconds of periods
+        ring.resize(std::max<size_t>(16, 2 * samplerate / blocksize));
+        for(auto &period : ring)
+            period.samples.resize(periodBytes);
+
+        // split the channels into groups, and distribute their files over the directories
+        if(groupSize == 0 || groupSize > channels.size())
+            groupSize = channels.size();
+        for(size_t first = 0; first < channels.size(); first += groupSize) {
+            auto group = std::make_unique<Group>();
+            for(size_t ch = first; ch < std::min(first + groupSize, channels.size()); ++ch)
+                group->channels.push_back(ch);
+            std::filesystem::path name = filepath.filename();
+            if(groupSize < channels.size())
+                name = filepath.stem().string() + "_" + std::to_string(channels[first]) + filepath.extension().string();
+            std::filesystem::path dir = directories.empty() ? filepath.parent_path() : directories[groups.size() % directories.size()];
+            group->path = dir / name;
+            groups.push_back(std::move(group));
+        }
+        // share the write buffer budget of 256 MiB among the files
+        size_t bufferBytes = std::clamp<size_t>((64 << 20) / groups.size(), 1 << 20, 4 << 20);
+        // and the preallocation of 256 MiB ahead, but at least the ring of each file
+        unsigned long long extent = std::max<unsigned long long>((256ULL << 20) / groups.size(), 4 * bufferBytes);
+        for(auto &group : groups) {
+            if(std::string res = group->file.openAsync(group->path, samplerate, format->bits, (unsigned long)group->channels.size(), format->isFloat, bufferBytes, 4, extent); !res.empty())
+                throw std::runtime_error(res);
+        }
+        size_t numWorkers = std::min<size_t>(groups.size(), std::max(1u, std::thread::hardware_concurrency()));
+        for(size_t i = 0; i < numWorkers; ++i)
+            workers.push_back(std::make_unique<Worker>());
+        for(size_t i = 0; i < groups.size(); ++i)
+            workers[i % numWorkers]->groups.push_back(groups[i].get());
+
+        std::filesystem::path sidecarPath = filepath;
+        sidecarPath += ".pos";
+        std::ofstream sidecar(sidecarPath, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+        sidecar.exceptions(std::ofstream::failbit);
+        PosHeader posHeader{ .sampleRate = samplerate, .blockSize = uint32_t(blocksize) };
+        sidecar.write(reinterpret_cast<char const *>(&posHeader), sizeof(posHeader));
+
+        for(auto &worker : workers)
+            worker->thread = std::thread(runWorker, std::ref(*worker), std::cref(*format));
+
+        device = &driver;
 
         std::signal(SIGINT, signalHandler);
 
         if(auto err = driver.start())
             throw std::system_error(err, cwASIO::err_category(), "when trying to start streaming");
 
-        std::cout << "Recording device " << driver.getDriverName()
-            << " (" << channelInfos[0].name << "/" << channelInfos[1].name << ") at " << samplerate << " Hz\n";
+        std::cout << "Recording device " << driver.getDriverName() << " (" << channels.size() << " channels from "
+            << channelInfos.front().name << " to " << channelInfos.back().name << ") at " << samplerate << " Hz as " << format->name
+            << " into " << groups.size() << " file(s) with " << workers.size() << " writer thread(s)\n";
 
-        uint32_t limit = uint32_t(uint32_t(0) - 2 * blocksize * 8);     // file size limit 4GB
-        uint32_t last = 0;
-        while(signalStatus == 0) {
-            std::vector<int32_t> buf = getNext();
-            if(buf.empty()) {
+        uint64_t frames = 0;        // frames in each file
+        uint64_t last = 0;
+        bool first = true;
+        int64_t offset = 0;         // sample position of the first frame in the files
+        unsigned gaps = 0;
+        bool stopped = false;
+        for(;;) {
+            if(!stopped && (signalStatus != 0 || failed)) {
+                driver.stop();      // check the periods that are still in the ring, then finish
+                stopped = true;
+            }
+            size_t checked = ringChecked.load(std::memory_order_relaxed);
+            if(checked == ringHead.load(std::memory_order_acquire)) {
+                if(stopped)
+                    break;
                 std::this_thread::sleep_for(10ms);
-            } else if(auto n = file.write(buf); n >= limit) {
-                break;
-            } else if(n > last + samplerate * 40) {
-                std::cout << "Written " << (n / 8) << " samples\r";
-                last = n;
+                continue;
+            }
+            Period &period = ring[checked % ring.size()];
+            PosRecord record{ frames, period.samplePosition, period.systemTime, 0, 0 };
+            period.silence = 0;
+            period.skip = 0;
+            if(!period.valid) {
+                record.flags |= PosRecord::invalid;
+            } else if(first) {
+                offset = period.samplePosition - int64_t(frames);    // after the frames of any invalid periods before
+                first = false;
+            } else if(int64_t expected = offset + int64_t(frames);
+                      std::abs(period.samplePosition - expected) > int64_t(maxGap) * samplerate) {
+                offset = period.samplePosition - int64_t(frames);
+                record.flags |= PosRecord::resync;
+                ++gaps;
+                std::cout << "Resync from sample position " << expected << " to " << period.samplePosition << "\n";
+            } else if(period.samplePosition > expected) {
+                period.silence = uint64_t(period.samplePosition - expected);
+                record = PosRecord{ frames + period.silence, period.samplePosition, period.systemTime, PosRecord::gap, uint32_t(period.silence) };
+                ++gaps;
+                std::cout << "Gap of " << period.silence << " samples at sample position " << expected << "\n";
+            } else if(period.samplePosition < expected) {
+                period.skip = size_t(std::min<int64_t>(expected - period.samplePosition, blocksize));
+                record.flags |= PosRecord::overlap;
+                record.frames = uint32_t(period.skip);
+                ++gaps;
+                std::cout << "Overlap of " << (expected - period.samplePosition) << " samples at sample position " << expected << "\n";
+            }
+            sidecar.write(reinterpret_cast<char const *>(&record), sizeof(record));
+            frames += period.silence + (blocksize - period.skip);
+            ringChecked.store(checked + 1, std::memory_order_release);
+            if(frames > last + samplerate * 10ULL) {
+                std::cout << "Written " << frames << " samples\r" << std::flush;
+                last = frames;
             }
         }
+        stopping = true;
+        for(auto &worker : workers)
+            worker->thread.join();
+        driver.disposeBuffers();
+        for(auto &group : groups) {
+            if(std::string res = group->file.close(); !res.empty())
+                fail(group->path.string() + ": " + res);
+        }
+        if(failed)
+            throw std::runtime_error(writeError);
+        std::cout << "Written " << frames << " samples\n";
+        if(overruns)
+            std::cout << overruns << " periods lost because the writers fell behind\n";
+        if(gaps)
+            std::cout << gaps << " discontinuities, see " << sidecarPath << "\n";
     } catch(std::exception &ex) {
+        stopping = true;
+        for(auto &worker : workers) {
+            if(worker->thread.joinable())
+                worker->thread.join();
+        }
         std::cerr << "Error: " << ex.what() << "\n";
         return 2;
     }
 }
+
+/** @}*/
@@ -0,0 +1,102 @@
+/** @file       resamplebench.cpp
+ *  @brief      cwASIO sample rate converter benchmark
+ *  @author     Stefan Heinzmann
+ *  @version    1.0
+ *  @date       2023-2025
+ *  @copyright  See file LICENSE in toplevel directory
+ * @addtogroup cwASIO_test
+ *  @{
+ *
+ * Measures the speed and the accuracy of `cwASIO::Resampler` for each quality
+ * preset in some typical conversions. The input is a stereo sine tone, which is
+ * converted in blocks of the size of a typical buffer switch. The accuracy is
+ * given as the signal to noise ratio of the output compared with the ideal sine
+ * at the output rate.
+ */
+
+#include "cwASIOresample.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace {
+    struct Case {
+        char const *name;
+        double inRate;
+        double outRate;
+        bool variable;
+        double drift;       // relative ratio deviation in variable mode
+    };
+
+    Case const cases[] = {
+        { "44.1k -> 48k fixed", 44100., 48000., false, 0. },
+        { "48k -> 44.1k fixed", 48000., 44100., false, 0. },
+        { "96k -> 48k fixed", 96000., 48000., false, 0. },
+        { "48k -> 48k variable", 48000., 48000., true, 1e-4 },
+        { "44.1k -> 48k variable", 44100., 48000., true, -2e-4 }
+    };
+
+    char const *const qualityNames[] = { "fast", "medium", "high" };
+
+    constexpr double pi = 3.14159265358979323846;
+    constexpr unsigned channels = 2;
+    constexpr size_t block = 256;       // output frames per call
+    constexpr double seconds = 10.;
+    constexpr double tone = 1000.;      // Hz
+
+    void run(Case const &c, cwASIO::Resampler::Quality quality) {
+        cwASIO::Resampler rs(channels, c.inRate, c.outRate, quality, c.variable);
+        double ratio = c.inRate / c.outRate * (1. + c.drift);
+        if (c.variable)
+            rs.setRatio(ratio);
+        size_t inFrames = size_t(c.inRate * seconds);
+        std::vector<float> input[channels];
+        for (unsigned ch = 0; ch < channels; ++ch) {
+            input[ch].resize(inFrames);
+            for (size_t i = 0; i < inFrames; ++i)
+                input[ch][i] = float(0.5 * std::sin(2. * pi * tone * i / c.inRate + ch));
+        }
+        std::vector<float> output[channels];
+        for (auto &o : output)
+            o.resize(size_t(inFrames / ratio) + block);
+        size_t done = 0, produced = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (;;) {
+            float const *in[channels];
+            float *out[channels];
+            for (unsigned ch = 0; ch < channels; ++ch) {
+                in[ch] = input[ch].data() + done;
+                out[ch] = output[ch].data() + produced;
+            }
+            size_t consumed;
+            size_t n = rs.process(in, inFrames - done, out, block, consumed);
+            done += consumed;
+            produced += n;
+            if (n < block)
+                break;
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        // compare with the ideal output, leaving out the filter's transients at both ends
+        double signal = 0., noise = 0.;
+        size_t margin = size_t(rs.latency() / ratio) + 1;
+        for (unsigned ch = 0; ch < channels; ++ch) {
+            for (size_t i = margin; i + margin < produced; ++i) {
+                double ideal = 0.5 * std::sin(2. * pi * tone * i * ratio / c.inRate + ch);
+                signal += ideal * ideal;
+                noise += (output[ch][i] - ideal) * (output[ch][i] - ideal);
+            }
+        }
+        printf("%-24s %-7s %8.1fx realtime  SNR %6.1f dB\n", c.name, qualityNames[unsigned(quality)]
+            , seconds / elapsed, 10. * std::log10(signal / noise));
+    }
+}
+
+int main() {
+    for (auto const &c : cases)
+        for (auto q : { cwASIO::Resampler::Quality::fast, cwASIO::Resampler::Quality::medium, cwASIO::Resampler::Quality::high })
+            run(c, q);
+    return 0;
+}
+
+/** @}*/
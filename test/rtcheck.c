@@ -0,0 +1,411 @@
+/** @file       rtcheck.c
+ *  @brief      cwASIO realtime safety checker for hosts
+ *  @author     Stefan Heinzmann
+ *  @version    1.0
+ *  @date       2023-2025
+ *  @copyright  See file LICENSE in toplevel directory
+ * @addtogroup cwASIO_test
+ *  @{
+ *
+ * Preloaded into a host, this library reports the calls made within realtime
+ * callbacks that may block or take unbounded time: memory allocation and
+ * release, locking a mutex, waiting on a semaphore, file and console I/O, and
+ * sleeping. The callbacks are marked by `cwASIO::RealtimeScope`, so the host
+ * has to be built with the CMake option `CWASIO_REALTIME_CHECK`:
+ *
+ *     LD_PRELOAD=./libcwASIO_rtcheck.so ./cwASIO_recorder <device> ...
+ *
+ * Each call site is reported with a stack trace the first time it is hit, and
+ * the number of calls per site is listed when the host exits. Setting the
+ * environment variable `CWASIO_RTCHECK` to `abort` aborts the host at the first
+ * violation instead, for inspecting it in the debugger.
+ *
+ * Memory is allocated with glibc's `__libc_malloc()` and friends, so that
+ * resolving the other functions with `dlsym()` can allocate memory.
+ */
+
+#define _GNU_SOURCE
+#undef _FORTIFY_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <time.h>
+#include <unistd.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+#define TLS __thread __attribute__((tls_model("initial-exec")))
+
+struct Site {
+    _Atomic(void *) caller;             // return address of the call
+    char const *what;
+    char const *callback;
+    atomic_ulong count;
+};
+
+enum { maxSites = 512 };
+
+static struct Site sites[maxSites];
+static atomic_ulong lost;               // violations at sites not fitting into `sites`
+static atomic_ulong scopes;             // callbacks checked
+static bool abortOnViolation;
+
+static TLS int depth;                   // nesting of realtime scopes on this thread
+static TLS char const *current;         // the outermost callback of this thread
+static TLS bool reporting;              // the checker itself is calling
+
+
+/** Mark the calling thread as running a realtime callback, called by `cwASIO::RealtimeScope`. */
+void cwASIOrealtimeEnter(char const *callback) {
+    if(depth++ == 0) {
+        current = callback;
+        atomic_fetch_add_explicit(&scopes, 1, memory_order_relaxed);
+    }
+}
+
+/** End the innermost realtime scope of the calling thread. */
+void cwASIOrealtimeLeave(void) {
+    --depth;
+}
+
+static struct Site *find(void *caller) {
+    size_t start = ((uintptr_t)caller >> 2) % maxSites;
+    for(size_t i = 0; i < maxSites; ++i) {
+        struct Site *site = &sites[(start + i) % maxSites];
+        void *expected = NULL;
+        if(atomic_compare_exchange_strong(&site->caller, &expected, caller) || expected == caller)
+            return site;
+    }
+    return NULL;
+}
+
+static void violation(char const *what, void *caller) {
+    reporting = true;
+    struct Site *site = find(caller);
+    if(!site) {
+        atomic_fetch_add_explicit(&lost, 1, memory_order_relaxed);
+    } else if(atomic_fetch_add_explicit(&site->count, 1, memory_order_relaxed) == 0) {
+        site->what = what;
+        site->callback = current;
+        char line[256];
+        int n = snprintf(line, sizeof line, "cwASIO realtime check: %s in %s\n", what, current);
+        write(STDERR_FILENO, line, (size_t)n);
+        void *frames[32];
+        int count = backtrace(frames, 32);
+        backtrace_symbols_fd(frames + 1, count - 1, STDERR_FILENO);
+    }
+    if(abortOnViolation)
+        abort();
+    reporting = false;
+}
+
+#define CHECK(what) do { \
+        if(depth > 0 && !reporting) \
+            violation(what, __builtin_return_address(0)); \
+    } while(0)
+
+static void *resolve(void **fn, char const *name) {
+    void *f = __atomic_load_n(fn, __ATOMIC_ACQUIRE);
+    if(!f) {
+        f = dlsym(RTLD_NEXT, name);
+        __atomic_store_n(fn, f, __ATOMIC_RELEASE);
+    }
+    return f;
+}
+
+// call the next definition of a function, normally the one in the C library
+#define REAL(name) ({ static void *fn; (__typeof__(&name))resolve(&fn, #name); })
+
+__attribute__((constructor)) static void setup(void) {
+    char const *mode = getenv("CWASIO_RTCHECK");
+    abortOnViolation = mode && strcmp(mode, "abort") == 0;
+    void *frame;
+    backtrace(&frame, 1);       // loads the unwinder now, not in a callback
+}
+
+__attribute__((destructor)) static void summary(void) {
+    reporting = true;
+    unsigned long total = atomic_load(&lost), callbacks = atomic_load(&scopes);
+    unsigned count = 0;
+    for(size_t i = 0; i < maxSites; ++i) {
+        if(atomic_load(&sites[i].count) > 0) {
+            total += atomic_load(&sites[i].count);
+            ++count;
+        }
+    }
+    if(callbacks == 0) {
+        fprintf(stderr, "cwASIO realtime check: no callbacks checked, is the host built with CWASIO_REALTIME_CHECK?\n");
+        return;
+    }
+    if(total == 0) {
+        fprintf(stderr, "cwASIO realtime check: %lu callbacks, no violations\n", callbacks);
+        return;
+    }
+    fprintf(stderr, "cwASIO realtime check: %lu callbacks, %lu violations at %u call sites\n", callbacks, total, count);
+    for(size_t i = 0; i < maxSites; ++i) {
+        struct Site *site = &sites[i];
+        if(atomic_load(&site->count) == 0)
+            continue;
+        fprintf(stderr, "%10lu %s in %s, called from ", atomic_load(&site->count), site->what, site->callback);
+        fflush(stderr);
+        void *caller = atomic_load(&site->caller);
+        backtrace_symbols_fd(&caller, 1, STDERR_FILENO);
+    }
+    if(atomic_load(&lost) > 0)
+        fprintf(stderr, "%10lu at further call sites\n", atomic_load(&lost));
+}
+
+
+// memory
+
+void *malloc(size_t size) {
+    CHECK("malloc");
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    CHECK("calloc");
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    CHECK("realloc");
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    if(ptr)
+        CHECK("free");
+    __libc_free(ptr);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    CHECK("memalign");
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    CHECK("aligned_alloc");
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+    CHECK("posix_memalign");
+    if(alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    void *p = __libc_memalign(alignment, size);
+    if(!p)
+        return ENOMEM;
+    *ptr = p;
+    return 0;
+}
+
+// locks
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+    CHECK("pthread_mutex_lock");
+    return REAL(pthread_mutex_lock)(mutex);
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t *rwlock) {
+    CHECK("pthread_rwlock_rdlock");
+    return REAL(pthread_rwlock_rdlock)(rwlock);
+}
+
+int pthread_rwlock_wrlock(pthread_rwlock_t *rwlock) {
+    CHECK("pthread_rwlock_wrlock");
+    return REAL(pthread_rwlock_wrlock)(rwlock);
+}
+
+int sem_wait(sem_t *sem) {
+    CHECK("sem_wait");
+    return REAL(sem_wait)(sem);
+}
+
+int sem_timedwait(sem_t *sem, struct timespec const *timeout) {
+    CHECK("sem_timedwait");
+    return REAL(sem_timedwait)(sem, timeout);
+}
+
+// file I/O
+
+int open(char const *path, int flags, ...) {
+    CHECK("open");
+    va_list args;
+    va_start(args, flags);
+    mode_t mode = (flags & (O_CREAT | O_TMPFILE)) ? va_arg(args, mode_t) : 0;
+    va_end(args);
+    return REAL(open)(path, flags, mode);
+}
+
+int open64(char const *path, int flags, ...) {
+    CHECK("open64");
+    va_list args;
+    va_start(args, flags);
+    mode_t mode = (flags & (O_CREAT | O_TMPFILE)) ? va_arg(args, mode_t) : 0;
+    va_end(args);
+    return REAL(open64)(path, flags, mode);
+}
+
+int openat(int dirfd, char const *path, int flags, ...) {
+    CHECK("openat");
+    va_list args;
+    va_start(args, flags);
+    mode_t mode = (flags & (O_CREAT | O_TMPFILE)) ? va_arg(args, mode_t) : 0;
+    va_end(args);
+    return REAL(openat)(dirfd, path, flags, mode);
+}
+
+int close(int fd) {
+    CHECK("close");
+    return REAL(close)(fd);
+}
+
+ssize_t read(int fd, void *buf, size_t count) {
+    CHECK("read");
+    return REAL(read)(fd, buf, count);
+}
+
+ssize_t write(int fd, void const *buf, size_t count) {
+    CHECK("write");
+    return REAL(write)(fd, buf, count);
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+    CHECK("pread");
+    return REAL(pread)(fd, buf, count, offset);
+}
+
+ssize_t pwrite(int fd, void const *buf, size_t count, off_t offset) {
+    CHECK("pwrite");
+    return REAL(pwrite)(fd, buf, count, offset);
+}
+
+int fsync(int fd) {
+    CHECK("fsync");
+    return REAL(fsync)(fd);
+}
+
+int fdatasync(int fd) {
+    CHECK("fdatasync");
+    return REAL(fdatasync)(fd);
+}
+
+FILE *fopen(char const *path, char const *mode) {
+    CHECK("fopen");
+    return REAL(fopen)(path, mode);
+}
+
+int fclose(FILE *stream) {
+    CHECK("fclose");
+    return REAL(fclose)(stream);
+}
+
+size_t fread(void *ptr, size_t size, size_t count, FILE *stream) {
+    CHECK("fread");
+    return REAL(fread)(ptr, size, count, stream);
+}
+
+size_t fwrite(void const *ptr, size_t size, size_t count, FILE *stream) {
+    CHECK("fwrite");
+    return REAL(fwrite)(ptr, size, count, stream);
+}
+
+int fflush(FILE *stream) {
+    CHECK("fflush");
+    return REAL(fflush)(stream);
+}
+
+int fputs(char const *s, FILE *stream) {
+    CHECK("fputs");
+    return REAL(fputs)(s, stream);
+}
+
+int puts(char const *s) {
+    CHECK("puts");
+    return REAL(puts)(s);
+}
+
+int fputc(int c, FILE *stream) {
+    CHECK("fputc");
+    return REAL(fputc)(c, stream);
+}
+
+int putchar(int c) {
+    CHECK("putchar");
+    return REAL(putchar)(c);
+}
+
+int printf(char const *format, ...) {
+    CHECK("printf");
+    va_list args;
+    va_start(args, format);
+    int res = vfprintf(stdout, format, args);
+    va_end(args);
+    return res;
+}
+
+int fprintf(FILE *stream, char const *format, ...) {
+    CHECK("fprintf");
+    va_list args;
+    va_start(args, format);
+    int res = vfprintf(stream, format, args);
+    va_end(args);
+    return res;
+}
+
+// sleeping
+
+int nanosleep(struct timespec const *duration, struct timespec *remaining) {
+    CHECK("nanosleep");
+    return REAL(nanosleep)(duration, remaining);
+}
+
+int clock_nanosleep(clockid_t clock, int flags, struct timespec const *duration, struct timespec *remaining) {
+    CHECK("clock_nanosleep");
+    return REAL(clock_nanosleep)(clock, flags, duration, remaining);
+}
+
+int usleep(useconds_t usec) {
+    CHECK("usleep");
+    return REAL(usleep)(usec);
+}
+
+unsigned sleep(unsigned seconds) {
+    CHECK("sleep");
+    return REAL(sleep)(seconds);
+}
+
+int sched_yield(void) {
+    CHECK("sched_yield");
+    return REAL(sched_yield)();
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+    CHECK("poll");
+    return REAL(poll)(fds, nfds, timeout);
+}
+
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout) {
+    CHECK("select");
+    return REAL(select)(nfds, readfds, writefds, exceptfds, timeout);
+}
+
+/** @}*/
@@ -1,40 +1,260 @@
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
 #include <cstdio>
 #include <cstring>
 #include <limits>
+#include <new>
+#include <thread>
+#include <vector>
 #include "wavefile.hpp"
 
+#ifdef _WIN32
+    #define NOMINMAX
+    #include <windows.h>
+    #include <io.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
 #ifndef WAVE_FORMAT_PCM
     #define WAVE_FORMAT_PCM 1
 #endif
 
+#ifndef WAVE_FORMAT_IEEE_FLOAT
+    #define WAVE_FORMAT_IEEE_FLOAT 3
+#endif
+
 #ifndef WAVE_FORMAT_EXTENSIBLE
     #define WAVE_FORMAT_EXTENSIBLE 0xFFFE
 #endif
 
 const WaveFile::GUID KSDATAFORMAT_SUBTYPE_PCM { 0x00000001, 0x0000, 0x0010, { 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 } };
+const WaveFile::GUID KSDATAFORMAT_SUBTYPE_IEEE_FLOAT { 0x00000003, 0x0000, 0x0010, { 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 } };
 
 using namespace std::string_literals;
 
+// State of the asynchronous writer. The producer fills the buffers of the ring in turn, and hands
+// each full one to the writer thread by advancing `filled`. The writer advances `written` when it
+// has put a buffer into the file. Buffer `n` covers the file from offset `n * blockBytes`, hence
+// the first one starts with an image of the headers.
+struct WaveFile::AsyncWriter {
+    static constexpr size_t alignment = 4096;                   // for O_DIRECT
+
+    size_t blockBytes = 0;
+    std::vector<std::byte *> buffers;
+    size_t fill = 0;                                // bytes in the buffer being filled, producer only
+    std::atomic<unsigned long long> filled { 0 };   // buffers handed to the writer
+    std::atomic<unsigned long long> written { 0 };  // buffers put into the file
+    std::atomic<unsigned long long> final { 0 };    // total number of buffers, once closing
+    size_t tail = 0;                                // bytes in the final buffer
+    std::atomic<bool> failed { false };
+    std::string error;                              // valid once `failed` is set
+    unsigned long long extent = 0;                  // preallocation granularity, 0 for none
+    unsigned long long preallocated = 0;
+#ifdef _WIN32
+    FILE *fp = NULL;
+#else
+    int fd = -1;
+    bool direct = false;
+#endif
+    std::thread thread;
+
+    ~AsyncWriter ( ) {
+        for ( std::byte *b : buffers ) {
+            ::operator delete ( b, std::align_val_t ( alignment ) );
+        }
+#ifndef _WIN32
+        if ( fd >= 0 ) {
+            ::close ( fd );
+        }
+#endif
+    }
+
+    std::string put ( std::byte *data, size_t length, unsigned long long offset ) {
+#ifdef _WIN32
+        if ( _fseeki64 ( fp, static_cast<long long> ( offset ), SEEK_SET ) != 0 || fwrite ( data, 1, length, fp ) != length ) {
+            return "Error writing data to file.";
+        }
+#else
+    #ifdef __linux__
+        // preallocate in large extents beyond the end of the file, so the file doesn't fragment
+        while ( extent != 0 && offset + length > preallocated ) {
+            if ( fallocate ( fd, FALLOC_FL_KEEP_SIZE, static_cast<off_t> ( preallocated ), static_cast<off_t> ( extent ) ) != 0 ) {
+                if ( errno == ENOSPC ) {
+                    return "Error writing data to file: "s + strerror ( errno );
+                }
+                preallocated = std::numeric_limits<unsigned long long>::max ( );    // not supported, don't retry
+                break;
+            }
+            preallocated += extent;
+        }
+    #endif
+        if ( direct ) {
+            // O_DIRECT only writes whole blocks, the excess is truncated when closing
+            size_t padded = ( length + alignment - 1 ) & ~( alignment - 1 );
+            memset ( data + length, 0, padded - length );
+            length = padded;
+        }
+        while ( length > 0 ) {
+            ssize_t n = pwrite ( fd, data, length, static_cast<off_t> ( offset ) );
+            if ( n < 0 ) {
+                if ( errno == EINTR ) {
+                    continue;
+                }
+                return "Error writing data to file: "s + strerror ( errno );
+            }
+            data += n;
+            length -= static_cast<size_t> ( n );
+            offset += static_cast<unsigned long long> ( n );
+        }
+#endif
+        return "";
+    }
+};
+
+
+namespace {
+    // frames per chunk of typed reading
+    size_t const chunkFrames = 1024;
+
+    // Decoding kernels, from one channel of interleaved samples to float, `stride` is the size of a frame in bytes.
+    // The loops don't branch, so that the compiler can vectorize them.
+    using Decoder = void ( * ) ( std::byte const *src, size_t stride, float *dst, size_t count );
+
+    void decodeInt16 ( std::byte const *src, size_t stride, float *dst, size_t count ) {
+        for ( size_t i = 0; i < count; ++i ) {
+            int16_t v;
+            memcpy ( &v, src + i * stride, sizeof ( v ) );
+            dst[i] = float ( v ) * ( 1.f / 32768.f );
+        }
+    }
+
+    void decodeInt24 ( std::byte const *src, size_t stride, float *dst, size_t count ) {
+        for ( size_t i = 0; i < count; ++i ) {
+            uint8_t const *p = reinterpret_cast<uint8_t const *> ( src + i * stride );
+            int32_t v = int32_t ( uint32_t ( p[0] ) << 8 | uint32_t ( p[1] ) << 16 | uint32_t ( p[2] ) << 24 );
+            dst[i] = float ( v ) * ( 1.f / 2147483648.f );
+        }
+    }
+
+    void decodeInt32 ( std::byte const *src, size_t stride, float *dst, size_t count ) {
+        for ( size_t i = 0; i < count; ++i ) {
+            int32_t v;
+            memcpy ( &v, src + i * stride, sizeof ( v ) );
+            dst[i] = float ( v ) * ( 1.f / 2147483648.f );
+        }
+    }
+
+    void decodeFloat32 ( std::byte const *src, size_t stride, float *dst, size_t count ) {
+        for ( size_t i = 0; i < count; ++i ) {
+            memcpy ( &dst[i], src + i * stride, sizeof ( float ) );
+        }
+    }
+
+    void decodeFloat64 ( std::byte const *src, size_t stride, float *dst, size_t count ) {
+        for ( size_t i = 0; i < count; ++i ) {
+            double v;
+            memcpy ( &v, src + i * stride, sizeof ( v ) );
+            dst[i] = float ( v );
+        }
+    }
+
+    // Encoding kernels, from float to a contiguous buffer of samples, with saturation.
+    using Encoder = void ( * ) ( float const *src, std::byte *dst, size_t count );
+
+    inline int32_t toInt32 ( float v ) {
+        return int32_t ( std::clamp ( v * 2147483648.f, -2147483648.f, 2147483520.f ) );   // the largest float below 2^31
+    }
+
+    void encodeInt16 ( float const *src, std::byte *dst, size_t count ) {
+        for ( size_t i = 0; i < count; ++i ) {
+            int16_t v = int16_t ( toInt32 ( src[i] ) >> 16 );
+            memcpy ( dst + 2 * i, &v, sizeof ( v ) );
+        }
+    }
+
+    void encodeInt24 ( float const *src, std::byte *dst, size_t count ) {
+        for ( size_t i = 0; i < count; ++i ) {
+            uint32_t v = uint32_t ( toInt32 ( src[i] ) );
+            dst[3 * i] = std::byte ( v >> 8 );
+            dst[3 * i + 1] = std::byte ( v >> 16 );
+            dst[3 * i + 2] = std::byte ( v >> 24 );
+        }
+    }
+
+    void encodeInt32 ( float const *src, std::byte *dst, size_t count ) {
+        for ( size_t i = 0; i < count; ++i ) {
+            int32_t v = toInt32 ( src[i] );
+            memcpy ( dst + 4 * i, &v, sizeof ( v ) );
+        }
+    }
+
+    void encodeFloat32 ( float const *src, std::byte *dst, size_t count ) {
+        memcpy ( dst, src, count * sizeof ( float ) );
+    }
+
+    void encodeFloat64 ( float const *src, std::byte *dst, size_t count ) {
+        for ( size_t i = 0; i < count; ++i ) {
+            double v = src[i];
+            memcpy ( dst + 8 * i, &v, sizeof ( v ) );
+        }
+    }
+
+    struct Codec {
+        cwASIOSampleType type;
+        unsigned bits;
+        bool isFloat;
+        Decoder decode;
+        Encoder encode;
+    };
+
+    Codec const codecs[] = {
+        { ASIOSTInt16LSB, 16, false, decodeInt16, encodeInt16 },
+        { ASIOSTInt24LSB, 24, false, decodeInt24, encodeInt24 },
+        { ASIOSTInt32LSB, 32, false, decodeInt32, encodeInt32 },
+        { ASIOSTFloat32LSB, 32, true, decodeFloat32, encodeFloat32 },
+        { ASIOSTFloat64LSB, 64, true, decodeFloat64, encodeFloat64 }
+    };
+
+    Codec const *codecOf ( cwASIOSampleType type ) {
+        for ( Codec const &c : codecs ) {
+            if ( c.type == type ) {
+                return &c;
+            }
+        }
+        return NULL;
+    }
+}
+
 
 WaveFile::WaveFile ( )
   : fp_ ( NULL ),
     samplerate_ ( 0 ),
     bitsPerSample_ ( 0 ),
     channels_ ( 0 ),
+    isFloat_ ( false ),
     samples_ ( 0 ),
     readNotWrite_ ( true ),
     dataLength_ ( 0 ),
-    startOfData_ ( 0 )
+    startOfData_ ( 0 ),
+    map_ ( NULL ),
+    mapLength_ ( 0 ),
+    mapHandle_ ( NULL ),
+    readahead_ ( 4 << 20 ),
+    prefetchBegin_ ( 0 ),
+    prefetchEnd_ ( 0 ),
+    headerInterval_ ( 1.0 )
 {
 }
 
 WaveFile::~WaveFile ( ) {
-    if ( ( fp_ == NULL ) || readNotWrite_ ) {
-        return;
-    }
-
-    writeHeaders ( fp_, bitsPerSample_, samplerate_, channels_, samples_ );
+    close ( );
 }
 
 std::string WaveFile::writeHeaders ( FILE *fp, unsigned long bitsPerSample, unsigned long samplerate, unsigned long channels, unsigned long long samplesWritten ) {
@@ -76,7 +296,6 @@ std::string WaveFile::writeHeaders ( FILE *fp, unsigned long bitsPerSample, unsi
     wh.chunk_type[3] = 'E';
 
     if ( fwrite ( &wh, sizeof ( WAVFILE_HEADER ), 1, fp ) != 1 ) {
-        fclose ( fp );
         return "Error writing Wave-Header to file.";
     }
 
@@ -99,7 +318,6 @@ std::string WaveFile::writeHeaders ( FILE *fp, unsigned long bitsPerSample, unsi
     }
 
     if ( fwrite ( &ds64, sizeof ( WAVFILE_DS64CHUNK ), 1, fp ) != 1 ) {
-        fclose ( fp );
         if ( makeRf64 ) {
             return "Error writing ds64-Chunk to file.";
         } else {
@@ -114,7 +332,7 @@ std::string WaveFile::writeHeaders ( FILE *fp, unsigned long bitsPerSample, unsi
     fmt.fmt_chunk[2] = 't';
     fmt.fmt_chunk[3] = ' ';
     fmt.fmt_length = sizeof ( WAVFILE_FMTCHUNK ) - sizeof ( WAVFILE_CHUNK );
-    fmt.formatTag = 1; // PCM = linear
+    fmt.formatTag = isFloat_ ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
     fmt.nChannels = static_cast<short> ( channels );
     fmt.nSamplesPerSec = static_cast<long> ( samplerate );
     fmt.nBitsPerSample = static_cast<short> ( bitsPerSample );
@@ -122,7 +340,6 @@ std::string WaveFile::writeHeaders ( FILE *fp, unsigned long bitsPerSample, unsi
     fmt.nBlockAlign = static_cast<short> ( bytesPerSample ) * fmt.nChannels;
 
     if ( fwrite ( &fmt, sizeof ( WAVFILE_FMTCHUNK ), 1, fp ) != 1 ) {
-        fclose ( fp );
         return "Error writing Format-Chunk to file.";
     }
 
@@ -139,210 +356,492 @@ std::string WaveFile::writeHeaders ( FILE *fp, unsigned long bitsPerSample, unsi
     }
 
     if ( fwrite ( &data, sizeof ( WAVFILE_CHUNK ), 1, fp ) != 1 ) {
-        fclose ( fp );
         return "Error writing Data-Chunk-Header to file.";
     }
 
-    long startOfData = ftell ( fp );
+    return "";
+}
 
-    if ( startOfData == -1 ) {
-        fclose ( fp );
-        return "Error retreiving file position.";
+// Read from the given file offset in one call where possible, returns the number of bytes read.
+static size_t readAt ( FILE* fp, unsigned long long offset, void *data, size_t size ) {
+#ifdef _WIN32
+    if ( _fseeki64 ( fp, static_cast<long long> ( offset ), SEEK_SET ) != 0 ) {
+        return 0;
     }
 
-    samplerate_ = samplerate;
-    bitsPerSample_ = bitsPerSample;
-    channels_ = channels;
-    startOfData_ = startOfData;
+    return fread ( data, 1, size, fp );
+#else
+    size_t done = 0;
 
-    return "";
+    while ( done < size ) {
+        ssize_t n = pread ( fileno ( fp ), static_cast<char *> ( data ) + done, size - done, static_cast<off_t> ( offset + done ) );
+        if ( n < 0 && errno == EINTR ) {
+            continue;
+        }
+        if ( n <= 0 ) {
+            break;
+        }
+        done += static_cast<size_t> ( n );
+    }
+
+    return done;
+#endif
 }
 
 std::string WaveFile::readHeaders ( FILE* fp ) {
-    if ( fseek ( fp, 0, SEEK_SET ) != 0 ) {
-        return "Error positioning file to start of file.";
-    }
+    // The headers normally fit into the first block of the file, which is read in one go. Chunks
+    // beyond it are read individually.
+    static size_t const headerBlockSize = 64 << 10;
+    std::vector<char> block ( headerBlockSize );
+    block.resize ( readAt ( fp, 0, block.data ( ), block.size ( ) ) );
+
+    auto fetch = [&] ( unsigned long long offset, void *data, size_t size ) {
+        if ( offset + size <= block.size ( ) ) {
+            memcpy ( data, block.data ( ) + offset, size );
+            return true;
+        }
+        return readAt ( fp, offset, data, size ) == size;
+    };
 
     WAVFILE_HEADER wh;
 
-    if ( fread ( &wh, sizeof ( WAVFILE_HEADER ), 1, fp ) != 1 ) {
-        fclose ( fp );
+    if ( !fetch ( 0, &wh, sizeof ( WAVFILE_HEADER ) ) ) {
         return "Error reading Wave-Header from file.";
     }
 
     if ( strncmp ( wh.chunk_type, "WAVE", sizeof ( wh.chunk_type ) ) != 0 ) {
-        fclose ( fp );
         return "Error in Wave-Header: Chunk type incorrect.";
     }
 
     if ( strncmp ( wh.main_chunk, "RIFF", sizeof ( wh.main_chunk ) ) != 0 && strncmp ( wh.main_chunk, "RF64", sizeof ( wh.main_chunk ) ) != 0 ) {
-        fclose ( fp );
         return "Error in Wave-Header: Main chunk incorrect.";
     }
 
-    bool isRf64 = false;
+    bool isRf64 = strncmp ( wh.main_chunk, "RF64", sizeof ( wh.main_chunk ) ) == 0;
+    bool haveDs64 = false;
+    bool haveFmt = false;
+    bool isFloat = false;
     WAVFILE_DS64CHUNK ds64 = { 0 };
-    if ( strncmp ( wh.main_chunk, "RF64", sizeof ( wh.main_chunk ) ) == 0 ) {
-        isRf64 = true;
+    WAVFILE_FMTCHUNK fmt = { 0 };
 
-        std::string result = searchChunk ( fp, "ds64" );
+    // walk the chunks up to the data chunk, which is the last one we need
+    for ( unsigned long long offset = sizeof ( WAVFILE_HEADER );; ) {
+        WAVFILE_CHUNK chunk;
 
-        if ( !result.empty ( ) ) {
-            return result;
+        if ( !fetch ( offset, &chunk, sizeof ( WAVFILE_CHUNK ) ) ) {
+            if ( isRf64 && !haveDs64 ) {
+                return "Error reading ds64-Chunk from file.";
+            }
+            return haveFmt ? "Error reading Data-Chunk-Header from file." : "Error reading Format-Chunk from file.";
         }
 
-        if ( fread ( &ds64, sizeof ( WAVFILE_DS64CHUNK ), 1, fp ) != 1 ) {
-            fclose ( fp );
-            return "Error reading ds64-Chunk from file.";
+        if ( strncmp ( chunk.chunk, "ds64", sizeof ( chunk.chunk ) ) == 0 ) {
+            if ( !fetch ( offset, &ds64, std::min<size_t> ( sizeof ( WAVFILE_DS64CHUNK ), sizeof ( WAVFILE_CHUNK ) + chunk.length ) ) ) {
+                return "Error reading ds64-Chunk from file.";
+            }
+            haveDs64 = true;
+        } else if ( strncmp ( chunk.chunk, "fmt ", sizeof ( chunk.chunk ) ) == 0 ) {
+            if ( chunk.length < sizeof ( WAVFILE_FMTCHUNK ) - sizeof ( WAVFILE_CHUNK ) || !fetch ( offset, &fmt, sizeof ( WAVFILE_FMTCHUNK ) ) ) {
+                return "Error reading Format-Chunk from file.";
+            }
+
+            isFloat = fmt.formatTag == WAVE_FORMAT_IEEE_FLOAT;
+
+            if ( fmt.formatTag != WAVE_FORMAT_PCM && !isFloat ) {
+                if ( fmt.formatTag != WAVE_FORMAT_EXTENSIBLE ) {
+                    return "Error in Format-Chunk: No WAVE_FORMAT_PCM file.";
+                }
+
+                // WAVEFORMATEXTENSIBLE: cbSize, wValidBitsPerSample and dwChannelMask precede the sub format
+                GUID subFormat;
+                if ( chunk.length < 40 || !fetch ( offset + sizeof ( WAVFILE_FMTCHUNK ) + 8, &subFormat, sizeof ( GUID ) ) ) {
+                    return "Error reading Format-Chunk from file.";
+                }
+
+                isFloat = memcmp ( &subFormat, &KSDATAFORMAT_SUBTYPE_IEEE_FLOAT, sizeof ( WaveFile::GUID ) ) == 0;
+
+                if ( !isFloat && memcmp ( &subFormat, &KSDATAFORMAT_SUBTYPE_PCM, sizeof ( WaveFile::GUID ) ) != 0 ) {
+                    return "Error in Format-Chunk: No WAVE_FORMAT_PCM file.";
+                }
+            }
+            haveFmt = true;
+        } else if ( strncmp ( chunk.chunk, "data", sizeof ( chunk.chunk ) ) == 0 ) {
+            if ( isRf64 && !haveDs64 ) {
+                return "Error reading ds64-Chunk from file.";
+            }
+            if ( !haveFmt ) {
+                return "Error reading Format-Chunk from file.";
+            }
+
+            samplerate_ = static_cast<unsigned long> ( fmt.nSamplesPerSec );
+            bitsPerSample_ = static_cast<unsigned long> ( fmt.nBitsPerSample );
+            channels_ = static_cast<unsigned long> ( fmt.nChannels );
+            isFloat_ = isFloat;
+            dataLength_ = isRf64 ? ds64.dataSize : chunk.length;
+            startOfData_ = static_cast<unsigned long> ( offset + sizeof ( WAVFILE_CHUNK ) );
+            break;
         }
+
+        // chunks are padded to an even length
+        offset += sizeof ( WAVFILE_CHUNK ) + chunk.length + ( chunk.length & 1 );
+    }
+
+    if ( fseek ( fp, static_cast<long> ( startOfData_ ), SEEK_SET ) != 0 ) {
+        return "Error setting file position.";
+    }
+
+    return "";
+}
+
+std::string WaveFile::open ( std::filesystem::path filename, unsigned long samplerate, unsigned long bitsPerSample, unsigned long channels, bool isFloat ) {
+    isFloat_ = isFloat;
+    FILE* fp = fopen ( filename.string().c_str(), "wb" );
+
+    if ( fp == NULL ) {
+        return "Error opening file \"" + filename.string() + "\".";
     }
 
-    std::string result = searchChunk ( fp, "fmt " );
+    std::string result = writeHeaders ( fp, bitsPerSample, samplerate, channels, 0 );
 
     if ( !result.empty ( ) ) {
+        fclose ( fp );
         return result;
     }
 
-    WAVFILE_FMTCHUNK fmt;
+    long startOfData = ftell ( fp );
 
-    if ( fread ( &fmt, sizeof ( WAVFILE_FMTCHUNK ), 1, fp ) != 1 ) {
+    if ( startOfData == -1 ) {
         fclose ( fp );
-        return "Error reading Format-Chunk from file.";
+        return "Error retreiving file position.";
     }
 
-    if ( fmt.formatTag != WAVE_FORMAT_PCM ) {
-        if ( fmt.formatTag != WAVE_FORMAT_EXTENSIBLE ) {
-            fclose ( fp );
-            return "Error in Format-Chunk: No WAVE_FORMAT_PCM file.";
-        }
+    samplerate_ = samplerate;
+    bitsPerSample_ = bitsPerSample;
+    channels_ = channels;
+    startOfData_ = startOfData;
+    fp_ = fp;
+    filename_ = filename.string();
+    samples_ = 0;
+    readNotWrite_ = false;
+    dataLength_ = 0;
 
-        WAVFILEEXT_FMTCHUNKEXT fmtext;
-        if ( fread ( &fmtext, sizeof ( WAVFILEEXT_FMTCHUNKEXT ), 1, fp ) != 1 ) {
-            fclose ( fp );
-            return "Error reading Format-Chunk from file.";
-        }
+    return "";
+}
 
-        if ( memcmp ( &fmtext.SubFormat, &KSDATAFORMAT_SUBTYPE_PCM, sizeof ( WaveFile::GUID ) ) != 0 ) {
-            fclose ( fp );
-            return "Error in Format-Chunk: No WAVE_FORMAT_PCM file.";
-        }
+std::string WaveFile::open ( std::filesystem::path filename) {
+    FILE* fp = fopen ( filename.string().c_str(), "rb" );
+
+    if ( fp == NULL ) {
+        return "Error opening file \"" + filename.string() + "\".";
     }
 
-    result = searchChunk ( fp, "data" );
+    std::string result = readHeaders ( fp );
 
     if ( !result.empty ( ) ) {
+        fclose ( fp );
         return result;
     }
 
-    WAVFILE_CHUNK data;
+    fp_ = fp;
+    filename_ = filename.string();
+    samples_ = 0;
+    readNotWrite_ = true;
+    chunk_.resize ( chunkFrames * getBytesPerSample ( ) * channels_ );
+    decoded_.resize ( chunkFrames );
 
-    if ( fread ( &data, sizeof ( WAVFILE_CHUNK ), 1, fp ) != 1 ) {
-        fclose ( fp );
-        return "Error reading Data-Chunk-Header from file.";
-    }
+    return "";
+}
 
-    long startOfData = ftell ( fp );
+std::string WaveFile::openMapped ( std::filesystem::path filename ) {
+    std::string result = open ( filename );
 
-    if ( startOfData == -1 ) {
-        fclose ( fp );
-        return "Error retreiving file position.";
+    if ( !result.empty ( ) ) {
+        return result;
     }
 
-    samplerate_ = static_cast<unsigned long> ( fmt.nSamplesPerSec );
-    bitsPerSample_ = static_cast<unsigned long> ( fmt.nBitsPerSample );
-    channels_ = static_cast<unsigned long> ( fmt.nChannels );
-    dataLength_ = isRf64 ? ds64.dataSize : data.length;
-    startOfData_ = startOfData;
+    result = mapData ( );
+
+    if ( !result.empty ( ) ) {
+        close ( );
+        return result;
+    }
 
     return "";
 }
 
-std::string WaveFile::searchChunk ( FILE* fp, const char *identifier ) {
-    struct DUMMY_HEADER {
-        char			id[4];
-        uint32_t	length;
+std::string WaveFile::mapData ( ) {
+    unsigned long long fileLength = 0;
+#ifdef _WIN32
+    HANDLE file = reinterpret_cast<HANDLE> ( _get_osfhandle ( _fileno ( fp_ ) ) );
+    LARGE_INTEGER size;
+
+    if ( !GetFileSizeEx ( file, &size ) ) {
+        return "Error retrieving file size.";
+    }
 
-    } dummyHeader;
+    fileLength = static_cast<unsigned long long> ( size.QuadPart );
+#else
+    struct stat st;
 
-    if ( fp == NULL ) {		// file is not open
-        return "Error file is not open.";
+    if ( fstat ( fileno ( fp_ ), &st ) != 0 ) {
+        return "Error retrieving file size.";
     }
 
-    long long currentPos = ftell ( fp );
+    fileLength = static_cast<unsigned long long> ( st.st_size );
+#endif
 
-    if ( currentPos == -1 ) {
-        return "Error reading file position.";
+    if ( fileLength < startOfData_ ) {
+        return "Error in Data-Chunk: File is truncated.";
     }
 
-    if ( fseek ( fp, sizeof ( WAVFILE_HEADER ), SEEK_SET ) != 0 ) {
-        return "Error setting file position.";
+    // a truncated recording may claim more data than there is
+    if ( dataLength_ > fileLength - startOfData_ ) {
+        dataLength_ = fileLength - startOfData_;
     }
 
-    for ( ;; ) {
-        if ( fread ( &dummyHeader, sizeof ( dummyHeader ), 1, fp ) != 1 ) {
-            return "Error reading from file.";
-        }
+    if ( static_cast<unsigned long long> ( static_cast<size_t> ( fileLength ) ) != fileLength ) {
+        return "Error file too large for mapping into memory.";
+    }
 
-        if ( strncmp ( dummyHeader.id, identifier, sizeof ( dummyHeader.id ) ) == 0 ) {
-            // we have found the chunk
-            long long offset = 0LL - sizeof ( dummyHeader );
-            if ( fseek ( fp, offset, SEEK_CUR ) != 0 ) {
-                fseek ( fp, currentPos, SEEK_SET );
-                return "Error setting file position.";
-            }
+    if ( dataLength_ == 0 ) {
+        return "";  // nothing to map, view ( ) returns empty spans
+    }
 
-            return "";
-        }
+    mapLength_ = static_cast<size_t> ( startOfData_ + dataLength_ );
+#ifdef _WIN32
+    HANDLE mapping = CreateFileMappingA ( file, NULL, PAGE_READONLY, 0, 0, NULL );
 
-        long long headerLength = dummyHeader.length;
-        if ( fseek ( fp, headerLength, SEEK_CUR ) != 0 ) {
-            fseek ( fp, currentPos, SEEK_SET );
-            return "Error setting file position.";
-        }
+    if ( mapping == NULL ) {
+        return "Error mapping file \"" + filename_ + "\" into memory.";
+    }
+
+    void *p = MapViewOfFile ( mapping, FILE_MAP_READ, 0, 0, mapLength_ );
+
+    if ( p == NULL ) {
+        CloseHandle ( mapping );
+        return "Error mapping file \"" + filename_ + "\" into memory.";
+    }
+
+    mapHandle_ = mapping;
+#else
+    void *p = mmap ( NULL, mapLength_, PROT_READ, MAP_SHARED, fileno ( fp_ ), 0 );
+
+    if ( p == MAP_FAILED ) {
+        return "Error mapping file \"" + filename_ + "\" into memory.";
     }
+
+    madvise ( p, mapLength_, MADV_SEQUENTIAL );
+#endif
+    map_ = static_cast<std::byte const *> ( p );
+    prefetchBegin_ = prefetchEnd_ = 0;
+
+    return "";
 }
 
-std::string WaveFile::open ( std::filesystem::path filename, unsigned long samplerate, unsigned long bitsPerSample, unsigned long channels ) {
-    FILE* fp = fopen ( filename.string().c_str(), "wb" );
+void WaveFile::unmapData ( ) {
+    if ( map_ == NULL ) {
+        return;
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile ( map_ );
+    CloseHandle ( static_cast<HANDLE> ( mapHandle_ ) );
+    mapHandle_ = NULL;
+#else
+    munmap ( const_cast<std::byte *> ( map_ ), mapLength_ );
+#endif
+    map_ = NULL;
+    mapLength_ = 0;
+}
+
+void WaveFile::prefetch ( unsigned long long offset ) {
+    // start a new window when the position jumped, or advance the window when half of it is used up
+    if ( offset >= prefetchBegin_ && offset + readahead_ / 2 < prefetchEnd_ ) {
+        return;
+    }
+
+    if ( offset < prefetchBegin_ || offset > prefetchEnd_ ) {
+        prefetchEnd_ = offset;
+    }
+
+    prefetchBegin_ = offset;
+    unsigned long long end = std::min<unsigned long long> ( offset + readahead_, mapLength_ );
+
+    if ( prefetchEnd_ >= end ) {
+        return;
+    }
+
+#ifndef _WIN32
+    static unsigned long long const page = static_cast<unsigned long long> ( sysconf ( _SC_PAGESIZE ) );
+    unsigned long long begin = prefetchEnd_ & ~( page - 1 );
+    madvise ( const_cast<std::byte *> ( map_ ) + begin, static_cast<size_t> ( end - begin ), MADV_WILLNEED );
+#endif
+    prefetchEnd_ = end;
+}
+
+std::span<std::byte const> WaveFile::view ( unsigned long samples ) {
+    if ( map_ == NULL ) {
+        return { };
+    }
+
+    size_t blocksize = static_cast<size_t> ( getBytesPerSample ( ) * channels_ );
+    unsigned long long samplesInFile = getTotalSamples ( );
+    assert(samplesInFile >= samples_);
+    unsigned long long samplesToRead = samplesInFile - samples_;
+    if (samplesToRead > samples) {
+        samplesToRead = samples;
+    }
+
+    unsigned long long offset = startOfData_ + samples_ * blocksize;
+    prefetch ( offset );
+    samples_ += samplesToRead;     // the file position isn't used while mapped
+
+    return { map_ + offset, static_cast<size_t> ( samplesToRead * blocksize ) };
+}
+
+std::string WaveFile::openAsync ( std::filesystem::path filename, unsigned long samplerate, unsigned long bitsPerSample, unsigned long channels,
+                                  bool isFloat, size_t bufferBytes, unsigned buffers, unsigned long long extent ) {
+    isFloat_ = isFloat;
+    FILE* fp = fopen ( filename.string().c_str(), "w+b" );
 
     if ( fp == NULL ) {
         return "Error opening file \"" + filename.string() + "\".";
     }
 
     std::string result = writeHeaders ( fp, bitsPerSample, samplerate, channels, 0 );
+    long startOfData = ftell ( fp );
+
+    if ( result.empty ( ) && startOfData == -1 ) {
+        result = "Error retreiving file position.";
+    }
 
     if ( !result.empty ( ) ) {
+        fclose ( fp );
         return result;
     }
 
+    std::unique_ptr<AsyncWriter> writer = std::make_unique<AsyncWriter> ( );
+    writer->blockBytes = std::max ( ( bufferBytes + AsyncWriter::alignment - 1 ) & ~( AsyncWriter::alignment - 1 ), AsyncWriter::alignment );
+    writer->extent = extent;
+    for ( unsigned i = 0; i < std::max ( buffers, 2u ); ++i ) {
+        writer->buffers.push_back ( static_cast<std::byte *> ( ::operator new ( writer->blockBytes, std::align_val_t ( AsyncWriter::alignment ) ) ) );
+    }
+
+    // the first buffer starts with the headers
+    if ( fflush ( fp ) != 0 || fseek ( fp, 0, SEEK_SET ) != 0 || fread ( writer->buffers[0], 1, startOfData, fp ) != static_cast<size_t> ( startOfData ) ) {
+        fclose ( fp );
+        return "Error reading back headers of file \"" + filename.string() + "\".";
+    }
+    writer->fill = static_cast<size_t> ( startOfData );
+
+#ifdef _WIN32
+    writer->fp = fp;
+#else
+    #ifdef O_DIRECT
+    writer->fd = ::open ( filename.string().c_str(), O_WRONLY | O_CLOEXEC | O_DIRECT );
+    writer->direct = writer->fd >= 0;
+    #endif
+    if ( writer->fd < 0 ) {     // the file system may not support O_DIRECT
+        writer->fd = ::open ( filename.string().c_str(), O_WRONLY | O_CLOEXEC );
+    }
+
+    if ( writer->fd < 0 ) {
+        fclose ( fp );
+        return "Error opening file \"" + filename.string() + "\".";
+    }
+#endif
+
     fp_ = fp;
     filename_ = filename.string();
+    samplerate_ = samplerate;
+    bitsPerSample_ = bitsPerSample;
+    channels_ = channels;
+    startOfData_ = startOfData;
     samples_ = 0;
     readNotWrite_ = false;
     dataLength_ = 0;
+    async_ = std::move ( writer );
+    async_->thread = std::thread ( &WaveFile::runAsyncWriter, this );
 
     return "";
 }
 
-std::string WaveFile::open ( std::filesystem::path filename) {
-    FILE* fp = fopen ( filename.string().c_str(), "rb" );
+void WaveFile::runAsyncWriter ( ) {
+    AsyncWriter &w = *async_;
+    size_t frame = static_cast<size_t> ( getBytesPerSample ( ) * channels_ );
+    auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration> ( std::chrono::duration<double> ( headerInterval_ ) );
+    auto lastHeader = std::chrono::steady_clock::now ( );
 
-    if ( fp == NULL ) {
-        return "Error opening file \"" + filename.string() + "\".";
-    }
+    for ( unsigned long long block = 0;; ) {
+        unsigned long long filled = w.filled.load ( std::memory_order_acquire );
+        unsigned long long final = w.final.load ( std::memory_order_acquire );
 
-    std::string result = readHeaders ( fp );
+        if ( block == filled ) {
+            if ( final != 0 && block == final ) {
+                return;
+            }
+            w.filled.wait ( filled, std::memory_order_acquire );
+            continue;
+        }
 
-    if ( !result.empty ( ) ) {
-        return result;
+        size_t length = block + 1 == final ? w.tail : w.blockBytes;
+        unsigned long long offset = block * w.blockBytes;
+
+        if ( !w.failed.load ( std::memory_order_relaxed ) ) {
+            std::string result = w.put ( w.buffers[block % w.buffers.size ( )], length, offset );
+
+            if ( !result.empty ( ) ) {
+                w.error = result;
+                w.failed.store ( true, std::memory_order_release );
+            }
+        }
+
+        w.written.store ( ++block, std::memory_order_release );
+        w.written.notify_one ( );
+
+        // keep the headers up to date, so that the file is usable even if the recording is interrupted
+        auto now = std::chrono::steady_clock::now ( );
+        if ( block != final && now - lastHeader >= interval && !w.failed.load ( std::memory_order_relaxed ) ) {
+            unsigned long long samples = ( offset + length - startOfData_ ) / frame;
+            if ( writeHeaders ( fp_, bitsPerSample_, samplerate_, channels_, samples ).empty ( ) ) {
+                fflush ( fp_ );
+            }
+            lastHeader = now;
+        }
     }
+}
 
-    fp_ = fp;
-    filename_ = filename.string();
-    samples_ = 0;
-    readNotWrite_ = true;
+std::string WaveFile::finishAsync ( ) {
+    AsyncWriter &w = *async_;
+
+    // hand over the partially filled buffer as the final one
+    unsigned long long block = w.filled.load ( std::memory_order_relaxed );
+    w.tail = w.fill;
+    w.final.store ( block + 1, std::memory_order_release );
+    w.filled.store ( block + 1, std::memory_order_release );
+    w.filled.notify_one ( );
+    w.thread.join ( );
+
+    std::string result = w.failed.load ( std::memory_order_acquire ) ? w.error : "";
+    unsigned long long length = startOfData_ + dataLength_;
+#ifdef __linux__
+    // release the preallocated space beyond the end, which truncating doesn't do on every file system
+    if ( w.preallocated > length && w.preallocated != std::numeric_limits<unsigned long long>::max ( ) ) {
+        fallocate ( w.fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off_t> ( length ), static_cast<off_t> ( w.preallocated - length ) );
+    }
+#endif
+#ifdef _WIN32
+    if ( fflush ( fp_ ) != 0 || _chsize_s ( _fileno ( fp_ ), static_cast<long long> ( length ) ) != 0 ) {
+#else
+    if ( ftruncate ( w.fd, static_cast<off_t> ( length ) ) != 0 ) {
+#endif
+        if ( result.empty ( ) ) {
+            result = "Error truncating file \"" + filename_ + "\".";
+        }
+    }
 
-    return "";
+    async_.reset ( );
+    return result;
 }
 
 std::string WaveFile::close ( ) {
@@ -350,16 +849,24 @@ std::string WaveFile::close ( ) {
         return "";
     }
 
+    unmapData ( );
+
+    std::string result;
+
+    if ( async_ ) {
+        result = finishAsync ( );
+    }
+
     if ( !readNotWrite_ ) {
-        std::string result = writeHeaders ( fp_, bitsPerSample_, samplerate_, channels_, samples_ );
+        std::string res = writeHeaders ( fp_, bitsPerSample_, samplerate_, channels_, samples_ );
 
-        if ( !result.empty ( ) ) {
-            return result;
+        if ( result.empty ( ) ) {
+            result = res;
         }
     }
 
-    if ( fclose ( fp_ ) != 0 ) {
-        return "Error closing file \""s + filename_ + "\".";
+    if ( fclose ( fp_ ) != 0 && result.empty ( ) ) {
+        result = "Error closing file \""s + filename_ + "\".";
     }
 
     fp_ = NULL;
@@ -367,12 +874,17 @@ std::string WaveFile::close ( ) {
     samplerate_ = 0;
     bitsPerSample_ = 0;
     channels_ = 0;
+    isFloat_ = false;
     samples_ = 0;
     readNotWrite_ = true;
     dataLength_ = 0;
     startOfData_ = 0;
 
-    return "";
+    return result;
+}
+
+bool WaveFile::hasFailed ( ) const {
+    return async_ != nullptr && async_->failed.load ( std::memory_order_acquire );
 }
 
 std::string WaveFile::write ( void const *data, unsigned long samples ) {
@@ -381,6 +893,47 @@ std::string WaveFile::write ( void const *data, unsigned long samples ) {
     }
 
     unsigned long bytesPerSample = getBytesPerSample ( );
+
+    if ( async_ ) {
+        AsyncWriter &w = *async_;
+
+        if ( w.failed.load ( std::memory_order_acquire ) ) {
+            return w.error;
+        }
+
+        std::byte const *src = static_cast<std::byte const *> ( data );
+        size_t bytes = static_cast<size_t> ( samples ) * bytesPerSample * channels_;
+
+        while ( bytes > 0 ) {
+            unsigned long long block = w.filled.load ( std::memory_order_relaxed );
+
+            // wait until the writer has emptied the buffer, this only happens when it falls behind by the whole ring
+            for ( ;; ) {
+                unsigned long long written = w.written.load ( std::memory_order_acquire );
+                if ( block - written < w.buffers.size ( ) ) {
+                    break;
+                }
+                w.written.wait ( written, std::memory_order_acquire );
+            }
+
+            size_t n = std::min ( bytes, w.blockBytes - w.fill );
+            memcpy ( w.buffers[block % w.buffers.size ( )] + w.fill, src, n );
+            w.fill += n;
+            src += n;
+            bytes -= n;
+
+            if ( w.fill == w.blockBytes ) {
+                w.fill = 0;
+                w.filled.store ( block + 1, std::memory_order_release );
+                w.filled.notify_one ( );
+            }
+        }
+
+        samples_ += samples;
+        dataLength_ = samples_ * bytesPerSample * channels_;
+
+        return "";
+    }
     int blocksize = samples * bytesPerSample * channels_;
 
     if ( fwrite ( data, static_cast<size_t> ( blocksize ), 1, fp_ ) != 1 ) {
@@ -407,6 +960,12 @@ unsigned long WaveFile::read ( unsigned long samples, void *data ) {
         samplesToRead = samples;
     }
 
+    if ( map_ != NULL ) {
+        std::span<std::byte const> frames = view ( static_cast<unsigned long> ( samplesToRead ) );
+        memcpy ( data, frames.data ( ), frames.size ( ) );
+        return static_cast<unsigned long> ( frames.size ( ) / blocksize );
+    }
+
     unsigned long samplesRead = static_cast<unsigned long> ( fread ( data, blocksize, static_cast<size_t> ( samplesToRead ), fp_ ) );
     if (samplesRead == 0 ) {
         return 0;
@@ -417,6 +976,77 @@ unsigned long WaveFile::read ( unsigned long samples, void *data ) {
     return samplesRead;
 }
 
+cwASIOSampleType WaveFile::getSampleType ( ) const {
+    for ( Codec const &c : codecs ) {
+        if ( c.bits == bitsPerSample_ && c.isFloat == isFloat_ ) {
+            return c.type;
+        }
+    }
+    return ASIOSTLastEntry;
+}
+
+unsigned long WaveFile::readFloat ( float *const *channels, unsigned long samples ) {
+    return readAs ( ASIOSTFloat32LSB, reinterpret_cast<void *const *> ( channels ), samples );
+}
+
+unsigned long WaveFile::readAs ( cwASIOSampleType type, void *const *channels, unsigned long samples ) {
+    Codec const *from = codecOf ( getSampleType ( ) );
+    Codec const *to = codecOf ( type );
+
+    if ( fp_ == NULL || !readNotWrite_ || from == NULL || to == NULL ) {
+        return 0;
+    }
+
+    size_t bytes = getBytesPerSample ( );
+    size_t stride = bytes * channels_;
+    size_t outBytes = to->bits / 8;
+    unsigned long done = 0;
+
+    while ( done < samples ) {
+        // take the next chunk straight from the mapping, or read it into the chunk buffer
+        unsigned long wanted = static_cast<unsigned long> ( std::min<size_t> ( samples - done, chunkFrames ) );
+        std::byte const *frames = NULL;
+        size_t count = 0;
+
+        if ( map_ != NULL ) {
+            std::span<std::byte const> view = this->view ( wanted );
+            frames = view.data ( );
+            count = view.size ( ) / stride;
+        } else {
+            frames = chunk_.data ( );
+            count = read ( wanted, chunk_.data ( ) );
+        }
+
+        if ( count == 0 ) {
+            break;
+        }
+
+        for ( unsigned long c = 0; c < channels_; ++c ) {
+            if ( channels[c] == NULL ) {
+                continue;
+            }
+
+            std::byte const *src = frames + c * bytes;
+            std::byte *dst = static_cast<std::byte *> ( channels[c] ) + done * outBytes;
+
+            if ( from == to ) {             // no conversion, only deinterleave
+                for ( size_t i = 0; i < count; ++i ) {
+                    memcpy ( dst + i * outBytes, src + i * stride, outBytes );
+                }
+            } else if ( to->type == ASIOSTFloat32LSB ) {
+                from->decode ( src, stride, reinterpret_cast<float *> ( dst ), count );
+            } else {
+                from->decode ( src, stride, decoded_.data ( ), count );
+                to->encode ( decoded_.data ( ), dst, count );
+            }
+        }
+
+        done += static_cast<unsigned long> ( count );
+    }
+
+    return done;
+}
+
 bool WaveFile::setPosition ( long long samples, int origin ) {
     if ( fp_ == NULL ) {
         return false;
@@ -470,7 +1100,7 @@ bool WaveFile::setPositionRelative ( long long samples ) {
 
     long long position = static_cast<long long> ( blocksize ) * samples;
 
-    if ( fseek ( fp_, position, SEEK_CUR ) != 0 ) {
+    if ( map_ == NULL && fseek ( fp_, position, SEEK_CUR ) != 0 ) {
         return false;
     }
 
@@ -484,10 +1114,6 @@ bool WaveFile::setPositionAbsoluteForward ( unsigned long long samples ) {
         return false;
     }
 
-    if ( samples == 0 ) {
-        return true;
-    }
-
     if ( ( samples < 0 ) || ( samples > getTotalSamples ( ) ) ) {
         return false;
     }
@@ -497,7 +1123,7 @@ bool WaveFile::setPositionAbsoluteForward ( unsigned long long samples ) {
 
     long long position = static_cast<long long> ( blocksize ) * static_cast<long long> ( samples );
 
-    if ( fseek ( fp_, startOfData_ + position, SEEK_SET ) != 0 ) {
+    if ( map_ == NULL && fseek ( fp_, startOfData_ + position, SEEK_SET ) != 0 ) {
         return false;
     }
 
@@ -511,10 +1137,6 @@ bool WaveFile::setPositionAbsoluteBackward ( unsigned long long samples ) {
         return false;
     }
 
-    if ( samples == 0 ) {
-        return true;
-    }
-
     if ( ( samples < 0 ) || ( samples > getTotalSamples ( ) ) ) {
         return false;
     }
@@ -524,7 +1146,7 @@ bool WaveFile::setPositionAbsoluteBackward ( unsigned long long samples ) {
 
     long long position = static_cast<long long> ( blocksize ) * static_cast<long long> ( samples );
 
-    if ( fseek ( fp_, startOfData_ + dataLength_ - position, SEEK_SET ) != 0 ) {
+    if ( map_ == NULL && fseek ( fp_, startOfData_ + dataLength_ - position, SEEK_SET ) != 0 ) {
         return false;
     }
 
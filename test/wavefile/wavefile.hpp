@@ -1,8 +1,13 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <filesystem>
+#include <memory>
+#include <span>
 #include <string>
+#include <vector>
+#include "cwASIOtypes.h"
 
 class WaveFile {
 public:
@@ -58,36 +63,81 @@ public:
     WaveFile ( );
     virtual ~WaveFile ( );
 
-    std::string open ( std::filesystem::path filename,  unsigned long samplerate, unsigned long bitsPerSample, unsigned long channels );
+    std::string open ( std::filesystem::path filename,  unsigned long samplerate, unsigned long bitsPerSample, unsigned long channels, bool isFloat = false );
     std::string open ( std::filesystem::path filename );
+    std::string openMapped ( std::filesystem::path filename );
+    std::string openAsync ( std::filesystem::path filename, unsigned long samplerate, unsigned long bitsPerSample, unsigned long channels,
+                            bool isFloat = false, size_t bufferBytes = 4 << 20, unsigned buffers = 8, unsigned long long extent = 256ULL << 20 );
     std::string close ( );
     std::string write ( void const *data, unsigned long samples );
     unsigned long read ( unsigned long samples, void *data );
+
+    // Typed reading: decodes up to the given number of frames at the current position into one
+    // buffer per channel, and advances the position like read ( ). Channels with a NULL buffer
+    // are skipped. The file's samples may be 16, 24 or 32-bit integers, or 32 or 64-bit floats.
+    // readAs ( ) delivers the little endian sample types Int16, Int24, Int32, Float32 and Float64,
+    // it returns 0 for other types. The work is done in chunks, without allocating memory.
+    unsigned long readFloat ( float *const *channels, unsigned long samples );
+    unsigned long readAs ( cwASIOSampleType type, void *const *channels, unsigned long samples );
     unsigned long long getPosition ( ) const { return samples_; }
     bool setPosition ( long long samples, int origin );
 
+    // Memory mapped reading, after opening with openMapped ( ): view ( ) returns up to the given
+    // number of frames at the current position without copying, and advances the position like
+    // read ( ). The pages ahead of the position are prefetched, readahead is the prefetch window.
+    bool isMapped ( ) const { return map_ != NULL; }
+    std::span<std::byte const> view ( unsigned long samples );
+    void setReadahead ( size_t bytes ) { readahead_ = bytes; }
+
+    // Asynchronous writing, after opening with openAsync ( ): write ( ) only copies into a ring of
+    // large aligned buffers, and a writer thread puts full buffers into the file, bypassing the page
+    // cache where possible. The file is preallocated in steps of extent bytes (not at all for 0), and the header is updated
+    // every headerInterval, so an interrupted recording stays readable. write ( ) waits for the
+    // writer only when the whole ring is full.
+    bool isAsync ( ) const { return async_ != nullptr; }
+    bool hasFailed ( ) const;       // asynchronous writing failed, write ( ) and close ( ) return the error
+    void setHeaderInterval ( double seconds ) { headerInterval_ = seconds; }
+
     std::string getFilename ( ) const { return filename_; }
     unsigned long getSamplerate ( ) const { return samplerate_; }
     unsigned long getBitsPerSample ( ) const { return bitsPerSample_; }
     unsigned long getBytesPerSample ( ) const { return bitsPerSample_ / 8 + ((bitsPerSample_ % 8) ? 1 : 0); }
     unsigned long getChannels ( ) const { return channels_; }
+    bool isFloat ( ) const { return isFloat_; }     // IEEE float rather than PCM integer samples
+    cwASIOSampleType getSampleType ( ) const;       // of the samples in the file, ASIOSTLastEntry if unsupported
     unsigned long long getTotalSamples ( ) const { return dataLength_ / getBytesPerSample ( ) / channels_; }
 
 private:
     std::string writeHeaders ( FILE* fp, unsigned long bitsPerSample, unsigned long samplerate, unsigned long channels, unsigned long long samplesWritten );
     std::string readHeaders  ( FILE* fp );
-    std::string searchChunk  ( FILE* fp, char const *identifier );
     bool setPositionRelative ( long long samples );
     bool setPositionAbsoluteForward ( unsigned long long samples );
     bool setPositionAbsoluteBackward ( unsigned long long samples );
+    struct AsyncWriter;
+    std::string finishAsync ( );
+    void runAsyncWriter ( );
+    std::string mapData ( );
+    void unmapData ( );
+    void prefetch ( unsigned long long offset );
 
     FILE* fp_;
     std::string filename_;
     unsigned long samplerate_;
     unsigned long bitsPerSample_;
     unsigned long channels_;
+    bool isFloat_;
     unsigned long long samples_;
     bool readNotWrite_;
     unsigned long long dataLength_;
     unsigned long startOfData_;
+    std::byte const *map_;      // whole file, when memory mapped
+    size_t mapLength_;
+    void *mapHandle_;           // file mapping object on Windows
+    size_t readahead_;
+    unsigned long long prefetchBegin_;  // byte range already prefetched
+    unsigned long long prefetchEnd_;
+    std::unique_ptr<AsyncWriter> async_;
+    double headerInterval_;
+    std::vector<std::byte> chunk_;  // typed reading: file samples, when not memory mapped
+    std::vector<float> decoded_;    // typed reading: one channel of a chunk
 };
@@ -0,0 +1,100 @@
+/** @file       wire.cpp
+ *  @brief      cwASIO passthrough using the blocking stream
+ *  @author     Stefan Heinzmann
+ *  @version    1.0
+ *  @date       2023-2025
+ *  @copyright  See file LICENSE in toplevel directory
+ * @addtogroup cwASIO_test
+ *  @{
+ *
+ * Copies input channels to output channels, reading and writing a
+ * `cwASIO::Stream` from the main thread instead of working in the callbacks.
+ * Runs for the given number of seconds, or until interrupted if that is 0, and
+ * reports the overflows and underflows of the stream at the end.
+ */
+
+#include "cwASIOstream.hpp"
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std::literals;
+
+static std::sig_atomic_t volatile signalStatus = 0;
+
+
+static void signalHandler(int signal) {
+    signalStatus = signal;
+}
+
+int main(int argc, char const *argv[]) {
+    if(argc < 4) {
+        std::cout << "Usage: wire <ASIO device> <seconds> <input channel>:<output channel> ...\n";
+        return 1;
+    }
+
+    try {
+        std::error_code ec;
+        cwASIO::Device driver(argv[1]);
+        double seconds = strtod(argv[2], nullptr);
+        std::vector<long> inputs, outputs;
+        for(int i = 3; i < argc; ++i) {
+            char *end;
+            inputs.push_back(strtol(argv[i], &end, 10));
+            if(*end != ':')
+                throw std::runtime_error("channel pair expected instead of "s + argv[i]);
+            outputs.push_back(strtol(end + 1, nullptr, 10));
+        }
+
+        cwASIODriverInfo driverinfo = driver.init(nullptr);
+        if(driverinfo.errorMessage[0] != '\0')
+            throw std::runtime_error("Can't init driver "s + driverinfo.name + ": " + driverinfo.errorMessage);
+
+        auto [_0, _1, preferredSize, _2] = driver.getBufferSize(ec);
+        if(ec)
+            throw std::system_error(ec, "when reading supported buffer sizes");
+
+        double samplerate = driver.getSampleRate(ec);
+        if(ec)
+            throw std::system_error(ec, "when reading sampling rate");
+
+        cwASIO::Stream stream(driver, inputs, outputs, preferredSize);
+        std::vector<std::vector<float>> buffers(inputs.size(), std::vector<float>(preferredSize));
+        std::vector<float *> pointers;
+        for(auto &b : buffers)
+            pointers.push_back(b.data());
+
+        // one period of silence ahead, so that writing doesn't fall behind
+        std::vector<float const *> silence(outputs.size(), nullptr);
+        stream.write(silence.data(), preferredSize);
+
+        std::signal(SIGINT, signalHandler);
+        if(auto err = stream.start())
+            throw std::system_error(err, cwASIO::err_category(), "when trying to start streaming");
+
+        std::cout << "Wiring " << inputs.size() << " channel(s) of " << driver.getDriverName()
+            << " at " << samplerate << " Hz, buffer size " << preferredSize << "\n";
+
+        size_t limit = seconds > 0. ? size_t(seconds * samplerate) : SIZE_MAX;
+        size_t frames = 0;
+        while(frames < limit && signalStatus == 0) {
+            size_t n = stream.read(pointers.data(), preferredSize);
+            if(stream.write(pointers.data(), n) < n)
+                break;
+            frames += n;
+        }
+        stream.stop();
+
+        std::cout << frames << " frames, " << stream.overflows() << " overflows, " << stream.underflows() << " underflows\n";
+    } catch(std::exception &ex) {
+        std::cerr << "Error: " << ex.what() << "\n";
+        return 2;
+    }
+    return 0;
+}
+
+/** @}*/